@@ -0,0 +1,608 @@
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+// Minimal stand-in for the parts of the Arduino core that the generated
+// code uses, for the native PlatformIO environment (JUNIPER_HOST). Pins are
+// plain arrays that host code can drive directly, Serial writes to stdout,
+// and time comes either from the monotonic clock or from a fake clock that
+// is only advanced by hand. Pin reads can also be fed from a recorded trace.
+// All of this state is per thread, so parallel replay can run one sketch
+// instance on each worker without them seeing each other's pins or clocks.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define LOW 0x0
+#define HIGH 0x1
+
+#define HOST_NUM_PINS 64
+
+// Analog inputs are numbered after the Uno's 14 digital pins.
+static const uint8_t A0 = 14;
+static const uint8_t A1 = 15;
+static const uint8_t A2 = 16;
+static const uint8_t A3 = 17;
+static const uint8_t A4 = 18;
+static const uint8_t A5 = 19;
+static const uint8_t A6 = 20;
+static const uint8_t A7 = 21;
+
+// The simulated sampling timer counts at an Uno's clock unless told
+// otherwise, so achieved rates match the board's.
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+namespace host {
+    struct pins {
+        uint8_t mode[HOST_NUM_PINS];
+        uint8_t digital[HOST_NUM_PINS];
+        uint16_t analog[HOST_NUM_PINS];
+    };
+
+    inline pins &pinState() {
+        static thread_local pins state;
+        return state;
+    }
+
+    struct clock {
+        bool fake;
+        uint64_t fakeMicros;
+    };
+
+    inline clock &clockState() {
+        static thread_local clock state = { false, 0 };
+        return state;
+    }
+
+    // Simulated pin change interrupts. enablePinChange records the handler
+    // the firmware installs for a pin; injectEdge then drives the pin the way
+    // hardware would and, when its level changes, calls the handler as the
+    // interrupt would.
+    typedef void (*pin_change_handler)();
+
+    inline pin_change_handler *pinChangeHandlers() {
+        static thread_local pin_change_handler handlers[HOST_NUM_PINS];
+        return handlers;
+    }
+
+    inline void enablePinChange(uint8_t pin, pin_change_handler handler) {
+        pinChangeHandlers()[pin % HOST_NUM_PINS] = handler;
+    }
+
+    inline void injectEdge(uint8_t pin, uint8_t value) {
+        pin %= HOST_NUM_PINS;
+        bool changed = pinState().digital[pin] != value;
+        pinState().digital[pin] = value;
+        if (changed && pinChangeHandlers()[pin] != NULL) {
+            pinChangeHandlers()[pin]();
+        }
+    }
+
+    // Switches micros()/millis() over to a clock that only moves when
+    // advanceMicros is called, so long running behaviour can be tested
+    // without waiting for it.
+    inline void useFakeClock(uint64_t startMicros) {
+        clockState().fake = true;
+        clockState().fakeMicros = startMicros;
+    }
+
+    inline void advanceMicros(uint64_t us) {
+        clockState().fakeMicros += us;
+    }
+
+    // Real elapsed time, whichever clock the sketch is running on.
+    inline uint64_t wallMicros() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+    }
+
+    // Free running counter for profiling short stretches of code: the time
+    // stamp counter on x86, the virtual counter on ARM64 and nanoseconds
+    // anywhere else. Unlike micros() it is never faked, since it measures
+    // work done rather than sketch time.
+    inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t v;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+        return v;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+    }
+
+    inline uint64_t nowMicros() {
+        if (clockState().fake) {
+            return clockState().fakeMicros;
+        }
+        return wallMicros();
+    }
+
+    // Simulated hardware timer. startTimer records the handler the firmware
+    // installs and its period in counts of a clockHz timer clock;
+    // serviceTimer then calls the handler once for every period that has
+    // elapsed on the host clock, as the compare interrupt would have. There
+    // are no interrupts on the host, so firmware calls serviceTimer before
+    // looking at what the handler produced. Elapsed time is read once per
+    // call, so a handler that moves the clock (a replayed read) cannot keep
+    // it running. During a replay only replayed reads move the fake clock,
+    // and when the handler is what reads, nothing would ever start it; so
+    // with jumpWhenIdle a call that finds no period elapsed jumps the fake
+    // clock to the end of the next one, as if the loop had waited for it.
+    typedef void (*timer_handler)();
+
+    struct timer {
+        timer_handler handler;
+        uint64_t clockHz;
+        uint32_t periodTicks;
+        uint64_t startMicros;
+        uint64_t nextTick;
+        bool jumpWhenIdle;
+    };
+
+    inline timer &timerState() {
+        static thread_local timer state = { NULL, 1, 1, 0, 0, false };
+        return state;
+    }
+
+    inline void startTimer(uint64_t clockHz, uint32_t periodTicks, timer_handler handler) {
+        timer &t = timerState();
+        t.handler = handler;
+        t.clockHz = clockHz;
+        t.periodTicks = (periodTicks > 0) ? periodTicks : 1;
+        t.startMicros = nowMicros();
+        t.nextTick = t.periodTicks;
+    }
+
+    inline void serviceTimer() {
+        timer &t = timerState();
+        if (t.handler == NULL) {
+            return;
+        }
+        uint64_t elapsed = nowMicros() - t.startMicros;
+        uint64_t ticks = (elapsed / 1000000ULL) * t.clockHz + (elapsed % 1000000ULL) * t.clockHz / 1000000ULL;
+        if (t.nextTick > ticks && t.jumpWhenIdle && clockState().fake) {
+            uint64_t due = (t.nextTick / t.clockHz) * 1000000ULL + ((t.nextTick % t.clockHz) * 1000000ULL + t.clockHz - 1) / t.clockHz;
+            advanceMicros(due - elapsed);
+            ticks = t.nextTick;
+        }
+        while (t.nextTick <= ticks) {
+            t.nextTick += t.periodTicks;
+            t.handler();
+        }
+    }
+
+    // Simulated UART behind Serial. With a rate of zero (the default) output
+    // is unlimited. Otherwise bytes leave a 64 byte transmit buffer, like the
+    // AVR core's, at bytesPerSecond, and writes into a full buffer block
+    // until a slot frees up (on the fake clock that wait advances time).
+    struct uart {
+        uint32_t bytesPerSecond;
+        uint16_t bufferSize;
+        uint64_t busyUntil;
+        uint64_t bytesWritten;
+    };
+
+    inline uart &uartState() {
+        static thread_local uart state = { 0, 64, 0, 0 };
+        return state;
+    }
+
+    // 8N1 framing puts ten bits on the wire for every byte.
+    inline void simulateUart(uint32_t baud) {
+        uartState().bytesPerSecond = baud / 10;
+        uartState().busyUntil = nowMicros();
+    }
+
+    inline int uartRoom() {
+        uart &u = uartState();
+        if (u.bytesPerSecond == 0) {
+            return u.bufferSize - 1;
+        }
+        uint64_t now = nowMicros();
+        uint64_t pending = (u.busyUntil > now) ?
+            ((u.busyUntil - now) * u.bytesPerSecond + 999999ULL) / 1000000ULL : 0;
+        return (pending >= u.bufferSize) ? 0 : (int) (u.bufferSize - pending);
+    }
+
+    inline void uartPush() {
+        uart &u = uartState();
+        u.bytesWritten++;
+        if (u.bytesPerSecond == 0) {
+            return;
+        }
+        while (uartRoom() == 0) {
+            if (clockState().fake) {
+                advanceMicros(1000000ULL / u.bytesPerSecond);
+            }
+        }
+        uint64_t now = nowMicros();
+        uint64_t start = (u.busyUntil > now) ? u.busyUntil : now;
+        u.busyUntil = start + 1000000ULL / u.bytesPerSecond;
+    }
+
+    // Trace files are a fixed 16 byte header followed by raw 8 byte records,
+    // all little-endian. This is exactly what the JUNIPER_CAPTURE build
+    // writes over Serial, so a dump of the port is a trace file. A count of
+    // zero means the records run to the end of the file, which is what the
+    // device writes since it cannot know the length up front.
+    struct trace_header {
+        char magic[4];
+        uint16_t version;
+        uint16_t recordBytes;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    // dropped counts the records the device could not send just before
+    // this one.
+    struct trace_sample {
+        uint32_t micros;
+        uint16_t value;
+        uint8_t pin;
+        uint8_t dropped;
+    };
+
+    // A trace mapped read-only into memory. Records are used in place, so
+    // traces larger than RAM stream through the page cache at disk speed.
+    struct trace_file {
+        void *base;
+        size_t bytes;
+        const trace_sample *samples;
+        size_t count;
+    };
+
+    // A run of consecutive records inside a mapped trace. No copies are made.
+    struct trace_block {
+        const trace_sample *samples;
+        size_t count;
+    };
+
+    inline bool mapTrace(const char *path, trace_file &trace) {
+        trace.base = NULL;
+        trace.bytes = 0;
+        trace.samples = NULL;
+        trace.count = 0;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(trace_header)) {
+            close(fd);
+            return false;
+        }
+        void *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        const trace_header *header = (const trace_header *) base;
+        if (memcmp(header->magic, "SBTR", 4) != 0 || header->version != 1 ||
+            header->recordBytes != sizeof(trace_sample)) {
+            munmap(base, (size_t) st.st_size);
+            return false;
+        }
+        madvise(base, (size_t) st.st_size, MADV_SEQUENTIAL);
+        size_t available = ((size_t) st.st_size - sizeof(trace_header)) / sizeof(trace_sample);
+        trace.base = base;
+        trace.bytes = (size_t) st.st_size;
+        trace.samples = (const trace_sample *) ((const uint8_t *) base + sizeof(trace_header));
+        trace.count = (header->count != 0 && header->count < available) ? header->count : available;
+        return true;
+    }
+
+    inline void unmapTrace(trace_file &trace) {
+        if (trace.base != NULL) {
+            munmap(trace.base, trace.bytes);
+        }
+        trace.base = NULL;
+        trace.samples = NULL;
+        trace.count = 0;
+    }
+
+    inline trace_block traceBlock(const trace_file &trace, size_t first, size_t n) {
+        trace_block block = { trace.samples, 0 };
+        if (first < trace.count) {
+            block.samples = trace.samples + first;
+            block.count = (n < trace.count - first) ? n : trace.count - first;
+        }
+        return block;
+    }
+
+    // Replay of a captured trace, enabled by SOUNDBAR_REPLAY=path. A read of
+    // the pin the next record was captured from consumes it: the pin takes
+    // its value and the fake clock moves by its timestamp delta, so the
+    // pipeline sees the capture exactly, only as fast as the host runs it.
+    // A record of a pin this build has not read is skipped, consumed the same
+    // way but counted, once a read of some other pin comes round again while
+    // it waits: a whole pass went by without its pin, so a trace with pins
+    // the build never reads still plays through instead of stalling.
+    // Records are pulled a block at a time from the mapping. While a replay
+    // runs, every write to an output pin is folded into an FNV-1a digest as
+    // it happens; two builds agree on the digest exactly when they made the
+    // same writes to the bar for every sample. A whole-file replay reports
+    // and exits when the records run out; a segment replay only sets done.
+    struct replay {
+        trace_file trace;
+        trace_block block;
+        size_t consumed;
+        size_t next;
+        uint32_t lastMicros;
+        uint64_t readPins;
+        uint64_t waitingPins;
+        uint64_t skipPins;
+        uint64_t skipped;
+        uint64_t dropped;
+        uint64_t digest;
+        uint64_t startWall;
+        bool exitWhenDone;
+        bool done;
+    };
+
+    const size_t replayBlockSamples = 4096;
+    const uint64_t digestSeed = 14695981039346656037ULL;
+
+    inline replay &replayState() {
+        static thread_local replay state = { { NULL, 0, NULL, 0 }, { NULL, 0 }, 0, 0, 0, 0, 0, 0, 0, 0, digestSeed, 0, false, false };
+        return state;
+    }
+
+    inline void foldWrite(uint8_t pin, uint16_t value) {
+        replay &r = replayState();
+        if (r.trace.samples == NULL || r.done || pinState().mode[pin] != OUTPUT) {
+            return;
+        }
+        r.digest = (r.digest ^ pin) * 1099511628211ULL;
+        r.digest = (r.digest ^ (value & 0xFF)) * 1099511628211ULL;
+        r.digest = (r.digest ^ (value >> 8)) * 1099511628211ULL;
+    }
+
+    inline bool startReplay(const char *path) {
+        replay &r = replayState();
+        if (!mapTrace(path, r.trace)) {
+            return false;
+        }
+        r.block = traceBlock(r.trace, 0, replayBlockSamples);
+        r.lastMicros = (r.trace.count > 0) ? r.trace.samples[0].micros : 0;
+        r.exitWhenDone = true;
+        useFakeClock(r.lastMicros);
+        timerState().jumpWhenIdle = true;
+        r.startWall = wallMicros();
+        return true;
+    }
+
+    // Starts this thread replaying a block of an already mapped trace, from
+    // fresh pins, clock and digest.
+    inline void startSegment(const trace_block &segment) {
+        pins fresh = {};
+        pinState() = fresh;
+        replay &r = replayState();
+        trace_file view = { NULL, 0, segment.samples, segment.count };
+        r.trace = view;
+        r.block = traceBlock(r.trace, 0, replayBlockSamples);
+        r.consumed = 0;
+        r.next = 0;
+        r.lastMicros = (segment.count > 0) ? segment.samples[0].micros : 0;
+        r.readPins = 0;
+        r.waitingPins = 0;
+        r.skipPins = 0;
+        r.skipped = 0;
+        r.dropped = 0;
+        r.digest = digestSeed;
+        r.startWall = wallMicros();
+        r.exitWhenDone = false;
+        r.done = false;
+        useFakeClock(r.lastMicros);
+        timerState().jumpWhenIdle = true;
+    }
+
+    inline void finishReplay() {
+        replay &r = replayState();
+        uint64_t elapsed = wallMicros() - r.startWall;
+        fprintf(stderr, "replay: %lu samples in %.3f s, %.0f samples/s, %llu skipped, %llu dropped in capture, bar digest %016llx\n",
+            (unsigned long) r.trace.count, elapsed / 1e6,
+            (elapsed > 0) ? r.trace.count * 1e6 / elapsed : 0.0,
+            (unsigned long long) r.skipped, (unsigned long long) r.dropped, (unsigned long long) r.digest);
+        fflush(stdout);
+        unmapTrace(r.trace);
+        exit(0);
+    }
+
+    // The next record, pulling in the next block when this one is used up.
+    // Returns NULL and finishes the replay when there are no more.
+    inline const trace_sample *nextRecord() {
+        replay &r = replayState();
+        if (r.next == r.block.count) {
+            r.consumed += r.block.count;
+            r.block = traceBlock(r.trace, r.consumed, replayBlockSamples);
+            r.next = 0;
+            if (r.block.count == 0) {
+                r.done = true;
+                if (r.exitWhenDone) {
+                    finishReplay();
+                }
+                return NULL;
+            }
+        }
+        return &r.block.samples[r.next];
+    }
+
+    inline void applyRecord(const trace_sample &s) {
+        replay &r = replayState();
+        uint8_t pin = s.pin % HOST_NUM_PINS;
+        r.next++;
+        r.dropped += s.dropped;
+        advanceMicros((uint32_t) (s.micros - r.lastMicros));
+        r.lastMicros = s.micros;
+        pinState().digital[pin] = (s.value != 0) ? HIGH : LOW;
+        pinState().analog[pin] = s.value;
+    }
+
+    inline void replayRead(uint8_t pin) {
+        replay &r = replayState();
+        if (r.trace.samples == NULL || r.done) {
+            return;
+        }
+        r.readPins |= 1ULL << pin;
+        const trace_sample *s;
+        while ((s = nextRecord()) != NULL) {
+            uint8_t recordPin = s->pin % HOST_NUM_PINS;
+            if (recordPin == pin) {
+                applyRecord(*s);
+                r.waitingPins = 0;
+                return;
+            }
+            bool unread = !((r.readPins >> recordPin) & 1);
+            if (!unread || !(((r.skipPins >> recordPin) | (r.waitingPins >> pin)) & 1)) {
+                // Another pin's turn; its own read should consume it.
+                r.waitingPins |= 1ULL << pin;
+                return;
+            }
+            applyRecord(*s);
+            r.skipPins |= 1ULL << recordPin;
+            r.skipped++;
+        }
+    }
+
+    // Number of passes the main loop should make before the host build
+    // reports and exits, taken from SOUNDBAR_LOOPS. Zero means forever.
+    inline uint32_t loopLimit() {
+        static uint32_t limit = getenv("SOUNDBAR_LOOPS") ? (uint32_t) strtoul(getenv("SOUNDBAR_LOOPS"), NULL, 10) : 0;
+        return limit;
+    }
+}
+
+inline void init() {
+    const char *path = getenv("SOUNDBAR_REPLAY");
+    if (path != NULL && !host::startReplay(path)) {
+        fprintf(stderr, "replay: %s is not a readable trace file\n", path);
+        exit(1);
+    }
+}
+
+inline unsigned long micros() {
+    return (unsigned long) (uint32_t) host::nowMicros();
+}
+
+inline unsigned long millis() {
+    return (unsigned long) (uint32_t) (host::nowMicros() / 1000ULL);
+}
+
+inline void delayMicroseconds(unsigned int us) {
+    if (host::clockState().fake) {
+        host::advanceMicros(us);
+    } else {
+        struct timespec ts = { (time_t) (us / 1000000UL), (long) (us % 1000000UL) * 1000L };
+        nanosleep(&ts, NULL);
+    }
+}
+
+inline void delay(unsigned long ms) {
+    if (host::clockState().fake) {
+        host::advanceMicros((uint64_t) ms * 1000ULL);
+    } else {
+        struct timespec ts = { (time_t) (ms / 1000UL), (long) (ms % 1000UL) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+    host::pinState().mode[pin % HOST_NUM_PINS] = mode;
+}
+
+inline int digitalRead(uint8_t pin) {
+    host::replayRead(pin % HOST_NUM_PINS);
+    return host::pinState().digital[pin % HOST_NUM_PINS];
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+    host::pinState().digital[pin % HOST_NUM_PINS] = value;
+    host::foldWrite(pin % HOST_NUM_PINS, value);
+}
+
+inline int analogRead(uint8_t pin) {
+    host::replayRead(pin % HOST_NUM_PINS);
+    return host::pinState().analog[pin % HOST_NUM_PINS];
+}
+
+inline void analogWrite(uint8_t pin, int value) {
+    host::pinState().analog[pin % HOST_NUM_PINS] = (uint16_t) value;
+    host::foldWrite(pin % HOST_NUM_PINS, (uint16_t) value);
+}
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class HostSerial {
+public:
+    void begin(unsigned long) {}
+    void flush() { fflush(stdout); }
+    int available() { return 0; }
+    int read() { return -1; }
+    // On the fake clock nothing else moves time, so polling a full UART lets
+    // one byte time pass; otherwise a blocking writer would spin forever.
+    int availableForWrite() {
+        int room = host::uartRoom();
+        if (room == 0 && host::clockState().fake) {
+            host::advanceMicros(1000000ULL / host::uartState().bytesPerSecond);
+            room = host::uartRoom();
+        }
+        return room;
+    }
+
+    size_t write(uint8_t c) {
+        host::uartPush();
+        return fwrite(&c, 1, 1, stdout);
+    }
+
+    size_t write(const uint8_t *buf, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            write(buf[i]);
+        }
+        return n;
+    }
+
+    size_t print(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(int n) { return format("%d", n); }
+    size_t print(unsigned int n) { return format("%u", n); }
+    size_t print(long n) { return format("%ld", n); }
+    size_t print(unsigned long n) { return format("%lu", n); }
+    size_t print(double d) { return format("%.2f", d); }
+
+    template<typename T>
+    size_t println(T value) { return print(value) + println(); }
+    size_t println() { return print("\r\n"); }
+
+private:
+    template<typename T>
+    size_t format(const char *fmt, T value) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), fmt, value);
+        return write((const uint8_t *) buf, (n < 0) ? 0 : (size_t) n);
+    }
+};
+
+static HostSerial Serial;
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef HOST_REPLAY_H
+#define HOST_REPLAY_H
+
+// Parallel replay for the native build. A mapped trace is cut into fixed
+// size segments and each segment is replayed by a freshly made pipeline
+// instance. Host pins, clock and replay state are thread local (see
+// ArduinoHost.h), as are the sketch's serial queue, telemetry, profiling
+// and memory counters (JUNIPER_THREAD_LOCAL), so each worker thread of a
+// work-stealing pool runs one instance at a time without sharing anything
+// but the read-only mapping.
+
+#include "ArduinoHost.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace host {
+    // Each worker owns a deque of task indices. It takes work from the back
+    // of its own deque and, once that is empty, steals from the front of the
+    // others. No tasks are added once the pool is running, so a worker that
+    // finds every deque empty is done.
+    class work_pool {
+    public:
+        explicit work_pool(unsigned threads)
+            : queues_(threads ? threads : 1)
+        { }
+
+        template<typename Task>
+        void run(size_t tasks, Task task) {
+            for (size_t i = 0; i < tasks; i++) {
+                queues_[i % queues_.size()].items.push_back(i);
+            }
+            std::vector<std::thread> workers;
+            for (size_t w = 0; w < queues_.size(); w++) {
+                workers.push_back(std::thread([this, w, &task]() {
+                    size_t item;
+                    while (take(w, item)) {
+                        task(item);
+                    }
+                }));
+            }
+            for (size_t w = 0; w < workers.size(); w++) {
+                workers[w].join();
+            }
+        }
+
+        uint64_t steals() const { return steals_; }
+
+    private:
+        struct queue {
+            std::mutex lock;
+            std::deque<size_t> items;
+        };
+
+        bool take(size_t self, size_t &item) {
+            {
+                std::lock_guard<std::mutex> guard(queues_[self].lock);
+                if (!queues_[self].items.empty()) {
+                    item = queues_[self].items.back();
+                    queues_[self].items.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < queues_.size(); i++) {
+                queue &victim = queues_[(self + i) % queues_.size()];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (!victim.items.empty()) {
+                    item = victim.items.front();
+                    victim.items.pop_front();
+                    steals_++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::vector<queue> queues_;
+        std::atomic<uint64_t> steals_{0};
+    };
+
+    struct segment_result {
+        uint64_t digest;
+        size_t samples;
+    };
+
+    // Replays every segment of trace on threads workers. make returns a new
+    // pipeline instance, setup and step take one by reference and run its
+    // setup and one pass of its loop. The combined digest folds the segment
+    // digests in segment order, so it does not depend on scheduling and can
+    // be compared across thread counts.
+    template<typename Make, typename Setup, typename Step>
+    uint64_t replaySegments(const trace_file &trace, size_t segmentSamples, unsigned threads,
+                            Make make, Setup setup, Step step) {
+        size_t segments = (trace.count + segmentSamples - 1) / segmentSamples;
+        std::vector<segment_result> results(segments);
+        work_pool pool(threads);
+        uint64_t start = wallMicros();
+        pool.run(segments, [&](size_t i) {
+            startSegment(traceBlock(trace, i * segmentSamples, segmentSamples));
+            auto instance = make();
+            setup(instance);
+            while (!replayState().done) {
+                step(instance);
+            }
+            results[i].digest = replayState().digest;
+            results[i].samples = replayState().trace.count;
+        });
+        uint64_t elapsed = wallMicros() - start;
+        uint64_t digest = digestSeed;
+        size_t samples = 0;
+        for (size_t i = 0; i < segments; i++) {
+            for (int b = 0; b < 64; b += 8) {
+                digest = (digest ^ ((results[i].digest >> b) & 0xFF)) * 1099511628211ULL;
+            }
+            samples += results[i].samples;
+        }
+        fprintf(stderr, "parallel replay: %u threads, %lu segments of %lu byte instances, %lu samples in %.3f s, %.0f samples/s, %lu steals, digest %016llx\n",
+            threads, (unsigned long) segments, (unsigned long) sizeof(make()), (unsigned long) samples, elapsed / 1e6,
+            (elapsed > 0) ? samples * 1e6 / elapsed : 0.0,
+            (unsigned long) pool.steals(), (unsigned long long) digest);
+        return digest;
+    }
+
+    // Runs the mapped SOUNDBAR_REPLAY trace with 1, 2, 4, ... up to
+    // SOUNDBAR_THREADS workers, so the report shows how throughput scales.
+    // Segments are SOUNDBAR_SEGMENT samples long (65536 by default).
+    template<typename Make, typename Setup, typename Step>
+    void parallelReplay(Make make, Setup setup, Step step) {
+        unsigned maxThreads = (unsigned) strtoul(getenv("SOUNDBAR_THREADS"), NULL, 10);
+        maxThreads = (maxThreads > 0) ? maxThreads : 1;
+        const char *segmentEnv = getenv("SOUNDBAR_SEGMENT");
+        size_t segmentSamples = segmentEnv ? (size_t) strtoul(segmentEnv, NULL, 10) : 65536;
+        trace_file trace = replayState().trace;
+        if (trace.samples == NULL || segmentSamples == 0) {
+            fprintf(stderr, "parallel replay: needs SOUNDBAR_REPLAY and a nonzero SOUNDBAR_SEGMENT\n");
+            exit(1);
+        }
+        uint64_t first = 0;
+        bool consistent = true;
+        for (unsigned threads = 1; ; threads *= 2) {
+            if (threads > maxThreads) {
+                threads = maxThreads;
+            }
+            uint64_t digest = replaySegments(trace, segmentSamples, threads, make, setup, step);
+            consistent = consistent && (threads == 1 || digest == first);
+            first = (threads == 1) ? digest : first;
+            if (threads >= maxThreads) {
+                break;
+            }
+        }
+        unmapTrace(replayState().trace);
+        exit(consistent ? 0 : 1);
+    }
+}
+
+#endif
@@ -5,15 +5,80 @@
 #define JUNIPER_H
 
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define JUNIPER_PROGMEM PROGMEM
+#else
+#include <stdio.h>
+#define JUNIPER_PROGMEM
+#endif
+
+// Runtime state that is global on a board is kept per thread on the host,
+// so parallel replay workers each run against their own copy.
+#ifdef JUNIPER_HOST
+#define JUNIPER_THREAD_LOCAL thread_local
+#else
+#define JUNIPER_THREAD_LOCAL
+#endif
 
 namespace juniper
 {
+    // Heap accounting for the allocations the runtime makes itself: closures
+    // held by function and the objects adopted by shared_ptr. Only kept when
+    // building with JUNIPER_TRACK_MEMORY, otherwise the hooks are empty.
+    struct memory_stats
+    {
+        uint32_t liveAllocations;
+        uint32_t liveBytes;
+        uint32_t peakBytes;
+        uint32_t totalAllocations;
+    };
+
+    inline memory_stats &memoryStats() {
+        static JUNIPER_THREAD_LOCAL memory_stats stats = { 0, 0, 0, 0 };
+        return stats;
+    }
+
+    inline void track_alloc(size_t bytes) {
+#ifdef JUNIPER_TRACK_MEMORY
+        memory_stats &stats = memoryStats();
+        stats.liveAllocations++;
+        stats.totalAllocations++;
+        stats.liveBytes += bytes;
+        if (stats.liveBytes > stats.peakBytes) {
+            stats.peakBytes = stats.liveBytes;
+        }
+#endif
+    }
+
+    inline void track_free(size_t bytes) {
+#ifdef JUNIPER_TRACK_MEMORY
+        memory_stats &stats = memoryStats();
+        stats.liveAllocations--;
+        stats.liveBytes -= bytes;
+#endif
+    }
+
     template<typename Result, typename ...Args>
     struct abstract_function
     {
         virtual Result operator()(Args... args) = 0;
         virtual abstract_function *clone() const = 0;
         virtual ~abstract_function() = default;
+
+        // Deleting through the virtual destructor passes the size of the
+        // concrete closure, so the accounting matches the allocation.
+        static void *operator new(size_t bytes) {
+            track_alloc(bytes);
+            return ::operator new(bytes);
+        }
+
+        static void operator delete(void *p, size_t bytes) {
+            track_free(bytes);
+            ::operator delete(p);
+        }
     };
 
     template<typename Func, typename Result, typename ...Args>
@@ -99,118 +164,1198 @@ namespace juniper
         b = c;
     }
 
+    // Tag for shared_ptrs that point at statically allocated storage.
+    struct static_storage_t {};
+    constexpr static_storage_t static_storage{};
+
     template <typename contained>
     class shared_ptr {
     public:
         shared_ptr() : ptr_(NULL), ref_count_(NULL) { }
 
-        shared_ptr(contained * p)
-            : ptr_(p), ref_count_(new int)
-        {
-            *ref_count_ = 0;
-            inc_ref();
-        }
+        // No reference count is kept and the pointee is never deleted, so a
+        // global built this way is constant initialized instead of calling
+        // new during startup.
+        constexpr shared_ptr(contained * p, static_storage_t)
+            : ptr_(p), ref_count_(NULL)
+        { }
+
+        shared_ptr(contained * p)
+            : ptr_(p), ref_count_(new int)
+        {
+            track_alloc(sizeof(contained) + sizeof(int));
+            *ref_count_ = 0;
+            inc_ref();
+        }
+
+        shared_ptr(const shared_ptr& rhs)
+            : ptr_(rhs.ptr_), ref_count_(rhs.ref_count_)
+        {
+            inc_ref();
+        }
+
+        ~shared_ptr() {
+            if (ref_count_ && 0 == dec_ref()) {
+                if (ptr_) {
+                    delete ptr_;
+                }
+                delete ref_count_;
+                track_free(sizeof(contained) + sizeof(int));
+            }
+        }
+
+        void set(contained* p) {
+          ptr_ = p;
+        }
+
+        contained* get() { return ptr_; }
+        const contained* get() const { return ptr_; }
+
+        void swap(shared_ptr& rhs) {
+            juniper::swap(ptr_, rhs.ptr_);
+            juniper::swap(ref_count_, rhs.ref_count_);
+        }
+
+        shared_ptr& operator=(const shared_ptr& rhs) {
+            shared_ptr tmp(rhs);
+            this->swap(tmp);
+            return *this;
+        }
+
+        //contained& operator*() {
+        //    return *ptr_;
+        //}
+
+        contained* operator->() {
+            return ptr_;
+        }
+
+        bool operator==(const shared_ptr& rhs) const {
+            return ptr_ == rhs.ptr_;
+        }
+
+        bool operator!=(const shared_ptr& rhs) const { return !(rhs == *this); }
+    private:
+        void inc_ref() {
+            if (ref_count_) {
+                ++(*ref_count_);
+            }
+        }
+
+        int dec_ref() {
+            return --(*ref_count_);
+        }
+
+        contained * ptr_;
+        int * ref_count_;
+    };
+
+    template<typename T>
+    bool equal_range(const T *a, const T *b, size_t n);
+
+    template<typename T, size_t N>
+    class array {
+    public:
+        array<T, N>& fill(T fillWith) {
+            for (size_t i = 0; i < N; i++) {
+                data[i] = fillWith;
+            }
+
+            return *this;
+        }
+
+        T& operator[](int i) {
+            return data[i];
+        }
+
+        constexpr const T& operator[](int i) const {
+            return data[i];
+        }
+
+        bool operator==(const array<T, N>& rhs) const {
+            return equal_range<T>(data, rhs.data, N);
+        }
+
+        bool operator!=(const array<T, N>& rhs) const { return !(rhs == *this); }
+
+        T data[N];
+    };
+
+    // Reads a value out of program memory. On AVR flash lives in its own
+    // address space and has to be read with lpm; everywhere else (including
+    // host builds) constant data is ordinary memory and this is a plain load.
+    template<typename T, size_t size = sizeof(T)>
+    struct flash_reader
+    {
+        static T read(const T *p) {
+#ifdef __AVR__
+            T ret;
+            memcpy_P(&ret, p, sizeof(T));
+            return ret;
+#else
+            return *p;
+#endif
+        }
+    };
+
+#ifdef __AVR__
+    template<typename T>
+    struct flash_reader<T, 1>
+    {
+        static T read(const T *p) {
+            union { uint8_t raw; T value; } u;
+            u.raw = pgm_read_byte(p);
+            return u.value;
+        }
+    };
+    template<typename T>
+    struct flash_reader<T, 2>
+    {
+        static T read(const T *p) {
+            union { uint16_t raw; T value; } u;
+            u.raw = pgm_read_word(p);
+            return u.value;
+        }
+    };
+    template<typename T>
+    struct flash_reader<T, 4>
+    {
+        static T read(const T *p) {
+            union { uint32_t raw; T value; } u;
+            u.raw = pgm_read_dword(p);
+            return u.value;
+        }
+    };
+#endif
+
+    template<typename T>
+    T flash_read(const T *p) {
+        return flash_reader<T>::read(p);
+    }
+
+    // Constant table stored in program memory. Declare instances const and
+    // JUNIPER_PROGMEM at namespace scope, and only ever use them by reference:
+    // copying one reads flash addresses as if they were RAM.
+    template<typename T, size_t N>
+    struct flash_array
+    {
+        T operator[](int i) const {
+            return flash_read(&data[i]);
+        }
+
+        T data[N];
+    };
+
+    template<size_t ...Is>
+    struct index_sequence {};
+
+    template<typename A, typename B>
+    struct concat_sequence;
+    template<size_t ...A, size_t ...B>
+    struct concat_sequence<index_sequence<A...>, index_sequence<B...>>
+    {
+        typedef index_sequence<A..., (sizeof...(A) + B)...> type;
+    };
+
+    // Built by halving so instantiation depth stays logarithmic in N.
+    template<size_t N>
+    struct make_index_sequence
+    {
+        typedef typename concat_sequence<
+            typename make_index_sequence<N / 2>::type,
+            typename make_index_sequence<N - N / 2>::type>::type type;
+    };
+    template<>
+    struct make_index_sequence<0>
+    {
+        typedef index_sequence<> type;
+    };
+    template<>
+    struct make_index_sequence<1>
+    {
+        typedef index_sequence<0> type;
+    };
+
+    // constexpr array builders. These are restricted to the single return
+    // statement form of C++11 constexpr so that tables built from constant
+    // inputs are folded by the compiler instead of computed at startup.
+    template<typename T, size_t N, size_t ...Is>
+    constexpr array<T, N> fill_array(T value, index_sequence<Is...>) {
+        return array<T, N>{ { ((void) Is, value)... } };
+    }
+
+    template<typename T, size_t N>
+    constexpr array<T, N> fill_array(T value) {
+        return fill_array<T, N>(value, typename make_index_sequence<N>::type());
+    }
+
+    template<typename Result, typename T, size_t N, typename Func, size_t ...Is>
+    constexpr array<Result, N> map_array(Func f, const array<T, N> &a, index_sequence<Is...>) {
+        return array<Result, N>{ { f(a[Is])... } };
+    }
+
+    template<typename T, size_t N, size_t A, size_t B, size_t ...Is>
+    constexpr array<T, N> append_arrays(const array<T, A> &a, uint32_t lengthA, const array<T, B> &b, uint32_t lengthB, index_sequence<Is...>) {
+        return array<T, N>{ { ((Is < lengthA) ? a[Is] : ((Is - lengthA < lengthB) ? b[Is - lengthA] : T()))... } };
+    }
+
+    template<bool cond, typename TrueType, typename FalseType>
+    struct conditional
+    {
+        typedef TrueType type;
+    };
+    template<typename TrueType, typename FalseType>
+    struct conditional<false, TrueType, FalseType>
+    {
+        typedef FalseType type;
+    };
+
+    // Range information for the fixed width integer types. avr-libc ships
+    // no <limits>, so this is the subset the runtime needs. Anything that
+    // is not specialized (float, double) is treated as non-integral.
+    template<typename T>
+    struct numeric_traits
+    {
+        static const bool is_integer = false;
+        static const bool is_signed = true;
+        static const unsigned long long max = 0;
+    };
+
+#define JUNIPER_NUMERIC_TRAITS(T, isSigned, maxValue) \
+    template<> \
+    struct numeric_traits<T> \
+    { \
+        static const bool is_integer = true; \
+        static const bool is_signed = isSigned; \
+        static const unsigned long long max = maxValue; \
+    };
+
+    JUNIPER_NUMERIC_TRAITS(uint8_t, false, 0xFFULL)
+    JUNIPER_NUMERIC_TRAITS(int8_t, true, 0x7FULL)
+    JUNIPER_NUMERIC_TRAITS(uint16_t, false, 0xFFFFULL)
+    JUNIPER_NUMERIC_TRAITS(int16_t, true, 0x7FFFULL)
+    JUNIPER_NUMERIC_TRAITS(uint32_t, false, 0xFFFFFFFFULL)
+    JUNIPER_NUMERIC_TRAITS(int32_t, true, 0x7FFFFFFFULL)
+    JUNIPER_NUMERIC_TRAITS(uint64_t, false, 0xFFFFFFFFFFFFFFFFULL)
+    JUNIPER_NUMERIC_TRAITS(int64_t, true, 0x7FFFFFFFFFFFFFFFULL)
+
+#undef JUNIPER_NUMERIC_TRAITS
+
+    // Spare representations ("niches") of a type. A type with a niche has a
+    // byte at offset 0 that never holds value in a valid object, so maybe
+    // can store nothing there instead of in a tag byte of its own. Juniper
+    // ADTs put their tag first and never use 0xFF; other types have no
+    // niche unless specialized.
+    template<typename T>
+    struct niche
+    {
+        static const bool available = false;
+        static const uint8_t value = 0;
+    };
+
+#define JUNIPER_NICHE(T, nicheValue) \
+    namespace juniper { \
+    template<> \
+    struct niche<T> \
+    { \
+        static const bool available = true; \
+        static const uint8_t value = nicheValue; \
+    }; \
+    }
+
+    template<>
+    struct niche<bool>
+    {
+        static const bool available = true;
+        static const uint8_t value = 0xFF;
+    };
+
+    // The tag of a maybe stored in its value's niche. It lives in the same
+    // union as the value, so its address is the niche byte; reading it gives
+    // 0 (just) or 1 (nothing). Assigning 1 writes the niche and assigning 0
+    // clears it, which matters for types like unit whose only byte is never
+    // written by the value itself. It holds no data of its own, so it can be
+    // compared and assigned but not copied out.
+    template<typename T>
+    struct niche_tag
+    {
+        operator uint8_t() const {
+            return (*reinterpret_cast<const uint8_t *>(this) == niche<T>::value) ? 1 : 0;
+        }
+
+        niche_tag &operator=(uint8_t tag) {
+            *reinterpret_cast<uint8_t *>(this) = (tag != 0) ? niche<T>::value : (uint8_t) ~niche<T>::value;
+            return *this;
+        }
+    };
+
+    // Whether two T are equal exactly when their bytes are. That holds for
+    // the integer types and bool; floats do not qualify (-0.0 == 0.0, NaN !=
+    // NaN) and neither do records, which may contain padding.
+    template<typename T>
+    struct trivially_comparable
+    {
+        static const bool value = numeric_traits<T>::is_integer;
+    };
+
+    template<>
+    struct trivially_comparable<bool>
+    {
+        static const bool value = true;
+    };
+
+    template<typename T, bool bytewise = trivially_comparable<T>::value>
+    struct range_equality
+    {
+        // Every element is compared and the results and-ed together, so the
+        // loop has no data dependent exit.
+        static bool equal(const T *a, const T *b, size_t n) {
+            bool same = true;
+            for (size_t i = 0; i < n; i++) {
+                same &= (a[i] == b[i]);
+            }
+            return same;
+        }
+    };
+
+    template<typename T>
+    struct range_equality<T, true>
+    {
+        static bool equal(const T *a, const T *b, size_t n) {
+            return memcmp(a, b, n * sizeof(T)) == 0;
+        }
+    };
+
+    // Equality of the first n elements of a and b.
+    template<typename T>
+    bool equal_range(const T *a, const T *b, size_t n) {
+        return range_equality<T>::equal(a, b, n);
+    }
+
+    // Number of bits needed to hold v.
+    constexpr int bit_width(unsigned long long v) {
+        return (v == 0) ? 0 : 1 + bit_width(v >> 1);
+    }
+
+    // Smallest integer type able to hold values in [-negBound, bound]. The
+    // negative side of a signed type reaches one further than its maximum,
+    // so negBound is compared against max + 1.
+    template<unsigned long long bound, bool isSigned, unsigned long long negBound = bound>
+    struct int_for_bound
+    {
+        typedef typename conditional<(bound <= 0xFFULL), uint8_t,
+                typename conditional<(bound <= 0xFFFFULL), uint16_t,
+                typename conditional<(bound <= 0xFFFFFFFFULL), uint32_t,
+                uint64_t>::type>::type>::type type;
+    };
+    template<unsigned long long bound, unsigned long long negBound>
+    struct int_for_bound<bound, true, negBound>
+    {
+        typedef typename conditional<(bound <= 0x7FULL && negBound <= 0x80ULL), int8_t,
+                typename conditional<(bound <= 0x7FFFULL && negBound <= 0x8000ULL), int16_t,
+                typename conditional<(bound <= 0x7FFFFFFFULL && negBound <= 0x80000000ULL), int32_t,
+                int64_t>::type>::type>::type type;
+    };
+
+    // Saturating n * x for the accumulator bounds below.
+    constexpr unsigned long long bound_product(unsigned long long x, int n) {
+        return (x > 0xFFFFFFFFFFFFFFFFULL / (unsigned long long) (n > 0 ? n : 1)) ?
+            0xFFFFFFFFFFFFFFFFULL :
+            x * (unsigned long long) n;
+    }
+
+    // Accumulator type for summing n values of type T whose magnitude never
+    // exceeds maxElem. When maxElem is the maximum of a signed T the elements
+    // can also be min = -(max + 1), so the negative side gets its own bound.
+    // The result is never narrower than T, so when the bound proves that T
+    // cannot overflow the sum stays in T and costs nothing extra.
+    // Non-integral types accumulate in themselves.
+    template<typename T, int n, unsigned long long maxElem = numeric_traits<T>::max>
+    struct accumulator
+    {
+        static const unsigned long long bound = bound_product(maxElem, n);
+        static const unsigned long long negBound =
+            bound_product((numeric_traits<T>::is_signed && maxElem >= (unsigned long long) numeric_traits<T>::max) ?
+                (unsigned long long) numeric_traits<T>::max + 1 : maxElem, n);
+        typedef typename int_for_bound<bound, numeric_traits<T>::is_signed, negBound>::type wide;
+        typedef typename conditional<!numeric_traits<T>::is_integer || (sizeof(wide) < sizeof(T)), T, wide>::type type;
+    };
+
+    // Integer type twice as wide as T and of the same signedness, for
+    // intermediate products.
+    template<typename T>
+    struct wider;
+    template<> struct wider<int8_t> { typedef int16_t type; };
+    template<> struct wider<int16_t> { typedef int32_t type; };
+    template<> struct wider<int32_t> { typedef int64_t type; };
+    template<> struct wider<uint8_t> { typedef uint16_t type; };
+    template<> struct wider<uint16_t> { typedef uint32_t type; };
+    template<> struct wider<uint32_t> { typedef uint64_t type; };
+
+    template<bool cond, typename T = void>
+    struct enable_if {};
+    template<typename T>
+    struct enable_if<true, T> { typedef T type; };
+
+    // The built in number types: the integers numeric_traits knows about
+    // and the floating point types.
+    template<typename T>
+    struct is_arithmetic
+    {
+        static const bool value = numeric_traits<T>::is_integer;
+    };
+    template<> struct is_arithmetic<float> { static const bool value = true; };
+    template<> struct is_arithmetic<double> { static const bool value = true; };
+    template<> struct is_arithmetic<long double> { static const bool value = true; };
+
+    template<typename T>
+    struct make_unsigned;
+    template<> struct make_unsigned<int16_t> { typedef uint16_t type; };
+    template<> struct make_unsigned<int32_t> { typedef uint32_t type; };
+    template<> struct make_unsigned<int64_t> { typedef uint64_t type; };
+
+    // Signed fixed point number with fracBits fractional bits stored in Rep,
+    // e.g. fixed<int16_t, 15> is Q15 and fixed<int32_t, 16> is Q16.16. All
+    // arithmetic saturates at the representable range instead of wrapping.
+    // The type is trivially copyable so that it can live in maybe/sig unions
+    // and be used as the element type of Vector::vector and Prelude::list.
+    template<typename Rep, int fracBits>
+    struct fixed
+    {
+        typedef typename wider<Rep>::type wide;
+
+        static constexpr wide one = (wide) 1 << fracBits;
+        static constexpr wide maxRaw = (wide) numeric_traits<Rep>::max;
+        static constexpr wide minRaw = -maxRaw - 1;
+
+        static constexpr Rep saturate(wide x) {
+            return (x > maxRaw) ? (Rep) maxRaw : ((x < minRaw) ? (Rep) minRaw : (Rep) x);
+        }
+
+        static constexpr fixed fromRaw(Rep r) {
+            return fixed(r, raw_tag());
+        }
+
+        template<typename T>
+        static constexpr Rep fromInteger(T value) {
+            return (value > 0 && (unsigned long long) value > (unsigned long long) (maxRaw >> fracBits)) ? (Rep) maxRaw :
+                ((value < 0 && (long long) value < (long long) (minRaw >> fracBits)) ? (Rep) minRaw :
+                saturate((wide) value * one));
+        }
+
+        template<typename T>
+        static constexpr Rep fromFloating(T value) {
+            return (value != value) ? (Rep) 0 :
+                (((double) value * one >= (double) maxRaw) ? (Rep) maxRaw :
+                (((double) value * one <= (double) minRaw) ? (Rep) minRaw :
+                (Rep) (wide) ((double) value * one + ((value < 0) ? -0.5 : 0.5))));
+        }
+
+        fixed() = default;
+
+        // Integers convert exactly, floating point values are rounded to the
+        // nearest representable value and NaN becomes zero. Both saturate,
+        // and the range check happens in the source type, so values too
+        // large for wide saturate instead of wrapping. Only built in number
+        // types convert implicitly; other fixed formats go through fromRaw.
+        template<typename T, typename = typename enable_if<is_arithmetic<T>::value>::type>
+        constexpr fixed(T value)
+            : raw(numeric_traits<T>::is_integer ? fromInteger(value) : fromFloating(value))
+        {}
+
+        constexpr double toDouble() const {
+            return (double) raw / (double) one;
+        }
+
+        constexpr wide toInt() const {
+            return raw >> fracBits;
+        }
+
+        constexpr fixed operator-() const {
+            return fromRaw(saturate(-(wide) raw));
+        }
+
+        friend constexpr fixed operator+(fixed a, fixed b) {
+            return fromRaw(saturate((wide) a.raw + b.raw));
+        }
+
+        friend constexpr fixed operator-(fixed a, fixed b) {
+            return fromRaw(saturate((wide) a.raw - b.raw));
+        }
+
+        friend constexpr fixed operator*(fixed a, fixed b) {
+            return fromRaw(saturate(((wide) a.raw * b.raw) >> fracBits));
+        }
+
+        // Division by zero saturates towards the sign of the dividend.
+        friend constexpr fixed operator/(fixed a, fixed b) {
+            return (b.raw == 0) ?
+                fromRaw((a.raw < 0) ? (Rep) minRaw : (Rep) maxRaw) :
+                fromRaw(saturate(((wide) a.raw * one) / b.raw));
+        }
+
+        fixed &operator+=(fixed rhs) { return *this = *this + rhs; }
+        fixed &operator-=(fixed rhs) { return *this = *this - rhs; }
+        fixed &operator*=(fixed rhs) { return *this = *this * rhs; }
+        fixed &operator/=(fixed rhs) { return *this = *this / rhs; }
+
+        friend constexpr bool operator==(fixed a, fixed b) { return a.raw == b.raw; }
+        friend constexpr bool operator!=(fixed a, fixed b) { return a.raw != b.raw; }
+        friend constexpr bool operator<(fixed a, fixed b) { return a.raw < b.raw; }
+        friend constexpr bool operator>(fixed a, fixed b) { return a.raw > b.raw; }
+        friend constexpr bool operator<=(fixed a, fixed b) { return a.raw <= b.raw; }
+        friend constexpr bool operator>=(fixed a, fixed b) { return a.raw >= b.raw; }
+
+        Rep raw;
+
+    private:
+        struct raw_tag {};
+        constexpr fixed(Rep r, raw_tag)
+            : raw(r)
+        {}
+    };
+
+    template<typename Rep, int fracBits>
+    constexpr typename fixed<Rep, fracBits>::wide fixed<Rep, fracBits>::one;
+    template<typename Rep, int fracBits>
+    constexpr typename fixed<Rep, fracBits>::wide fixed<Rep, fracBits>::maxRaw;
+    template<typename Rep, int fracBits>
+    constexpr typename fixed<Rep, fracBits>::wide fixed<Rep, fracBits>::minRaw;
+
+    // Taylor series sine and cosine for designing filters at compile time.
+    // Twelve terms are exact to well below Q14 resolution for |x| <= pi.
+    constexpr double cos_series(double x2, double term, int k) {
+        return (k == 12) ? 0.0 : term + cos_series(x2, -term * x2 / ((2 * k + 1) * (2 * k + 2)), k + 1);
+    }
+
+    constexpr double sin_series(double x2, double term, int k) {
+        return (k == 12) ? 0.0 : term + sin_series(x2, -term * x2 / ((2 * k + 2) * (2 * k + 3)), k + 1);
+    }
+
+    constexpr double constexpr_cos(double x) {
+        return cos_series(x * x, 1.0, 0);
+    }
+
+    constexpr double constexpr_sin(double x) {
+        return sin_series(x * x, x, 0);
+    }
+
+    // Bitwise integer square root, rounded down.
+    template<typename T>
+    T isqrt(T v) {
+        T ret = 0;
+        T bit = (T) 1 << (sizeof(T) * 8 - 2);
+        while (bit > v) {
+            bit >>= 2;
+        }
+        while (bit != 0) {
+            if (v >= ret + bit) {
+                v -= ret + bit;
+                ret = (ret >> 1) + bit;
+            } else {
+                ret >>= 1;
+            }
+            bit >>= 2;
+        }
+        return ret;
+    }
+
+    // Negative inputs return zero.
+    template<typename Rep, int fracBits>
+    fixed<Rep, fracBits> sqrt(fixed<Rep, fracBits> x) {
+        typedef typename fixed<Rep, fracBits>::wide wide;
+        typedef typename make_unsigned<wide>::type uwide;
+        return (x.raw <= 0) ?
+            fixed<Rep, fracBits>::fromRaw(0) :
+            fixed<Rep, fracBits>::fromRaw((Rep) isqrt<uwide>((uwide) x.raw << fracBits));
+    }
+
+    // Type that Vector::magnitude and friends produce for a given element
+    // type: double for built in numbers, the element type itself for fixed.
+    template<typename T>
+    struct real_type
+    {
+        typedef double type;
+    };
+    template<typename Rep, int fracBits>
+    struct real_type<fixed<Rep, fracBits>>
+    {
+        typedef fixed<Rep, fracBits> type;
+    };
+
+    // How Vector::dot and magnitude2 sum products of T. Integers sum in
+    // wider<T> so that no single product overflows. Fixed point sums the
+    // rescaled products in its wide type and saturates once at the end
+    // instead of after every term. Everything else sums in T.
+    template<typename T>
+    struct product_sum
+    {
+        typedef T acc;
+        typedef T result;
+        static acc product(T a, T b) { return a * b; }
+        static result finish(acc sum) { return sum; }
+    };
+
+    template<typename T>
+    struct integer_product_sum
+    {
+        typedef typename wider<T>::type acc;
+        typedef acc result;
+        static acc product(T a, T b) { return (acc) a * b; }
+        static result finish(acc sum) { return sum; }
+    };
+    template<> struct product_sum<int8_t> : integer_product_sum<int8_t> {};
+    template<> struct product_sum<int16_t> : integer_product_sum<int16_t> {};
+    template<> struct product_sum<int32_t> : integer_product_sum<int32_t> {};
+    template<> struct product_sum<uint8_t> : integer_product_sum<uint8_t> {};
+    template<> struct product_sum<uint16_t> : integer_product_sum<uint16_t> {};
+    template<> struct product_sum<uint32_t> : integer_product_sum<uint32_t> {};
+
+    template<typename Rep, int fracBits>
+    struct product_sum<fixed<Rep, fracBits>>
+    {
+        typedef typename fixed<Rep, fracBits>::wide acc;
+        typedef fixed<Rep, fracBits> result;
+        static acc product(result a, result b) { return ((acc) a.raw * b.raw) >> fracBits; }
+        static result finish(acc sum) { return result::fromRaw(result::saturate(sum)); }
+    };
+
+    template<typename T>
+    constexpr double to_double(T x) {
+        return (double) x;
+    }
+    template<typename Rep, int fracBits>
+    constexpr double to_double(fixed<Rep, fracBits> x) {
+        return x.toDouble();
+    }
+
+#ifndef JUNIPER_HISTOGRAM_BUCKETS
+#define JUNIPER_HISTOGRAM_BUCKETS 20
+#endif
+
+    // Log2 bucketed histogram of durations in microseconds. Bucket 0 counts
+    // zero, bucket k counts [2^(k-1), 2^k) and the last bucket also takes
+    // everything above its range. Counts are halved together when one of
+    // them would overflow, which keeps the shape of the distribution.
+    struct latency_histogram
+    {
+        uint16_t counts[JUNIPER_HISTOGRAM_BUCKETS];
+        uint32_t max;
+
+        static uint8_t bucket(uint32_t us) {
+            uint8_t b = 0;
+            while (us != 0 && b < JUNIPER_HISTOGRAM_BUCKETS - 1) {
+                us >>= 1;
+                b++;
+            }
+            return b;
+        }
+
+        static uint32_t lowerBound(uint8_t b) {
+            return (b == 0) ? 0 : ((uint32_t) 1 << (b - 1));
+        }
+
+        static uint32_t upperBound(uint8_t b) {
+            return (b == 0) ? 0 : (((uint32_t) 1 << b) - 1);
+        }
+
+        void record(uint32_t us) {
+            uint8_t b = bucket(us);
+            if (counts[b] == 0xFFFF) {
+                for (uint8_t i = 0; i < JUNIPER_HISTOGRAM_BUCKETS; i++) {
+                    counts[i] = (counts[i] + 1) >> 1;
+                }
+            }
+            counts[b]++;
+            if (us > max) {
+                max = us;
+            }
+        }
+
+        uint32_t total() const {
+            uint32_t ret = 0;
+            for (uint8_t i = 0; i < JUNIPER_HISTOGRAM_BUCKETS; i++) {
+                ret += counts[i];
+            }
+            return ret;
+        }
+
+        // Estimated pct-th percentile, interpolated linearly inside the
+        // bucket it falls in and never above the observed maximum.
+        uint32_t percentile(uint8_t pct) const {
+            uint32_t target = (total() * pct + 99) / 100;
+            uint32_t seen = 0;
+            for (uint8_t i = 0; i < JUNIPER_HISTOGRAM_BUCKETS; i++) {
+                if (counts[i] != 0 && seen + counts[i] >= target) {
+                    uint32_t lo = lowerBound(i);
+                    uint32_t hi = (i == JUNIPER_HISTOGRAM_BUCKETS - 1) ? max : upperBound(i);
+                    uint32_t ret = lo + (uint32_t) (((uint64_t) (hi - lo) * (target - seen)) / counts[i]);
+                    return (ret > max) ? max : ret;
+                }
+                seen += counts[i];
+            }
+            return max;
+        }
+
+        void clear() {
+            for (uint8_t i = 0; i < JUNIPER_HISTOGRAM_BUCKETS; i++) {
+                counts[i] = 0;
+            }
+            max = 0;
+        }
+    };
+
+    // Keeps the compiler from moving memory accesses across it. The volatile
+    // indices alone do not order the plain stores to a ring_buffer's slots.
+    inline void compiler_barrier() {
+#if defined(__GNUC__)
+        asm volatile("" ::: "memory");
+#endif
+    }
+
+    // Single producer, single consumer queue with power of two capacity N.
+    // Each index is only written by one side, so a producer and a consumer
+    // may run concurrently (e.g. main loop and an interrupt) without locks,
+    // provided the index type is read atomically: on AVR keep N <= 256. A
+    // slot is always written or read before the index that hands it over.
+    template<typename T, size_t N>
+    class ring_buffer
+    {
+        static_assert((N & (N - 1)) == 0, "ring_buffer capacity must be a power of two");
+        typedef typename conditional<(N <= 256), uint8_t, uint16_t>::type index_t;
+
+        T data[N];
+        volatile index_t head;
+        volatile index_t tail;
+
+    public:
+        ring_buffer()
+            : head(0), tail(0)
+        {}
+
+        size_t size() const {
+            return (index_t) (head - tail) & (N - 1);
+        }
+
+        // One slot is kept open to tell a full queue from an empty one.
+        size_t free() const {
+            return N - 1 - size();
+        }
+
+        bool empty() const {
+            return head == tail;
+        }
+
+        bool push(const T &value) {
+            index_t next = (index_t) (head + 1) & (N - 1);
+            if (next == tail) {
+                return false;
+            }
+            data[head] = value;
+            compiler_barrier();
+            head = next;
+            return true;
+        }
+
+        bool pop(T &value) {
+            if (head == tail) {
+                return false;
+            }
+            value = data[tail];
+            compiler_barrier();
+            tail = (index_t) (tail + 1) & (N - 1);
+            return true;
+        }
+
+        const T &peek() const {
+            return data[tail];
+        }
+    };
+
+    // Binary telemetry frames:
+    //   0xA5, type, length, payload[length], crc8(type, length, payload)
+    // Multi-byte payload fields are little endian. The CRC is CRC-8 with
+    // polynomial 0x07, which lets a decoder resynchronize on the sync byte
+    // after dropped or corrupted bytes.
+    namespace telemetry
+    {
+        const uint8_t sync = 0xA5;
+        const uint8_t overhead = 4;
+
+        enum frame_type : uint8_t
+        {
+            samples = 1,
+            levels = 2,
+            counters = 3
+        };
+
+        // Ids of the values sent in counters frames.
+        enum counter_id : uint8_t
+        {
+            passes = 0,
+            serialDrops = 1,
+            frameDrops = 2
+        };
+
+        inline uint8_t crc8(uint8_t crc, uint8_t byte) {
+            crc ^= byte;
+            for (uint8_t i = 0; i < 8; i++) {
+                crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+            }
+            return crc;
+        }
+
+        // Writes a whole frame or nothing, so a full queue never leaves half
+        // a frame behind.
+        template<size_t N>
+        bool write_frame(ring_buffer<uint8_t, N> &queue, uint8_t type, const uint8_t *payload, uint8_t length) {
+            if (queue.free() < (size_t) length + overhead) {
+                return false;
+            }
+            uint8_t crc = crc8(crc8(0, type), length);
+            queue.push(sync);
+            queue.push(type);
+            queue.push(length);
+            for (uint8_t i = 0; i < length; i++) {
+                queue.push(payload[i]);
+                crc = crc8(crc, payload[i]);
+            }
+            queue.push(crc);
+            return true;
+        }
+
+        // Incremental decoder for the host side. Feed it bytes in order;
+        // feed returns true each time a complete, valid frame is available
+        // in type/length/payload.
+        class decoder
+        {
+            enum state_t { waitSync, readType, readLength, readPayload, readCrc };
+            state_t state;
+            uint8_t crc;
+            uint8_t received;
+
+        public:
+            uint8_t type;
+            uint8_t length;
+            uint8_t payload[255];
+            uint32_t frames;
+            uint32_t errors;
+
+            decoder()
+                : state(waitSync), crc(0), received(0), type(0), length(0), frames(0), errors(0)
+            {}
+
+            bool feed(uint8_t byte) {
+                switch (state) {
+                    case waitSync:
+                        if (byte == sync) {
+                            state = readType;
+                        }
+                        return false;
+                    case readType:
+                        // Frame types never use the sync value, so a repeated
+                        // sync byte just restarts the frame.
+                        if (byte == sync) {
+                            return false;
+                        }
+                        type = byte;
+                        crc = crc8(0, byte);
+                        state = readLength;
+                        return false;
+                    case readLength:
+                        length = byte;
+                        crc = crc8(crc, byte);
+                        received = 0;
+                        state = (length == 0) ? readCrc : readPayload;
+                        return false;
+                    case readPayload:
+                        payload[received++] = byte;
+                        crc = crc8(crc, byte);
+                        if (received == length) {
+                            state = readCrc;
+                        }
+                        return false;
+                    case readCrc:
+                        state = waitSync;
+                        if (byte == crc) {
+                            frames++;
+                            return true;
+                        }
+                        errors++;
+                        return false;
+                }
+                return false;
+            }
+
+            uint16_t u16(uint8_t offset) const {
+                return (uint16_t) (payload[offset] | ((uint16_t) payload[offset + 1] << 8));
+            }
+
+            uint32_t u32(uint8_t offset) const {
+                return (uint32_t) u16(offset) | ((uint32_t) u16(offset + 2) << 16);
+            }
+        };
+    }
+
+    template<typename T>
+    T quit() {
+        exit(1);
+    }
+}
+
+#endif
+
+#ifdef JUNIPER_HOST
+#include "ArduinoHost.h"
+#include "HostReplay.h"
+#else
+#include <Arduino.h>
+#endif
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+namespace juniper {
+    // Reads and writes of a value that an interrupt also changes. On AVR a
+    // 32 bit access takes four instructions, and an interrupt landing
+    // between them sees or leaves a torn value, so interrupts are held off
+    // around the access. Elsewhere such accesses are single instructions.
+    template<typename T>
+    T atomic_read(const volatile T &value) {
+#ifdef __AVR__
+        T copy;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            copy = value;
+        }
+        return copy;
+#else
+        return value;
+#endif
+    }
+
+    template<typename T>
+    void atomic_write(volatile T &target, T value) {
+#ifdef __AVR__
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            target = value;
+        }
+#else
+        target = value;
+#endif
+    }
+}
+
+
+// Number of microphone channels. One is the original digital microphone on
+// a single bar; two or more switches to analog microphones on A0 onwards,
+// each with its own envelope and its own share of the bar pins.
+#ifndef SOUNDBAR_CHANNELS
+#define SOUNDBAR_CHANNELS 1
+#endif
+
+// With SOUNDBAR_PULSE_DENSITY the digital microphone's level is the share
+// of each window of SOUNDBAR_DUTY_WINDOW_US that its comparator was low,
+// instead of a moving average of two extreme values.
+#ifndef SOUNDBAR_DUTY_WINDOW_US
+#define SOUNDBAR_DUTY_WINDOW_US 20000
+#endif
+
+// With SOUNDBAR_FILTER each analog channel's samples pass through a DC
+// blocker and a band-pass around the voice band (300 Hz - 3 kHz, or up to
+// the Nyquist limit at lower rates) before their level is taken, so the
+// bars ignore the microphones' bias and rumble. A filter is only as good
+// as its sample clock, so the channels are converted together by the
+// sampling timer (JUNIPER_SAMPLE_TIMER) at SOUNDBAR_FILTER_RATE frames per
+// second, the rate the band-pass is designed for, and filtered
+// SOUNDBAR_FILTER_BLOCK frames at a time. The default rate is as fast as
+// the ADC's 125 kHz clock allows for all channels on an Uno.
+#ifndef SOUNDBAR_FILTER_RATE
+#define SOUNDBAR_FILTER_RATE (9600 / SOUNDBAR_CHANNELS)
+#endif
+#ifndef SOUNDBAR_FILTER_BLOCK
+#define SOUNDBAR_FILTER_BLOCK 8
+#endif
+
+// Each bar follows its level's envelope, rising by 1 / 2^SOUNDBAR_ATTACK
+// and falling by 1 / 2^SOUNDBAR_RELEASE of the distance per pass, so it
+// jumps to a peak within a few passes and decays over about 2^RELEASE.
+#ifndef SOUNDBAR_ATTACK
+#define SOUNDBAR_ATTACK 1
+#endif
+#ifndef SOUNDBAR_RELEASE
+#define SOUNDBAR_RELEASE 4
+#endif
 
-        shared_ptr(const shared_ptr& rhs)
-            : ptr_(rhs.ptr_), ref_count_(rhs.ref_count_)
-        {
-            inc_ref();
-        }
+#ifdef SOUNDBAR_FILTER
+#if SOUNDBAR_CHANNELS < 2
+#error "SOUNDBAR_FILTER needs analog microphones (SOUNDBAR_CHANNELS >= 2)"
+#endif
+#ifndef JUNIPER_SAMPLE_TIMER
+#error "SOUNDBAR_FILTER needs a fixed sample clock: define JUNIPER_SAMPLE_TIMER"
+#endif
+#if defined(__AVR__) && SOUNDBAR_FILTER_RATE * SOUNDBAR_CHANNELS > 9600
+#error "SOUNDBAR_FILTER_RATE * SOUNDBAR_CHANNELS conversions a second are more than the ADC can make"
+#endif
+#define JUNIPER_SAMPLE_CHANNELS SOUNDBAR_CHANNELS
+// The sample queue holds two blocks of frames, one filling while the other
+// is filtered, plus the slot the ring buffer keeps open, rounded up to a
+// power of two. 256 is as large as the interrupt-safe queue gets on AVR.
+#define SOUNDBAR_FILTER_QUEUED (2 * SOUNDBAR_CHANNELS * SOUNDBAR_FILTER_BLOCK)
+#ifndef JUNIPER_SAMPLE_EVENTS
+#if SOUNDBAR_FILTER_QUEUED < 64
+#define JUNIPER_SAMPLE_EVENTS 64
+#elif SOUNDBAR_FILTER_QUEUED < 128
+#define JUNIPER_SAMPLE_EVENTS 128
+#elif SOUNDBAR_FILTER_QUEUED < 256
+#define JUNIPER_SAMPLE_EVENTS 256
+#endif
+#endif
+#if !defined(JUNIPER_SAMPLE_EVENTS) || JUNIPER_SAMPLE_EVENTS <= SOUNDBAR_FILTER_QUEUED
+#error "the sample queue must hold two blocks of SOUNDBAR_CHANNELS * SOUNDBAR_FILTER_BLOCK samples: lower SOUNDBAR_FILTER_BLOCK or raise JUNIPER_SAMPLE_EVENTS"
+#endif
+#endif
 
-        ~shared_ptr() {
-            if (ref_count_ && 0 == dec_ref()) {
-                if (ptr_) {
-                    delete ptr_;
-                }
-                delete ref_count_;
-            }
-        }
+#if defined(SOUNDBAR_PULSE_DENSITY) && defined(JUNIPER_EDGE_INTERRUPTS) && SOUNDBAR_CHANNELS > 1
+#error "JUNIPER_EDGE_INTERRUPTS watches a single pin, so it takes SOUNDBAR_CHANNELS 1"
+#endif
 
-        void set(contained* p) {
-          ptr_ = p;
-        }
+// A capture is a dump of the serial port, so nothing else may write to it,
+// and it records the reads the loop makes through anaRead, which the
+// sampling timer's reads bypass.
+#ifdef JUNIPER_CAPTURE
+#if defined(JUNIPER_TELEMETRY) || defined(JUNIPER_PROFILE_LOOP) || defined(JUNIPER_PROFILE_STAGES) || defined(JUNIPER_TRACK_MEMORY)
+#error "JUNIPER_CAPTURE needs the serial port to itself: drop JUNIPER_TELEMETRY, JUNIPER_PROFILE_* and JUNIPER_TRACK_MEMORY"
+#endif
+#ifdef JUNIPER_SAMPLE_TIMER
+#error "JUNIPER_CAPTURE records the loop's reads, and JUNIPER_SAMPLE_TIMER takes its samples outside the loop"
+#endif
+#endif
 
-        contained* get() { return ptr_; }
-        const contained* get() const { return ptr_; }
+#ifdef JUNIPER_PROFILE_STAGES
+namespace juniper {
+    // Stage timings are taken from a cycle counter rather than micros(),
+    // whose 4 us steps are longer than most stages. On AVR that is Timer1
+    // free running at the CPU clock. A stage that runs for longer than the
+    // 16 bit counter's 65536 cycles (4.1 ms at 16 MHz) is undercounted by
+    // a multiple of that. On the host it is the CPU's own counter. Other
+    // boards fall back to micros() scaled to cycles.
+#if defined(JUNIPER_HOST)
+    typedef uint64_t stage_clock_t;
+
+    inline void start_stage_clock() {}
+
+    inline stage_clock_t stage_clock() {
+        return host::cycles();
+    }
+#elif defined(__AVR__)
+#ifdef JUNIPER_SAMPLE_TIMER
+#error "JUNIPER_PROFILE_STAGES and JUNIPER_SAMPLE_TIMER both need Timer1"
+#endif
+    typedef uint16_t stage_clock_t;
 
-        void swap(shared_ptr& rhs) {
-            juniper::swap(ptr_, rhs.ptr_);
-            juniper::swap(ref_count_, rhs.ref_count_);
-        }
+    // Normal mode, no prescaler. This takes Timer1 from analogWrite on
+    // pins 9 and 10 and from the Servo library.
+    inline void start_stage_clock() {
+        TCCR1A = 0;
+        TCCR1B = _BV(CS10);
+    }
 
-        shared_ptr& operator=(const shared_ptr& rhs) {
-            shared_ptr tmp(rhs);
-            this->swap(tmp);
-            return *this;
-        }
+    inline stage_clock_t stage_clock() {
+        return TCNT1;
+    }
+#else
+    typedef uint32_t stage_clock_t;
 
-        //contained& operator*() {
-        //    return *ptr_;
-        //}
+    inline void start_stage_clock() {}
 
-        contained* operator->() {
-            return ptr_;
-        }
+    inline stage_clock_t stage_clock() {
+        return (stage_clock_t) (::micros() * (F_CPU / 1000000UL));
+    }
+#endif
 
-        bool operator==(shared_ptr& rhs) {
-            return ptr_ == rhs.ptr_;
+    // Counters for one instrumented pipeline stage. Counters register
+    // themselves in a global list on first use so they can be reported
+    // without the caller keeping track of them.
+    struct stage_counter
+    {
+        const char *name;
+        uint32_t calls;
+        uint32_t values;
+        uint32_t empties;
+        unsigned long cycles;
+        stage_counter *next;
+
+        static stage_counter *&head() {
+            static JUNIPER_THREAD_LOCAL stage_counter *first = nullptr;
+            return first;
         }
 
-        bool operator!=(shared_ptr& rhs) { return !(rhs == *this); }
-    private:
-        void inc_ref() {
-            if (ref_count_) {
-                ++(*ref_count_);
+        stage_counter(const char *stageName)
+            : name(stageName), calls(0), values(0), empties(0), cycles(0), next(head())
+        {
+            if (head() == nullptr) {
+                start_stage_clock();
             }
+            head() = this;
         }
-
-        int dec_ref() {
-            return --(*ref_count_);
-        }
-
-        contained * ptr_;
-        int * ref_count_;
     };
 
-    template<typename T, size_t N>
-    class array {
-    public:
-        array<T, N>& fill(T fillWith) {
-            for (size_t i = 0; i < N; i++) {
-                data[i] = fillWith;
-            }
-
-            return *this;
+    // Times one evaluation of a stage. The time is inclusive of any stage
+    // nested inside it. The outcome is whatever the last signal combinator
+    // to finish reported, which is the outermost one in the expression.
+    struct stage_scope
+    {
+        stage_counter &counter;
+        stage_scope *outer;
+        stage_clock_t start;
+        int8_t outcome;
+
+        static stage_scope *&current() {
+            static JUNIPER_THREAD_LOCAL stage_scope *scope = nullptr;
+            return scope;
         }
 
-        T& operator[](int i) {
-            return data[i];
+        stage_scope(stage_counter &c)
+            : counter(c), outer(current()), start(stage_clock()), outcome(-1)
+        {
+            counter.calls++;
+            current() = this;
         }
 
-        bool operator==(array<T, N>& rhs) {
-            for (auto i = 0; i < N; i++) {
-                if (data[i] != rhs[i]) {
-                    return false;
-                }
+        ~stage_scope() {
+            counter.cycles += (stage_clock_t) (stage_clock() - start);
+            if (outcome == 1) {
+                counter.values++;
+            } else if (outcome == 0) {
+                counter.empties++;
             }
-            return true;
+            current() = outer;
         }
-
-        bool operator!=(array<T, N>& rhs) { return !(rhs == *this); }
-
-        T data[N];
     };
 
-    template<typename T>
-    T quit() {
-        exit(1);
+    inline void stage_outcome(bool hasValue) {
+        if (stage_scope::current()) {
+            stage_scope::current()->outcome = hasValue ? 1 : 0;
+        }
+    }
+
+    // Every JUNIPER_STAGE site passes a distinct lambda type, so each site
+    // gets its own counter instance (one per thread on the host).
+    template<typename Func>
+    auto stage_call(const char *stageName, Func f) -> decltype(f()) {
+        static JUNIPER_THREAD_LOCAL stage_counter counter(stageName);
+        stage_scope scope(counter);
+        return f();
     }
 }
 
+#define JUNIPER_STAGE(stageName, ...) juniper::stage_call(stageName, [&]() { return __VA_ARGS__; })
+#define JUNIPER_STAGE_OUTCOME(hasValue) juniper::stage_outcome(hasValue)
+#else
+#define JUNIPER_STAGE(stageName, ...) (__VA_ARGS__)
+#define JUNIPER_STAGE_OUTCOME(hasValue)
 #endif
 
-#include <Arduino.h>
-
 namespace Prelude {}
 namespace List {}
 namespace Signal {}
@@ -271,21 +1416,23 @@ namespace SoundBar {
 
 namespace Prelude {
     struct unit {
-        bool operator==(unit rhs) {
+        bool operator==(const unit& rhs) const {
             return true;
         }
 
-        bool operator!=(unit rhs) {
+        bool operator!=(const unit& rhs) const {
             return !(rhs == *this);
         }
     };
 }
 
+JUNIPER_NICHE(Prelude::unit, 0xFF)
+
 namespace Prelude {
-    template<typename a>
+    template<typename a, bool = juniper::niche<a>::available>
     struct maybe {
         uint8_t tag;
-        bool operator==(maybe rhs) {
+        bool operator==(const maybe& rhs) const {
             if (this->tag != rhs.tag) { return false; }
             switch (this->tag) {
                 case 0:
@@ -296,10 +1443,27 @@ namespace Prelude {
             return false;
         }
 
-        bool operator!=(maybe rhs) { return !(rhs == *this); }
+        bool operator!=(const maybe& rhs) const { return !(rhs == *this); }
+        union {
+            a just;
+            uint8_t nothing;
+        };
+    };
+
+    // A maybe of a type with a niche is the size of the type: nothing is
+    // stored in the niche and tag is read back from it.
+    template<typename a>
+    struct maybe<a, true> {
+        bool operator==(const maybe& rhs) const {
+            if (this->tag != rhs.tag) { return false; }
+            return (this->tag == 1) || (this->just == rhs.just);
+        }
+
+        bool operator!=(const maybe& rhs) const { return !(rhs == *this); }
         union {
             a just;
             uint8_t nothing;
+            juniper::niche_tag<a> tag;
         };
     };
 
@@ -310,7 +1474,7 @@ namespace Prelude {
 
     template<typename a>
     Prelude::maybe<a> nothing() {
-        return (([&]() -> Prelude::maybe<a> { Prelude::maybe<a> ret; ret.tag = 1; ret.nothing = 0; return ret; })());
+        return (([&]() -> Prelude::maybe<a> { Prelude::maybe<a> ret; ret.nothing = 0; ret.tag = 1; return ret; })());
     }
 
 
@@ -320,7 +1484,7 @@ namespace Prelude {
     template<typename a, typename b>
     struct either {
         uint8_t tag;
-        bool operator==(either rhs) {
+        bool operator==(const either& rhs) const {
             if (this->tag != rhs.tag) { return false; }
             switch (this->tag) {
                 case 0:
@@ -331,7 +1495,7 @@ namespace Prelude {
             return false;
         }
 
-        bool operator!=(either rhs) { return !(rhs == *this); }
+        bool operator!=(const either& rhs) const { return !(rhs == *this); }
         union {
             a left;
             b right;
@@ -356,67 +1520,82 @@ namespace Prelude {
     struct list {
         juniper::array<a, n> data;
         uint32_t length;
-        bool operator==(list rhs) {
-            return true && data == rhs.data && length == rhs.length;
+        // Only the first length elements are live, so only those are
+        // compared.
+        bool operator==(const list& rhs) const {
+            return (length == rhs.length) && juniper::equal_range<a>((data).data, (rhs.data).data, length);
         }
 
-        bool operator!=(list rhs) {
+        bool operator!=(const list& rhs) const {
             return !(rhs == *this);
         }
     };
 }
 
+namespace Prelude {
+    template<typename a, int n>
+    struct flashList {
+        juniper::flash_array<a, n> data;
+        uint32_t length;
+    };
+}
+
 namespace Prelude {
     template<int n>
     struct string {
         Prelude::list<uint8_t, n> characters;
-        bool operator==(string rhs) {
+        bool operator==(const string& rhs) const {
             return true && characters == rhs.characters;
         }
 
-        bool operator!=(string rhs) {
+        bool operator!=(const string& rhs) const {
             return !(rhs == *this);
         }
     };
 }
 
 namespace Prelude {
+    // sig has a single constructor, so its tag is always 0 and takes no
+    // space: a sig is exactly its maybe, and the tag == 0 half of every
+    // combinator's test folds away at compile time.
     template<typename a>
     struct sig {
-        uint8_t tag;
-        bool operator==(sig rhs) {
-            if (this->tag != rhs.tag) { return false; }
-            switch (this->tag) {
-                case 0:
-                    return this->signal == rhs.signal;
-            }
-            return false;
+        static constexpr uint8_t tag = 0;
+        bool operator==(const sig& rhs) const {
+            return this->signal == rhs.signal;
         }
 
-        bool operator!=(sig rhs) { return !(rhs == *this); }
-        union {
-            Prelude::maybe<a> signal;
-        };
+        bool operator!=(const sig& rhs) const { return !(rhs == *this); }
+        Prelude::maybe<a> signal;
     };
 
+    template<typename a>
+    constexpr uint8_t sig<a>::tag;
+
     template<typename a>
     Prelude::sig<a> signal(Prelude::maybe<a> data) {
-        return (([&]() -> Prelude::sig<a> { Prelude::sig<a> ret; ret.tag = 0; ret.signal = data; return ret; })());
+        return (([&]() -> Prelude::sig<a> { Prelude::sig<a> ret; ret.signal = data; return ret; })());
     }
 
 
 }
 
+static_assert(sizeof(Prelude::maybe<Prelude::unit>) == sizeof(Prelude::unit), "maybe<unit> must live in unit's niche");
+static_assert(sizeof(Prelude::maybe<bool>) == sizeof(bool), "maybe<bool> must live in bool's niche");
+static_assert(sizeof(Prelude::sig<Prelude::unit>) == sizeof(Prelude::unit), "sig<unit> must be a single byte");
+static_assert(sizeof(Prelude::sig<bool>) == sizeof(bool), "sig<bool> must be a single byte");
+static_assert(sizeof(Prelude::sig<uint16_t>) == sizeof(Prelude::maybe<uint16_t>), "a sig must be exactly its maybe");
+
 namespace Prelude {
     template<typename a, typename b>
     struct tuple2 {
         a e1;
         b e2;
-        bool operator==(tuple2 rhs) {
+        bool operator==(const tuple2& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2;
         }
 
-        bool operator!=(tuple2 rhs) {
+        bool operator!=(const tuple2& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -428,11 +1607,11 @@ namespace Prelude {
         a e1;
         b e2;
         c e3;
-        bool operator==(tuple3 rhs) {
+        bool operator==(const tuple3& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3;
         }
 
-        bool operator!=(tuple3 rhs) {
+        bool operator!=(const tuple3& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -445,11 +1624,11 @@ namespace Prelude {
         b e2;
         c e3;
         d e4;
-        bool operator==(tuple4 rhs) {
+        bool operator==(const tuple4& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4;
         }
 
-        bool operator!=(tuple4 rhs) {
+        bool operator!=(const tuple4& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -463,11 +1642,11 @@ namespace Prelude {
         c e3;
         d e4;
         e e5;
-        bool operator==(tuple5 rhs) {
+        bool operator==(const tuple5& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5;
         }
 
-        bool operator!=(tuple5 rhs) {
+        bool operator!=(const tuple5& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -482,11 +1661,11 @@ namespace Prelude {
         d e4;
         e e5;
         f e6;
-        bool operator==(tuple6 rhs) {
+        bool operator==(const tuple6& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5 && e6 == rhs.e6;
         }
 
-        bool operator!=(tuple6 rhs) {
+        bool operator!=(const tuple6& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -502,11 +1681,11 @@ namespace Prelude {
         e e5;
         f e6;
         g e7;
-        bool operator==(tuple7 rhs) {
+        bool operator==(const tuple7& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5 && e6 == rhs.e6 && e7 == rhs.e7;
         }
 
-        bool operator!=(tuple7 rhs) {
+        bool operator!=(const tuple7& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -523,11 +1702,11 @@ namespace Prelude {
         f e6;
         g e7;
         h e8;
-        bool operator==(tuple8 rhs) {
+        bool operator==(const tuple8& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5 && e6 == rhs.e6 && e7 == rhs.e7 && e8 == rhs.e8;
         }
 
-        bool operator!=(tuple8 rhs) {
+        bool operator!=(const tuple8& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -545,11 +1724,11 @@ namespace Prelude {
         g e7;
         h e8;
         i e9;
-        bool operator==(tuple9 rhs) {
+        bool operator==(const tuple9& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5 && e6 == rhs.e6 && e7 == rhs.e7 && e8 == rhs.e8 && e9 == rhs.e9;
         }
 
-        bool operator!=(tuple9 rhs) {
+        bool operator!=(const tuple9& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -568,11 +1747,11 @@ namespace Prelude {
         h e8;
         i e9;
         j e10;
-        bool operator==(tuple10 rhs) {
+        bool operator==(const tuple10& rhs) const {
             return true && e1 == rhs.e1 && e2 == rhs.e2 && e3 == rhs.e3 && e4 == rhs.e4 && e5 == rhs.e5 && e6 == rhs.e6 && e7 == rhs.e7 && e8 == rhs.e8 && e9 == rhs.e9 && e10 == rhs.e10;
         }
 
-        bool operator!=(tuple10 rhs) {
+        bool operator!=(const tuple10& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -581,7 +1760,7 @@ namespace Prelude {
 namespace Io {
     struct pinState {
         uint8_t tag;
-        bool operator==(pinState rhs) {
+        bool operator==(const pinState& rhs) const {
             if (this->tag != rhs.tag) { return false; }
             switch (this->tag) {
                 case 0:
@@ -592,7 +1771,7 @@ namespace Io {
             return false;
         }
 
-        bool operator!=(pinState rhs) { return !(rhs == *this); }
+        bool operator!=(const pinState& rhs) const { return !(rhs == *this); }
         union {
             uint8_t high;
             uint8_t low;
@@ -610,10 +1789,14 @@ namespace Io {
 
 }
 
+JUNIPER_NICHE(Io::pinState, 0xFF)
+static_assert(sizeof(Prelude::maybe<Io::pinState>) == sizeof(Io::pinState), "maybe<pinState> must live in its niche");
+static_assert(sizeof(Prelude::sig<Io::pinState>) == sizeof(Io::pinState), "sig<pinState> must live in its niche");
+
 namespace Io {
     struct mode {
         uint8_t tag;
-        bool operator==(mode rhs) {
+        bool operator==(const mode& rhs) const {
             if (this->tag != rhs.tag) { return false; }
             switch (this->tag) {
                 case 0:
@@ -626,7 +1809,7 @@ namespace Io {
             return false;
         }
 
-        bool operator!=(mode rhs) { return !(rhs == *this); }
+        bool operator!=(const mode& rhs) const { return !(rhs == *this); }
         union {
             uint8_t input;
             uint8_t output;
@@ -649,14 +1832,107 @@ namespace Io {
 
 }
 
+JUNIPER_NICHE(Io::mode, 0xFF)
+static_assert(sizeof(Prelude::maybe<Io::mode>) == sizeof(Io::mode), "maybe<mode> must live in its niche");
+static_assert(sizeof(Prelude::sig<Io::mode>) == sizeof(Io::mode), "sig<mode> must live in its niche");
+
+namespace Io {
+    struct txPolicy {
+        uint8_t tag;
+        bool operator==(const txPolicy& rhs) const {
+            if (this->tag != rhs.tag) { return false; }
+            switch (this->tag) {
+                case 0:
+                    return this->txDrop == rhs.txDrop;
+                case 1:
+                    return this->txBlock == rhs.txBlock;
+            }
+            return false;
+        }
+
+        bool operator!=(const txPolicy& rhs) const { return !(rhs == *this); }
+        union {
+            uint8_t txDrop;
+            uint8_t txBlock;
+        };
+    };
+
+    Io::txPolicy txDrop() {
+        return (([&]() -> Io::txPolicy { Io::txPolicy ret; ret.tag = 0; ret.txDrop = 0; return ret; })());
+    }
+
+    Io::txPolicy txBlock() {
+        return (([&]() -> Io::txPolicy { Io::txPolicy ret; ret.tag = 1; ret.txBlock = 0; return ret; })());
+    }
+
+
+}
+
+JUNIPER_NICHE(Io::txPolicy, 0xFF)
+static_assert(sizeof(Prelude::maybe<Io::txPolicy>) == sizeof(Io::txPolicy), "maybe<txPolicy> must live in its niche");
+static_assert(sizeof(Prelude::sig<Io::txPolicy>) == sizeof(Io::txPolicy), "sig<txPolicy> must live in its niche");
+
+namespace Io {
+    struct memoryUsage {
+        uint32_t liveAllocations;
+        uint32_t liveBytes;
+        uint32_t peakBytes;
+        uint32_t stackHighWater;
+        bool operator==(const memoryUsage& rhs) const {
+            return true && liveAllocations == rhs.liveAllocations && liveBytes == rhs.liveBytes && peakBytes == rhs.peakBytes && stackHighWater == rhs.stackHighWater;
+        }
+
+        bool operator!=(const memoryUsage& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace Io {
+    struct edgeEvent {
+        uint32_t micros;
+        Io::pinState state;
+        bool operator==(const edgeEvent& rhs) const {
+            return true && micros == rhs.micros && state == rhs.state;
+        }
+
+        bool operator!=(const edgeEvent& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace Io {
+    struct dutyState {
+        uint32_t windowStart;
+        uint32_t lastMicros;
+        uint32_t activeMicros;
+        bool active;
+        bool started;
+        uint16_t level;
+        bool operator==(const dutyState& rhs) const {
+            return true && windowStart == rhs.windowStart && lastMicros == rhs.lastMicros && activeMicros == rhs.activeMicros && active == rhs.active && started == rhs.started && level == rhs.level;
+        }
+
+        bool operator!=(const dutyState& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+
+    Io::dutyState dutyStart() {
+        return (([&]() -> Io::dutyState { Io::dutyState ret; ret.windowStart = 0; ret.lastMicros = 0; ret.activeMicros = 0; ret.active = false; ret.started = false; ret.level = 0; return ret; })());
+    }
+}
+
 namespace Time {
     struct timerState {
-        uint32_t lastPulse;
-        bool operator==(timerState rhs) {
-            return true && lastPulse == rhs.lastPulse;
+        uint32_t deadline;
+        bool armed;
+        bool operator==(const timerState& rhs) const {
+            return true && deadline == rhs.deadline && armed == rhs.armed;
         }
 
-        bool operator!=(timerState rhs) {
+        bool operator!=(const timerState& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -667,11 +1943,65 @@ namespace Button {
         Io::pinState actualState;
         Io::pinState lastState;
         uint32_t lastDebounceTime;
-        bool operator==(buttonState rhs) {
+        bool operator==(const buttonState& rhs) const {
             return true && actualState == rhs.actualState && lastState == rhs.lastState && lastDebounceTime == rhs.lastDebounceTime;
         }
 
-        bool operator!=(buttonState rhs) {
+        bool operator!=(const buttonState& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace Button {
+    // Debounced state of up to 8, 16 or 32 inputs, one bit per input, with a
+    // two bit counter per input stored vertically across cnt0 and cnt1.
+    template<typename a>
+    struct bankState {
+        a state;
+        a cnt0;
+        a cnt1;
+        bool operator==(const bankState& rhs) const {
+            return true && state == rhs.state && cnt0 == rhs.cnt0 && cnt1 == rhs.cnt1;
+        }
+
+        bool operator!=(const bankState& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace Signal {
+    // Coefficients of one biquad section in Q2.14, normalized so a0 is 1:
+    //   y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+    struct biquadCoeffs {
+        juniper::fixed<int16_t, 14> b0;
+        juniper::fixed<int16_t, 14> b1;
+        juniper::fixed<int16_t, 14> b2;
+        juniper::fixed<int16_t, 14> a1;
+        juniper::fixed<int16_t, 14> a2;
+        bool operator==(const biquadCoeffs& rhs) const {
+            return true && b0 == rhs.b0 && b1 == rhs.b1 && b2 == rhs.b2 && a1 == rhs.a1 && a2 == rhs.a2;
+        }
+
+        bool operator!=(const biquadCoeffs& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace Signal {
+    // Direct Form I history of one section: its last two inputs and outputs.
+    struct biquadState {
+        int16_t x1;
+        int16_t x2;
+        int16_t y1;
+        int16_t y2;
+        bool operator==(const biquadState& rhs) const {
+            return true && x1 == rhs.x1 && x2 == rhs.x2 && y1 == rhs.y1 && y2 == rhs.y2;
+        }
+
+        bool operator!=(const biquadState& rhs) const {
             return !(rhs == *this);
         }
     };
@@ -681,16 +2011,71 @@ namespace Vector {
     template<typename a, int n>
     struct vector {
         juniper::array<a, n> data;
-        bool operator==(vector rhs) {
+        bool operator==(const vector& rhs) const {
             return true && data == rhs.data;
         }
 
-        bool operator!=(vector rhs) {
+        bool operator!=(const vector& rhs) const {
+            return !(rhs == *this);
+        }
+    };
+}
+
+namespace SoundBar {
+    typedef Prelude::unit (*barDriver)(uint16_t, Io::pinState);
+}
+
+namespace SoundBar {
+    // One microphone driving one bar of c850 pins. An instance owns its
+    // envelope, its pin map and the driver its pins are written
+    // through, so any number of them can run side by side. The pin map
+    // points at c850 consecutive pins in flash, which may be a slice of a
+    // larger table.
+    template<int c850>
+    struct instance {
+        uint16_t microphonePin;
+        const uint8_t *barPins;
+        SoundBar::barDriver driver;
+        uint16_t envelope;
+#ifdef SOUNDBAR_PULSE_DENSITY
+        Io::dutyState duty;
+#endif
+#ifdef SOUNDBAR_FILTER
+        juniper::array<Signal::biquadState, 2> filter;
+#endif
+        bool operator==(const instance& rhs) const {
+            return true && microphonePin == rhs.microphonePin && barPins == rhs.barPins && driver == rhs.driver && envelope == rhs.envelope
+#ifdef SOUNDBAR_PULSE_DENSITY
+                && duty == rhs.duty
+#endif
+#ifdef SOUNDBAR_FILTER
+                && filter == rhs.filter
+#endif
+                ;
+        }
+
+        bool operator!=(const instance& rhs) const {
             return !(rhs == *this);
         }
     };
 }
 
+namespace SoundBar {
+    // Footprint budget of one instance: the pin, pin map, driver and
+    // envelope, plus the state of whichever optional stages are built in.
+    // The pin map lives in flash, so the bar length never sizes an instance.
+    constexpr size_t instanceBudget = 4 * sizeof(void *)
+#ifdef SOUNDBAR_PULSE_DENSITY
+        + sizeof(Io::dutyState)
+#endif
+#ifdef SOUNDBAR_FILTER
+        + sizeof(juniper::array<Signal::biquadState, 2>)
+#endif
+        ;
+    static_assert(sizeof(instance<8>) <= instanceBudget, "SoundBar::instance outgrew its footprint budget");
+    static_assert(sizeof(instance<8>) == sizeof(instance<64>), "SoundBar::instance must not grow with its bar");
+}
+
 namespace Prelude {
     template<typename t5, typename t3, typename t4>
     juniper::function<t4(t5)> compose(juniper::function<t4(t3)> f, juniper::function<t3(t5)> g);
@@ -761,11 +2146,46 @@ namespace List {
     Prelude::list<t80, c10> append(Prelude::list<t80, c8> lstA, Prelude::list<t80, c9> lstB);
 }
 
+namespace List {
+    template<typename t810, typename t811, int c810, typename t812>
+    constexpr Prelude::list<t811, c810> mapConst(t812 f, Prelude::list<t810, c810> lst);
+}
+
+namespace List {
+    template<typename t813, int c813, int c814, int c815>
+    constexpr Prelude::list<t813, c815> appendConst(Prelude::list<t813, c813> lstA, Prelude::list<t813, c814> lstB);
+}
+
 namespace List {
     template<typename t96, int c16>
     t96 nth(uint32_t i, Prelude::list<t96, c16> lst);
 }
 
+namespace List {
+    template<typename t820, int c820>
+    uint32_t length(const Prelude::flashList<t820, c820> &lst);
+}
+
+namespace List {
+    template<typename t821, int c821>
+    t821 nth(uint32_t i, const Prelude::flashList<t821, c821> &lst);
+}
+
+namespace List {
+    template<typename t822, int c822>
+    Prelude::unit foreach(juniper::function<Prelude::unit(t822)> f, const Prelude::flashList<t822, c822> &lst);
+}
+
+namespace List {
+    template<typename t823, typename t824, int c823>
+    t824 foldl(juniper::function<t824(t823,t824)> f, t824 initState, const Prelude::flashList<t823, c823> &lst);
+}
+
+namespace List {
+    template<typename t825, int c825>
+    Prelude::list<t825, c825> load(const Prelude::flashList<t825, c825> &lst);
+}
+
 namespace List {
     template<typename t98, int c17, int c18>
     Prelude::list<t98, (c17)*(c18)> flattenSafe(Prelude::list<Prelude::list<t98, c17>, c18> listOfLists);
@@ -803,7 +2223,7 @@ namespace List {
 
 namespace List {
     template<typename t154, int c39>
-    Prelude::list<t154, c39> replicate(uint32_t numOfElements, t154 elem);
+    constexpr Prelude::list<t154, c39> replicate(uint32_t numOfElements, t154 elem);
 }
 
 namespace List {
@@ -861,6 +2281,26 @@ namespace List {
     t236 average(Prelude::list<t236, c65> lst);
 }
 
+namespace List {
+    template<typename t800, int c800, unsigned long long c801>
+    typename juniper::accumulator<t800, c800, c801>::type sumBounded(Prelude::list<t800, c800> lst);
+}
+
+namespace List {
+    template<typename t802, int c802>
+    typename juniper::accumulator<t802, c802>::type sumWide(Prelude::list<t802, c802> lst);
+}
+
+namespace List {
+    template<typename t803, int c803, unsigned long long c804>
+    t803 averageBounded(Prelude::list<t803, c803> lst);
+}
+
+namespace List {
+    template<typename t805, int c805>
+    t805 averageWide(Prelude::list<t805, c805> lst);
+}
+
 namespace Signal {
     template<typename t238, typename t239>
     Prelude::sig<t239> map(juniper::function<t239(t238)> f, Prelude::sig<t238> s);
@@ -871,6 +2311,11 @@ namespace Signal {
     Prelude::unit sink(juniper::function<Prelude::unit(t250)> f, Prelude::sig<t250> s);
 }
 
+namespace Signal {
+    template<typename t918, typename Func>
+    Prelude::unit sink(Func f, Prelude::sig<t918> s);
+}
+
 namespace Signal {
     template<typename t254>
     Prelude::sig<t254> filter(juniper::function<bool(t254)> f, Prelude::sig<t254> s);
@@ -921,6 +2366,99 @@ namespace Signal {
     Prelude::sig<Prelude::list<t358, c67>> record(Prelude::sig<t358> incoming, juniper::shared_ptr<Prelude::list<t358, c67>> pastValues);
 }
 
+namespace Signal {
+    template<typename t890, typename t891, int c890, typename Func>
+    Prelude::sig<Prelude::list<t891, c890>> mapBlock(Func f, Prelude::sig<Prelude::list<t890, c890>> s);
+}
+
+namespace Signal {
+    template<typename t892, int c891, typename Func>
+    Prelude::sig<Prelude::list<t892, c891>> filterBlock(Func f, Prelude::sig<Prelude::list<t892, c891>> s);
+}
+
+namespace Signal {
+    template<typename t893, typename t894, int c892, typename Func>
+    Prelude::sig<Prelude::list<t894, c892>> foldPBlock(Func f, juniper::shared_ptr<t894> state0, Prelude::sig<Prelude::list<t893, c892>> incoming);
+}
+
+namespace Signal {
+    template<typename t895, int c893, typename Func>
+    Prelude::unit sinkBlock(Func f, Prelude::sig<Prelude::list<t895, c893>> s);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs biquadNormalize(double b0, double b1, double b2, double a0, double a1, double a2);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs highPassFrom(double cosW0, double alpha);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs highPass(double sampleRate, double corner, double q);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs bandPassFrom(double cosW0, double alpha);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs bandPass(double sampleRate, double center, double q);
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs dcBlock(double pole);
+}
+
+namespace Signal {
+    template<int c900>
+    juniper::shared_ptr<juniper::array<Signal::biquadState, c900>> biquadStart();
+}
+
+namespace Signal {
+    int16_t biquadStep(const Signal::biquadCoeffs &k, Signal::biquadState &st, int16_t x);
+}
+
+namespace Signal {
+    template<int c901, const Signal::biquadCoeffs *c902>
+    Prelude::sig<int16_t> biquad(Prelude::sig<int16_t> s, juniper::shared_ptr<juniper::array<Signal::biquadState, c901>> state);
+}
+
+namespace Signal {
+    template<int c903, const Signal::biquadCoeffs *c904, int c905>
+    Prelude::sig<Prelude::list<int16_t, c905>> biquadBlock(Prelude::sig<Prelude::list<int16_t, c905>> s, juniper::shared_ptr<juniper::array<Signal::biquadState, c903>> state);
+}
+
+namespace Signal {
+    template<int c910, int c911>
+    uint16_t envelopeStep(uint16_t target, uint16_t current);
+}
+
+namespace Signal {
+    template<int c918, int c919, unsigned long long c920>
+    uint16_t envelopeFold(uint16_t value, uint16_t level);
+}
+
+namespace Signal {
+    template<unsigned long long c921>
+    uint16_t envelopeLevel(uint16_t level);
+}
+
+namespace Signal {
+    template<int c912, int c913, unsigned long long c914>
+    Prelude::sig<uint16_t> envelope(Prelude::sig<uint16_t> incoming, juniper::shared_ptr<uint16_t> state);
+}
+
+#ifdef JUNIPER_PROFILE_STAGES
+namespace Signal {
+    Prelude::unit printStageProfile();
+}
+
+namespace Signal {
+    Prelude::unit printStageProfileEvery(uint32_t passes);
+}
+#endif
+
 namespace Io {
     Io::pinState toggle(Io::pinState p);
 }
@@ -934,6 +2472,30 @@ namespace Io {
     Prelude::unit printFloat(float f);
 }
 
+namespace Io {
+    Prelude::unit printText(const char *text);
+}
+
+namespace Io {
+    Prelude::unit printUnsigned(unsigned long value);
+}
+
+namespace Io {
+    Prelude::unit printLine();
+}
+
+namespace Io {
+    Prelude::unit flushSerial();
+}
+
+namespace Io {
+    Io::txPolicy beginReport();
+}
+
+namespace Io {
+    Prelude::unit endReport(Io::txPolicy previous);
+}
+
 namespace Io {
     Prelude::unit beginSerial(uint32_t speed);
 }
@@ -1002,6 +2564,130 @@ namespace Io {
     Prelude::sig<Io::pinState> edge(Prelude::sig<Io::pinState> sig, juniper::shared_ptr<Io::pinState> prevState);
 }
 
+#ifdef JUNIPER_EDGE_INTERRUPTS
+namespace Io {
+    void pinChangeInterrupt();
+}
+
+namespace Io {
+    Prelude::unit watchEdges(uint16_t pin);
+}
+
+namespace Io {
+    Prelude::sig<Io::edgeEvent> edgeIn();
+}
+
+namespace Io {
+    Prelude::sig<Io::pinState> edgeLevelIn();
+}
+
+namespace Io {
+    uint32_t edgesDroppedCount();
+}
+
+namespace Io {
+    Prelude::sig<Prelude::unit> risingEdge(Prelude::sig<Io::edgeEvent> sig);
+}
+
+namespace Io {
+    Prelude::sig<Prelude::unit> fallingEdge(Prelude::sig<Io::edgeEvent> sig);
+}
+#endif
+
+namespace Io {
+    template<int c870>
+    uint16_t dutyLevel(uint32_t activeMicros, uint32_t elapsedMicros);
+}
+
+namespace Io {
+    template<int c871>
+    Prelude::unit dutyAdvance(Io::dutyState &duty, uint32_t t, bool active, uint32_t windowMicros);
+}
+
+namespace Io {
+    template<int c872>
+    Prelude::sig<uint16_t> pulseDensity(Prelude::sig<Io::pinState> sig, uint32_t windowMicros, juniper::shared_ptr<Io::dutyState> state);
+}
+
+#ifdef JUNIPER_EDGE_INTERRUPTS
+namespace Io {
+    template<int c873>
+    Prelude::sig<uint16_t> pulseDensityIn(uint32_t windowMicros, juniper::shared_ptr<Io::dutyState> state);
+}
+#endif
+
+namespace Io {
+    bool telemetrySend(uint8_t type, const uint8_t *payload, uint8_t length);
+}
+
+namespace Io {
+    template<int c840>
+    bool telemetrySamples(Prelude::list<uint16_t, c840> samples);
+}
+
+namespace Io {
+    template<int c841>
+    bool telemetryLevels(Prelude::list<uint16_t, c841> levels);
+}
+
+namespace Io {
+    bool telemetryCounter(uint8_t id, uint32_t value);
+}
+
+#ifdef JUNIPER_TELEMETRY
+namespace Io {
+    Prelude::unit telemetrySample(uint16_t value);
+}
+#endif
+
+namespace Io {
+    Prelude::unit serviceSerial();
+}
+
+namespace Io {
+    Prelude::unit setTxPolicy(Io::txPolicy policy);
+}
+
+namespace Io {
+    bool reserveTx(size_t needed);
+}
+
+namespace Io {
+    size_t serialWrite(const uint8_t *buf, size_t length);
+}
+
+#ifdef JUNIPER_CAPTURE
+namespace Io {
+    Prelude::unit beginCapture();
+}
+
+namespace Io {
+    Prelude::unit captureSample(uint16_t pin, uint16_t value);
+}
+#endif
+
+#ifdef JUNIPER_TRACK_MEMORY
+namespace Io {
+    Prelude::unit paintStack();
+}
+
+namespace Io {
+    uint32_t stackHighWater();
+}
+
+namespace Io {
+    Io::memoryUsage memory();
+}
+
+namespace Io {
+    bool withinMemoryBudget(Io::memoryUsage usage);
+}
+
+namespace Io {
+    Prelude::unit printMemory(Io::memoryUsage usage);
+}
+#endif
+
 namespace Maybe {
     template<typename t453, typename t454>
     Prelude::maybe<t454> map(juniper::function<t454(t453)> f, Prelude::maybe<t453> maybeVal);
@@ -1047,17 +2733,70 @@ namespace Time {
 }
 
 namespace Time {
-    int32_t now();
+    uint32_t now();
+}
+
+namespace Time {
+    uint32_t nowMicros();
 }
 
 namespace Time {
     juniper::shared_ptr<Time::timerState> state();
 }
 
+namespace Time {
+    Prelude::sig<uint32_t> pulseAt(uint32_t t, uint32_t interval, juniper::shared_ptr<Time::timerState> state);
+}
+
 namespace Time {
     Prelude::sig<uint32_t> every(uint32_t interval, juniper::shared_ptr<Time::timerState> state);
 }
 
+namespace Time {
+    Prelude::sig<uint32_t> everyMicros(uint32_t interval, juniper::shared_ptr<Time::timerState> state);
+}
+
+#ifdef JUNIPER_SAMPLE_TIMER
+namespace Time {
+    void sampleInterrupt(uint16_t value);
+}
+
+namespace Time {
+    Prelude::unit startSampling(uint16_t pin, uint32_t rateHz);
+}
+
+namespace Time {
+    double sampleRate();
+}
+
+namespace Time {
+    uint32_t samplesTakenCount();
+}
+
+namespace Time {
+    uint32_t samplesMissedCount();
+}
+
+namespace Time {
+    Prelude::sig<uint16_t> sampleIn();
+}
+
+namespace Time {
+    template<int c894>
+    Prelude::sig<Prelude::list<uint16_t, c894>> sampleBlockIn();
+}
+#endif
+
+#ifdef JUNIPER_PROFILE_LOOP
+namespace Time {
+    Prelude::unit printLoopProfile();
+}
+
+namespace Time {
+    Prelude::unit profileLoop();
+}
+#endif
+
 namespace Math {
     double degToRad(double degrees);
 }
@@ -1170,26 +2909,92 @@ namespace Math {
     double mapRange(double x, double a1, double a2, double b1, double b2);
 }
 
+namespace Math {
+    template<typename t830, int c830>
+    juniper::fixed<t830, c830> mapRange(juniper::fixed<t830, c830> x, juniper::fixed<t830, c830> a1, juniper::fixed<t830, c830> a2, juniper::fixed<t830, c830> b1, juniper::fixed<t830, c830> b2);
+}
+
+namespace Math {
+    template<typename t831, int c831>
+    juniper::fixed<t831, c831> sqrt_(juniper::fixed<t831, c831> x);
+}
+
 namespace Math {
     template<typename t537>
     t537 clamp(t537 x, t537 min, t537 max);
 }
 
-namespace Math {
-    template<typename t539>
-    int32_t sign(t539 n);
+namespace Math {
+    template<typename t539>
+    int32_t sign(t539 n);
+}
+
+namespace Math {
+    int16_t sinQ15(uint16_t angle);
+}
+
+namespace Math {
+    int16_t cosQ15(uint16_t angle);
+}
+
+namespace Math {
+    uint16_t radToAngle(int32_t radians);
+}
+
+namespace Math {
+    int32_t log2Q16(uint32_t x);
+}
+
+namespace Math {
+    int32_t logQ16(uint32_t x);
+}
+
+namespace Math {
+    int32_t log10Q16(uint32_t x);
+}
+
+namespace Math {
+    uint32_t exp2Q16(int32_t x);
+}
+
+namespace Math {
+    uint32_t powQ16(uint32_t x, int32_t y);
+}
+
+namespace Math {
+    uint32_t sqrtQ16(uint32_t x);
+}
+
+namespace Button {
+    juniper::shared_ptr<Button::buttonState> state();
+}
+
+namespace Button {
+    Prelude::sig<Io::pinState> debounceDelay(Prelude::sig<Io::pinState> incoming, uint16_t delay, juniper::shared_ptr<Button::buttonState> buttonState);
+}
+
+namespace Button {
+    Prelude::sig<Io::pinState> debounce(Prelude::sig<Io::pinState> incoming, juniper::shared_ptr<Button::buttonState> buttonState);
+}
+
+namespace Button {
+    template<typename t880>
+    juniper::shared_ptr<Button::bankState<t880>> bank();
 }
 
 namespace Button {
-    juniper::shared_ptr<Button::buttonState> state();
+    template<typename t881, int c880>
+    t881 readBank(Prelude::list<uint16_t, c880> pins);
 }
 
 namespace Button {
-    Prelude::sig<Io::pinState> debounceDelay(Prelude::sig<Io::pinState> incoming, uint16_t delay, juniper::shared_ptr<Button::buttonState> buttonState);
+    template<typename t882>
+    Prelude::sig<t882> debounceBank(Prelude::sig<t882> incoming, juniper::shared_ptr<Button::bankState<t882>> bankState);
 }
 
 namespace Button {
-    Prelude::sig<Io::pinState> debounce(Prelude::sig<Io::pinState> incoming, juniper::shared_ptr<Button::buttonState> buttonState);
+    template<typename t883>
+    Io::pinState bankPin(t883 bits, uint8_t i);
 }
 
 namespace Vector {
@@ -1224,17 +3029,17 @@ namespace Vector {
 
 namespace Vector {
     template<typename t592, int c84>
-    t592 dot(Vector::vector<t592, c84> v1, Vector::vector<t592, c84> v2);
+    typename juniper::product_sum<t592>::result dot(Vector::vector<t592, c84> v1, Vector::vector<t592, c84> v2);
 }
 
 namespace Vector {
     template<typename t598, int c87>
-    t598 magnitude2(Vector::vector<t598, c87> v);
+    typename juniper::product_sum<t598>::result magnitude2(Vector::vector<t598, c87> v);
 }
 
 namespace Vector {
     template<typename t604, int c90>
-    double magnitude(Vector::vector<t604, c90> v);
+    typename juniper::real_type<t604>::type magnitude(Vector::vector<t604, c90> v);
 }
 
 namespace Vector {
@@ -1267,16 +3072,98 @@ namespace Vector {
     Vector::vector<t676, c112> projectPlane(Vector::vector<t676, c112> a, Vector::vector<t676, c112> m);
 }
 
+namespace SoundBar {
+    template<int c850>
+    constexpr SoundBar::instance<c850> makeInstance(uint16_t microphonePin, const uint8_t *barPins, SoundBar::barDriver driver);
+}
+
+namespace SoundBar {
+    template<int c851>
+    Prelude::unit setupInstance(SoundBar::instance<c851> &self);
+}
+
+namespace SoundBar {
+    template<int c852>
+    Prelude::unit resetBar(SoundBar::instance<c852> &self);
+}
+
+namespace SoundBar {
+    template<int c853>
+    Prelude::unit drawBar(SoundBar::instance<c853> &self, uint16_t level);
+}
+
+namespace SoundBar {
+    template<int c854>
+    Prelude::sig<uint16_t> stepInstance(SoundBar::instance<c854> &self);
+}
+
+#if SOUNDBAR_CHANNELS > 1
+namespace SoundBar {
+    template<int c860, int c861, size_t ...Is>
+    constexpr juniper::array<SoundBar::instance<c861>, c860> makeChannels(juniper::index_sequence<Is...>);
+}
+
+namespace SoundBar {
+    template<int c862>
+    uint16_t analogLevel(uint16_t sample);
+}
+
+#ifdef SOUNDBAR_FILTER
+namespace SoundBar {
+    int16_t centerSample(uint16_t sample);
+}
+
+namespace SoundBar {
+    template<int c906>
+    uint16_t filteredLevel(int16_t sample);
+}
+
+namespace SoundBar {
+    template<int c922>
+    Prelude::sig<uint16_t> stepFiltered(SoundBar::instance<c922> &self, Prelude::sig<Prelude::list<int16_t, SOUNDBAR_FILTER_BLOCK>> centeredSig);
+}
+#endif
+
+namespace SoundBar {
+    template<int c863>
+    Prelude::sig<uint16_t> stepAnalog(SoundBar::instance<c863> &self, uint16_t sample);
+}
+
+namespace SoundBar {
+    template<int c864, int c865>
+    Prelude::list<uint16_t, c864> stepChannels(juniper::array<SoundBar::instance<c865>, c864> &channels);
+}
+#endif
+
 namespace SoundBar {
     Prelude::unit setup();
 }
 
+#ifdef JUNIPER_TELEMETRY
+namespace SoundBar {
+    Prelude::unit sendLevel(uint16_t level);
+}
+
 namespace SoundBar {
-    Prelude::unit resetBar();
+    Prelude::unit sendCountersEvery(uint32_t passes);
 }
 
+#if SOUNDBAR_CHANNELS > 1
 namespace SoundBar {
-    Prelude::unit drawBar(uint16_t level);
+    template<int c866>
+    Prelude::unit sendLevels(Prelude::list<uint16_t, c866> levels);
+}
+#endif
+#endif
+
+#ifdef JUNIPER_TRACK_MEMORY
+namespace SoundBar {
+    Prelude::unit checkMemory();
+}
+#endif
+
+namespace SoundBar {
+    Prelude::unit loop();
 }
 
 namespace SoundBar {
@@ -1521,6 +3408,21 @@ namespace List {
     }
 }
 
+namespace List {
+    template<typename t810, typename t811, int c810, typename t812>
+    constexpr Prelude::list<t811, c810> mapConst(t812 f, Prelude::list<t810, c810> lst) {
+        return Prelude::list<t811, c810>{ juniper::map_array<t811, t810, c810>(f, (lst).data, typename juniper::make_index_sequence<c810>::type()), (lst).length };
+    }
+}
+
+namespace List {
+    template<typename t813, int c813, int c814, int c815>
+    constexpr Prelude::list<t813, c815> appendConst(Prelude::list<t813, c813> lstA, Prelude::list<t813, c814> lstB) {
+        static_assert(c813 + c814 <= c815, "appendConst result capacity is smaller than both inputs together");
+        return Prelude::list<t813, c815>{ juniper::append_arrays<t813, c815>((lstA).data, (lstA).length, (lstB).data, (lstB).length, typename juniper::make_index_sequence<c815>::type()), ((lstA).length + (lstB).length) };
+    }
+}
+
 namespace List {
     template<typename t96, int c16>
     t96 nth(uint32_t i, Prelude::list<t96, c16> lst) {
@@ -1542,6 +3444,58 @@ namespace List {
     }
 }
 
+namespace List {
+    template<typename t820, int c820>
+    uint32_t length(const Prelude::flashList<t820, c820> &lst) {
+        return juniper::flash_read(&(lst).length);
+    }
+}
+
+namespace List {
+    template<typename t821, int c821>
+    t821 nth(uint32_t i, const Prelude::flashList<t821, c821> &lst) {
+        return ((i < length<t821, c821>(lst)) ?
+            ((lst).data)[i]
+        :
+            juniper::quit<t821>());
+    }
+}
+
+namespace List {
+    template<typename t822, int c822>
+    Prelude::unit foreach(juniper::function<Prelude::unit(t822)> f, const Prelude::flashList<t822, c822> &lst) {
+        uint32_t n = length<t822, c822>(lst);
+        for (uint32_t i = 0; i < n; i++) {
+            f(((lst).data)[i]);
+        }
+        return {};
+    }
+}
+
+namespace List {
+    template<typename t823, typename t824, int c823>
+    t824 foldl(juniper::function<t824(t823,t824)> f, t824 initState, const Prelude::flashList<t823, c823> &lst) {
+        t824 s = initState;
+        uint32_t n = length<t823, c823>(lst);
+        for (uint32_t i = 0; i < n; i++) {
+            s = f(((lst).data)[i], s);
+        }
+        return s;
+    }
+}
+
+namespace List {
+    template<typename t825, int c825>
+    Prelude::list<t825, c825> load(const Prelude::flashList<t825, c825> &lst) {
+        Prelude::list<t825, c825> ret;
+        ret.length = length<t825, c825>(lst);
+        for (uint32_t i = 0; i < ret.length; i++) {
+            ((ret).data)[i] = ((lst).data)[i];
+        }
+        return ret;
+    }
+}
+
 namespace List {
     template<typename t98, int c17, int c18>
     Prelude::list<t98, (c17)*(c18)> flattenSafe(Prelude::list<Prelude::list<t98, c17>, c18> listOfLists) {
@@ -1766,16 +3720,8 @@ namespace List {
 
 namespace List {
     template<typename t154, int c39>
-    Prelude::list<t154, c39> replicate(uint32_t numOfElements, t154 elem) {
-        return (([&]() -> Prelude::list<t154, c39> {
-            auto n = c39;
-            return (([&]() -> Prelude::list<t154, c39>{
-                Prelude::list<t154, c39> guid42;
-                guid42.data = (juniper::array<t154, c39>().fill(elem));
-                guid42.length = numOfElements;
-                return guid42;
-            })());
-        })());
+    constexpr Prelude::list<t154, c39> replicate(uint32_t numOfElements, t154 elem) {
+        return Prelude::list<t154, c39>{ juniper::fill_array<t154, c39>(elem), numOfElements };
     }
 }
 
@@ -2097,10 +4043,46 @@ namespace List {
     }
 }
 
+namespace List {
+    template<typename t800, int c800, unsigned long long c801>
+    typename juniper::accumulator<t800, c800, c801>::type sumBounded(Prelude::list<t800, c800> lst) {
+        typedef typename juniper::accumulator<t800, c800, c801>::type acc;
+        acc total = 0;
+        for (uint32_t i = 0; i < (lst).length; i++) {
+            total += (acc) ((lst).data)[i];
+        }
+        return total;
+    }
+}
+
+namespace List {
+    template<typename t802, int c802>
+    typename juniper::accumulator<t802, c802>::type sumWide(Prelude::list<t802, c802> lst) {
+        return sumBounded<t802, c802, juniper::numeric_traits<t802>::max>(lst);
+    }
+}
+
+namespace List {
+    template<typename t803, int c803, unsigned long long c804>
+    t803 averageBounded(Prelude::list<t803, c803> lst) {
+        return (((lst).length == 0) ?
+            ((t803) 0)
+        :
+            ((t803) (sumBounded<t803, c803, c804>(lst) / (typename juniper::accumulator<t803, c803, c804>::type) (lst).length)));
+    }
+}
+
+namespace List {
+    template<typename t805, int c805>
+    t805 averageWide(Prelude::list<t805, c805> lst) {
+        return averageBounded<t805, c805, juniper::numeric_traits<t805>::max>(lst);
+    }
+}
+
 namespace Signal {
     template<typename t238, typename t239>
     Prelude::sig<t239> map(juniper::function<t239(t238)> f, Prelude::sig<t238> s) {
-        return (([&]() -> Prelude::sig<t239> {
+        Prelude::sig<t239> ret = (([&]() -> Prelude::sig<t239> {
             auto guid73 = s;
             return ((((guid73).tag == 0) && ((((guid73).signal).tag == 0) && true)) ? 
                 (([&]() -> Prelude::sig<t239> {
@@ -2115,13 +4097,15 @@ namespace Signal {
                 :
                     juniper::quit<Prelude::sig<t239>>()));
         })());
+        JUNIPER_STAGE_OUTCOME(((ret).tag == 0) && (((ret).signal).tag == 0));
+        return ret;
     }
 }
 
 namespace Signal {
     template<typename t250>
     Prelude::unit sink(juniper::function<Prelude::unit(t250)> f, Prelude::sig<t250> s) {
-        return (([&]() -> Prelude::unit {
+        Prelude::unit ret = (([&]() -> Prelude::unit {
             auto guid74 = s;
             return ((((guid74).tag == 0) && ((((guid74).signal).tag == 0) && true)) ? 
                 (([&]() -> Prelude::unit {
@@ -2136,13 +4120,28 @@ namespace Signal {
                 :
                     juniper::quit<Prelude::unit>()));
         })());
+        JUNIPER_STAGE_OUTCOME(((s).tag == 0) && (((s).signal).tag == 0));
+        return ret;
+    }
+}
+
+namespace Signal {
+    // sink with f called directly rather than through a juniper::function,
+    // so a lambda or plain function sinks a signal without a heap allocation.
+    template<typename t918, typename Func>
+    Prelude::unit sink(Func f, Prelude::sig<t918> s) {
+        JUNIPER_STAGE_OUTCOME(((s).tag == 0) && (((s).signal).tag == 0));
+        if (((s).tag == 0) && (((s).signal).tag == 0)) {
+            f(((s).signal).just);
+        }
+        return {};
     }
 }
 
 namespace Signal {
     template<typename t254>
     Prelude::sig<t254> filter(juniper::function<bool(t254)> f, Prelude::sig<t254> s) {
-        return (([&]() -> Prelude::sig<t254> {
+        Prelude::sig<t254> ret = (([&]() -> Prelude::sig<t254> {
             auto guid75 = s;
             return ((((guid75).tag == 0) && ((((guid75).signal).tag == 0) && true)) ? 
                 (([&]() -> Prelude::sig<t254> {
@@ -2160,6 +4159,8 @@ namespace Signal {
                 :
                     juniper::quit<Prelude::sig<t254>>()));
         })());
+        JUNIPER_STAGE_OUTCOME(((ret).tag == 0) && (((ret).signal).tag == 0));
+        return ret;
     }
 }
 
@@ -2270,7 +4271,7 @@ namespace Signal {
 namespace Signal {
     template<typename t302, typename t308>
     Prelude::sig<t308> foldP(juniper::function<t308(t302,t308)> f, juniper::shared_ptr<t308> state0, Prelude::sig<t302> incoming) {
-        return (([&]() -> Prelude::sig<t308> {
+        Prelude::sig<t308> ret = (([&]() -> Prelude::sig<t308> {
             auto guid83 = incoming;
             return ((((guid83).tag == 0) && ((((guid83).signal).tag == 0) && true)) ? 
                 (([&]() -> Prelude::sig<t308> {
@@ -2294,6 +4295,8 @@ namespace Signal {
                 :
                     juniper::quit<Prelude::sig<t308>>()));
         })());
+        JUNIPER_STAGE_OUTCOME(((ret).tag == 0) && (((ret).signal).tag == 0));
+        return ret;
     }
 }
 
@@ -2422,15 +4425,551 @@ namespace Signal {
     }
 }
 
-namespace Signal {
-    template<typename t358, int c67>
-    Prelude::sig<Prelude::list<t358, c67>> record(Prelude::sig<t358> incoming, juniper::shared_ptr<Prelude::list<t358, c67>> pastValues) {
-        return (([&]() -> Prelude::sig<Prelude::list<t358, c67>> {
-            auto n = c67;
-            return foldP<t358, Prelude::list<t358, c67>>(List::pushOffFront<t358, c67>, pastValues, incoming);
-        })());
+namespace Signal {
+    template<typename t358, int c67>
+    Prelude::sig<Prelude::list<t358, c67>> record(Prelude::sig<t358> incoming, juniper::shared_ptr<Prelude::list<t358, c67>> pastValues) {
+        return (([&]() -> Prelude::sig<Prelude::list<t358, c67>> {
+            auto n = c67;
+            return foldP<t358, Prelude::list<t358, c67>>(List::pushOffFront<t358, c67>, pastValues, incoming);
+        })());
+    }
+}
+
+namespace Signal {
+    // Block counterpart of map. A block is a list of up to c890 samples
+    // carried by one sig, so the sig is unwrapped once per block and f runs
+    // in a plain loop over the live samples. f is any callable: a lambda or
+    // function is inlined into the loop, while a juniper::function still
+    // makes one indirect call per sample. The result is written in place
+    // rather than through just and signal, which would copy whole blocks,
+    // and the length is read once since writes to the output may alias it.
+    // None of the block combinators emit an empty block: a block with no
+    // live samples is passed on as nothing, the way filter passes on a
+    // dropped value.
+    template<typename t890, typename t891, int c890, typename Func>
+    Prelude::sig<Prelude::list<t891, c890>> mapBlock(Func f, Prelude::sig<Prelude::list<t890, c890>> s) {
+        Prelude::sig<Prelude::list<t891, c890>> ret;
+        ((ret).signal).tag = 1;
+        if (((s).signal).tag == 0) {
+            const Prelude::list<t890, c890> &block = ((s).signal).just;
+            Prelude::list<t891, c890> &out = ((ret).signal).just;
+            uint32_t length = (block).length;
+            for (uint32_t i = 0; i < length; i++) {
+                ((out).data)[i] = f(((block).data)[i]);
+            }
+            (out).length = length;
+            ((ret).signal).tag = (length == 0) ? 1 : 0;
+        }
+        JUNIPER_STAGE_OUTCOME(((ret).signal).tag == 0);
+        return ret;
+    }
+}
+
+namespace Signal {
+    // Block counterpart of filter: samples for which f is true are dropped
+    // and the rest are packed to the front, keeping their order. Every
+    // sample is written and the output index only advances past the kept
+    // ones, so the loop does not branch on f. A block with nothing left is
+    // not emitted (see mapBlock).
+    template<typename t892, int c891, typename Func>
+    Prelude::sig<Prelude::list<t892, c891>> filterBlock(Func f, Prelude::sig<Prelude::list<t892, c891>> s) {
+        Prelude::sig<Prelude::list<t892, c891>> ret;
+        ((ret).signal).tag = 1;
+        if (((s).signal).tag == 0) {
+            const Prelude::list<t892, c891> &block = ((s).signal).just;
+            Prelude::list<t892, c891> &out = ((ret).signal).just;
+            uint32_t kept = 0;
+            uint32_t length = (block).length;
+            for (uint32_t i = 0; i < length; i++) {
+                t892 value = ((block).data)[i];
+                ((out).data)[kept] = value;
+                kept += f(value) ? 0 : 1;
+            }
+            (out).length = kept;
+            ((ret).signal).tag = (kept == 0) ? 1 : 0;
+        }
+        JUNIPER_STAGE_OUTCOME(((ret).signal).tag == 0);
+        return ret;
+    }
+}
+
+namespace Signal {
+    // Block counterpart of foldP. The state is kept in a local for the whole
+    // block and stored back once; the block emitted holds the state after
+    // each sample, exactly what foldP would have emitted one at a time. An
+    // empty block leaves the state alone and is not emitted (see mapBlock).
+    template<typename t893, typename t894, int c892, typename Func>
+    Prelude::sig<Prelude::list<t894, c892>> foldPBlock(Func f, juniper::shared_ptr<t894> state0, Prelude::sig<Prelude::list<t893, c892>> incoming) {
+        Prelude::sig<Prelude::list<t894, c892>> ret;
+        ((ret).signal).tag = 1;
+        if (((incoming).signal).tag == 0) {
+            const Prelude::list<t893, c892> &block = ((incoming).signal).just;
+            Prelude::list<t894, c892> &out = ((ret).signal).just;
+            t894 state = (*((state0).get()));
+            uint32_t length = (block).length;
+            for (uint32_t i = 0; i < length; i++) {
+                state = f(((block).data)[i], state);
+                ((out).data)[i] = state;
+            }
+            (*((t894*) (state0.get())) = state);
+            (out).length = length;
+            ((ret).signal).tag = (length == 0) ? 1 : 0;
+        }
+        JUNIPER_STAGE_OUTCOME(((ret).signal).tag == 0);
+        return ret;
+    }
+}
+
+namespace Signal {
+    // Block counterpart of sink: f is called on every live sample in order.
+    template<typename t895, int c893, typename Func>
+    Prelude::unit sinkBlock(Func f, Prelude::sig<Prelude::list<t895, c893>> s) {
+        JUNIPER_STAGE_OUTCOME(((s).signal).tag == 0);
+        if (((s).signal).tag == 0) {
+            const Prelude::list<t895, c893> &block = ((s).signal).just;
+            uint32_t length = (block).length;
+            for (uint32_t i = 0; i < length; i++) {
+                f(((block).data)[i]);
+            }
+        }
+        return {};
+    }
+}
+
+namespace Signal {
+    // Filter design, after the RBJ audio EQ cookbook. Everything is constexpr,
+    // so a cascade declared as a constexpr array of these costs no code or
+    // floating point at run time.
+    constexpr Signal::biquadCoeffs biquadNormalize(double b0, double b1, double b2, double a0, double a1, double a2) {
+        return Signal::biquadCoeffs{ juniper::fixed<int16_t, 14>(b0 / a0), juniper::fixed<int16_t, 14>(b1 / a0), juniper::fixed<int16_t, 14>(b2 / a0),
+            juniper::fixed<int16_t, 14>(a1 / a0), juniper::fixed<int16_t, 14>(a2 / a0) };
+    }
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs highPassFrom(double cosW0, double alpha) {
+        return biquadNormalize((1.0 + cosW0) / 2.0, -(1.0 + cosW0), (1.0 + cosW0) / 2.0, 1.0 + alpha, -2.0 * cosW0, 1.0 - alpha);
+    }
+}
+
+namespace Signal {
+    // Second order high-pass with its -3 dB point near corner for q 0.707.
+    constexpr Signal::biquadCoeffs highPass(double sampleRate, double corner, double q) {
+        return highPassFrom(juniper::constexpr_cos(2.0 * 3.14159265358979 * corner / sampleRate),
+            juniper::constexpr_sin(2.0 * 3.14159265358979 * corner / sampleRate) / (2.0 * q));
+    }
+}
+
+namespace Signal {
+    constexpr Signal::biquadCoeffs bandPassFrom(double cosW0, double alpha) {
+        return biquadNormalize(alpha, 0.0, -alpha, 1.0 + alpha, -2.0 * cosW0, 1.0 - alpha);
+    }
+}
+
+namespace Signal {
+    // Band-pass with 0 dB gain at center and bandwidth center / q.
+    constexpr Signal::biquadCoeffs bandPass(double sampleRate, double center, double q) {
+        return bandPassFrom(juniper::constexpr_cos(2.0 * 3.14159265358979 * center / sampleRate),
+            juniper::constexpr_sin(2.0 * 3.14159265358979 * center / sampleRate) / (2.0 * q));
+    }
+}
+
+namespace Signal {
+    // First order DC blocker y[n] = x[n] - x[n-1] + pole y[n-1]. The corner
+    // is about (1 - pole) / (2 pi) times the sample rate, so it needs no
+    // rate; 0.995 puts it at 6 Hz for 8 kHz sampling.
+    constexpr Signal::biquadCoeffs dcBlock(double pole) {
+        return biquadNormalize(1.0, -1.0, 0.0, 1.0, -pole, 0.0);
+    }
+}
+
+namespace Signal {
+    template<int c900>
+    juniper::shared_ptr<juniper::array<Signal::biquadState, c900>> biquadStart() {
+        return (juniper::shared_ptr<juniper::array<Signal::biquadState, c900>>(new juniper::array<Signal::biquadState, c900>((([&]() -> juniper::array<Signal::biquadState, c900> {
+            juniper::array<Signal::biquadState, c900> ret;
+            ret.fill(Signal::biquadState{ 0, 0, 0, 0 });
+            return ret;
+        })()))));
+    }
+}
+
+namespace Signal {
+    // One Direct Form I step. All five products are summed in a 32 bit
+    // accumulator and rounded back to 16 bits once, with saturation. Samples
+    // should stay within +-8191, which leaves the accumulator headroom for
+    // any stable section and for gains up to about 4.
+    int16_t biquadStep(const Signal::biquadCoeffs &k, Signal::biquadState &st, int16_t x) {
+        int32_t acc = (int32_t) (k).b0.raw * x + (int32_t) (k).b1.raw * (st).x1 + (int32_t) (k).b2.raw * (st).x2
+            - (int32_t) (k).a1.raw * (st).y1 - (int32_t) (k).a2.raw * (st).y2;
+        acc = (acc + (1 << 13)) >> 14;
+        int16_t y = (int16_t) ((acc > 32767) ? 32767 : ((acc < -32768) ? -32768 : acc));
+        (st).x2 = (st).x1;
+        (st).x1 = x;
+        (st).y2 = (st).y1;
+        (st).y1 = y;
+        return y;
+    }
+}
+
+namespace Signal {
+    // Runs each sample through the c901 sections at c902 in turn. c902 points
+    // at a constexpr array, so the coefficients are compile time constants
+    // the compiler can fold into the multiplies.
+    template<int c901, const Signal::biquadCoeffs *c902>
+    Prelude::sig<int16_t> biquad(Prelude::sig<int16_t> s, juniper::shared_ptr<juniper::array<Signal::biquadState, c901>> state) {
+        if (((s).signal).tag == 0) {
+            int16_t y = ((s).signal).just;
+            juniper::array<Signal::biquadState, c901> &st = (*((state).get()));
+            for (int i = 0; i < c901; i++) {
+                y = biquadStep(c902[i], st[i], y);
+            }
+            ((s).signal).just = y;
+        }
+        JUNIPER_STAGE_OUTCOME(((s).signal).tag == 0);
+        return s;
+    }
+}
+
+namespace Signal {
+    // Block form of biquad. The history of every section is copied into a
+    // local for the whole block and stored back once, so it can live in
+    // registers instead of being loaded and stored for every sample. Each
+    // sample still passes through all sections before the next one starts,
+    // which lets the sections' recurrences overlap. An empty block is not
+    // emitted (see mapBlock).
+    template<int c903, const Signal::biquadCoeffs *c904, int c905>
+    Prelude::sig<Prelude::list<int16_t, c905>> biquadBlock(Prelude::sig<Prelude::list<int16_t, c905>> s, juniper::shared_ptr<juniper::array<Signal::biquadState, c903>> state) {
+        if (((s).signal).tag == 0) {
+            Prelude::list<int16_t, c905> &block = ((s).signal).just;
+            juniper::array<Signal::biquadState, c903> st = (*((state).get()));
+            uint32_t length = (block).length;
+            for (uint32_t j = 0; j < length; j++) {
+                int16_t y = ((block).data)[j];
+                for (int i = 0; i < c903; i++) {
+                    y = biquadStep(c904[i], st[i], y);
+                }
+                ((block).data)[j] = y;
+            }
+            (*((juniper::array<Signal::biquadState, c903>*) (state.get())) = st);
+            ((s).signal).tag = (length == 0) ? 1 : 0;
+        }
+        JUNIPER_STAGE_OUTCOME(((s).signal).tag == 0);
+        return s;
+    }
+}
+
+namespace Signal {
+    // One step of a one-pole filter from current towards target, by
+    // 1 / 2^c910 of the distance when rising and 1 / 2^c911 when falling,
+    // so the attack and release time constants are about 2^c910 and 2^c911
+    // steps. Steps are rounded away from current, so the filter always
+    // settles exactly on a steady target instead of stalling short of it.
+    template<int c910, int c911>
+    uint16_t envelopeStep(uint16_t target, uint16_t current) {
+        static_assert(c910 >= 0 && c910 < 16 && c911 >= 0 && c911 < 16, "envelope shifts must be 0 .. 15");
+        return ((target > current) ? 
+            (uint16_t) (current + (((uint32_t) (target - current) + ((1u << c910) - 1)) >> c910))
+        :
+            (uint16_t) (current - (((uint32_t) (current - target) + ((1u << c911) - 1)) >> c911)));
+    }
+}
+
+namespace Signal {
+    // The envelope state after value 0 .. c920 arrives at state level, for
+    // foldP and foldPBlock: the value is clipped, given as many fractional
+    // bits as c920 leaves free, and stepped towards (see envelopeStep). A
+    // bound of 0, a one-pin bar, holds the state at 0.
+    template<int c918, int c919, unsigned long long c920>
+    uint16_t envelopeFold(uint16_t value, uint16_t level) {
+        static_assert(c920 <= 0xFFFF, "envelope bound must fit in 16 bits");
+        const int fracBits = 16 - juniper::bit_width(c920);
+        uint16_t target = (uint16_t) (((value > c920) ? (uint16_t) c920 : value) << fracBits);
+        return envelopeStep<c918, c919>(target, level);
+    }
+}
+
+namespace Signal {
+    // The value 0 .. c921 an envelope state stands for, rounded to nearest.
+    template<unsigned long long c921>
+    uint16_t envelopeLevel(uint16_t level) {
+        const int fracBits = 16 - juniper::bit_width(c921);
+        return (uint16_t) (((uint32_t) level + ((1u << fracBits) >> 1)) >> fracBits);
+    }
+}
+
+namespace Signal {
+    // Peak envelope of incoming values 0 .. c914, with attack and release
+    // shifts c912 and c913 (see envelopeStep). Unlike record and an
+    // average, the only state is the envelope itself in 2 bytes, kept with
+    // as many fractional bits as c914 leaves free, and each value costs one
+    // step however long the time constants are. Larger values are clipped.
+    template<int c912, int c913, unsigned long long c914>
+    Prelude::sig<uint16_t> envelope(Prelude::sig<uint16_t> incoming, juniper::shared_ptr<uint16_t> state) {
+        if (((incoming).signal).tag == 0) {
+            uint16_t level = envelopeFold<c912, c913, c914>(((incoming).signal).just, (*((state).get())));
+            (*((uint16_t*) (state.get())) = level);
+            ((incoming).signal).just = envelopeLevel<c914>(level);
+        }
+        JUNIPER_STAGE_OUTCOME(((incoming).signal).tag == 0);
+        return incoming;
+    }
+}
+
+#ifdef JUNIPER_PROFILE_STAGES
+namespace Signal {
+    // One line per JUNIPER_STAGE site: invocations, how many produced a
+    // value, how many were empty and the cumulative time in cycles.
+    Prelude::unit printStageProfile() {
+        Io::txPolicy policy = Io::beginReport();
+        Io::printText("stage calls just nothing cycles");
+        Io::printLine();
+        for (juniper::stage_counter *c = juniper::stage_counter::head(); c != nullptr; c = c->next) {
+            Io::printText(c->name);
+            Io::printText(" ");
+            Io::printUnsigned(c->calls);
+            Io::printText(" ");
+            Io::printUnsigned(c->values);
+            Io::printText(" ");
+            Io::printUnsigned(c->empties);
+            Io::printText(" ");
+            Io::printUnsigned(c->cycles);
+            Io::printLine();
+        }
+        Io::endReport(policy);
+        return {};
+    }
+}
+
+namespace Signal {
+    JUNIPER_THREAD_LOCAL uint32_t stageReportCountdown = 0;
+}
+
+namespace Signal {
+    Prelude::unit printStageProfileEvery(uint32_t passes) {
+        if (++stageReportCountdown >= passes) {
+            stageReportCountdown = 0;
+            printStageProfile();
+        }
+        return {};
+    }
+}
+#endif
+
+#ifndef JUNIPER_SERIAL_TX_BYTES
+#define JUNIPER_SERIAL_TX_BYTES 128
+#endif
+
+namespace Io {
+    // Outgoing serial bytes wait here until serviceSerial hands them to the
+    // core's interrupt driven transmitter, which only ever gets as many bytes
+    // as it has room for. What happens when the queue is full is decided by
+    // serialTxPolicy: txDrop discards and counts, txBlock services the
+    // transmitter until there is room.
+    JUNIPER_THREAD_LOCAL juniper::ring_buffer<uint8_t, JUNIPER_SERIAL_TX_BYTES> serialTx;
+    JUNIPER_THREAD_LOCAL Io::txPolicy serialTxPolicy = Io::txDrop();
+    JUNIPER_THREAD_LOCAL uint32_t serialDropped = 0;
+    JUNIPER_THREAD_LOCAL uint32_t telemetryDropped = 0;
+}
+
+namespace Io {
+    Prelude::unit setTxPolicy(Io::txPolicy policy) {
+        serialTxPolicy = policy;
+        return {};
+    }
+}
+
+namespace Io {
+    // Waits for room under txBlock. Returns whether needed bytes now fit.
+    bool reserveTx(size_t needed) {
+        if (needed > JUNIPER_SERIAL_TX_BYTES - 1) {
+            return false;
+        }
+        while ((serialTxPolicy).tag == 1 && serialTx.free() < needed) {
+            serviceSerial();
+        }
+        return serialTx.free() >= needed;
+    }
+}
+
+namespace Io {
+    // Queues as much of buf as the policy allows and returns how many bytes
+    // were accepted. Under txDrop the remainder is counted in serialDropped.
+    // Whatever the transmitter has room for is handed over straight away,
+    // so output does not depend on the caller servicing the queue.
+    size_t serialWrite(const uint8_t *buf, size_t length) {
+        size_t written = 0;
+        while (written < length) {
+            if (serialTx.free() == 0 && !reserveTx(1)) {
+                break;
+            }
+            serialTx.push(buf[written++]);
+        }
+        serialDropped += length - written;
+        serviceSerial();
+        return written;
+    }
+}
+
+namespace Io {
+    bool telemetrySend(uint8_t type, const uint8_t *payload, uint8_t length) {
+        bool sent = reserveTx((size_t) length + juniper::telemetry::overhead) &&
+            juniper::telemetry::write_frame(serialTx, type, payload, length);
+        if (!sent) {
+            telemetryDropped++;
+        }
+        return sent;
+    }
+}
+
+namespace Io {
+    // A list's whole capacity must fit in one frame in the TX queue, so no
+    // word is ever cut off and only a busy queue can turn a frame away.
+    template<int c842>
+    bool telemetryWords(uint8_t type, Prelude::list<uint16_t, c842> words) {
+        static_assert(c842 > 0, "telemetry lists need a capacity of at least one word");
+        static_assert(2 * c842 + juniper::telemetry::overhead <= JUNIPER_SERIAL_TX_BYTES - 1,
+            "a telemetry list must fit in one frame in the TX queue: raise JUNIPER_SERIAL_TX_BYTES");
+        uint8_t payload[2 * c842] = { 0 };
+        uint8_t length = (uint8_t) (words).length;
+        for (uint8_t i = 0; i < length; i++) {
+            payload[2 * i] = (uint8_t) ((words).data)[i];
+            payload[2 * i + 1] = (uint8_t) (((words).data)[i] >> 8);
+        }
+        return telemetrySend(type, payload, 2 * length);
+    }
+}
+
+namespace Io {
+    template<int c840>
+    bool telemetrySamples(Prelude::list<uint16_t, c840> samples) {
+        return telemetryWords<c840>(juniper::telemetry::samples, samples);
+    }
+}
+
+namespace Io {
+    template<int c841>
+    bool telemetryLevels(Prelude::list<uint16_t, c841> levels) {
+        return telemetryWords<c841>(juniper::telemetry::levels, levels);
+    }
+}
+
+namespace Io {
+    // Payload is the counter id followed by its 32 bit value.
+    bool telemetryCounter(uint8_t id, uint32_t value) {
+        uint8_t payload[5] = { id, (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+        return telemetrySend(juniper::telemetry::counters, payload, 5);
+    }
+}
+
+#ifdef JUNIPER_TELEMETRY
+#ifndef JUNIPER_TELEMETRY_SAMPLE_EVERY
+#define JUNIPER_TELEMETRY_SAMPLE_EVERY 8
+#endif
+#ifndef JUNIPER_TELEMETRY_SAMPLE_BATCH
+#define JUNIPER_TELEMETRY_SAMPLE_BATCH 16
+#endif
+
+namespace Io {
+    // Raw pin reads waiting to go out in a samples frame. Every
+    // JUNIPER_TELEMETRY_SAMPLE_EVERY-th read is kept, in read order, and a
+    // frame is sent once JUNIPER_TELEMETRY_SAMPLE_BATCH have been kept.
+    JUNIPER_THREAD_LOCAL Prelude::list<uint16_t, JUNIPER_TELEMETRY_SAMPLE_BATCH> sampleBatch = List::replicate<uint16_t, JUNIPER_TELEMETRY_SAMPLE_BATCH>(0, 0);
+    JUNIPER_THREAD_LOCAL uint8_t sampleSkip = 0;
+}
+
+namespace Io {
+    Prelude::unit telemetrySample(uint16_t value) {
+        if (++sampleSkip < JUNIPER_TELEMETRY_SAMPLE_EVERY) {
+            return {};
+        }
+        sampleSkip = 0;
+        ((sampleBatch).data)[(sampleBatch).length++] = value;
+        if ((sampleBatch).length == JUNIPER_TELEMETRY_SAMPLE_BATCH) {
+            telemetrySamples<JUNIPER_TELEMETRY_SAMPLE_BATCH>(sampleBatch);
+            (sampleBatch).length = 0;
+        }
+        return {};
+    }
+}
+#endif
+
+namespace Io {
+    Prelude::unit serviceSerial() {
+        if (serialTx.empty()) {
+            return {};
+        }
+        int room = Serial.availableForWrite();
+        uint8_t byte;
+        while (room-- > 0 && serialTx.pop(byte)) {
+            Serial.write(byte);
+        }
+        return {};
+    }
+}
+
+#ifdef JUNIPER_CAPTURE
+// Records are 8 bytes, so at 115200 baud the link carries only about 1440
+// of them a second, far fewer than the loop reads. Capture therefore runs
+// the port at JUNIPER_CAPTURE_BAUD (1 Mbaud is exact on a 16 MHz AVR and
+// carries about 12500 records/s) and keeps only every
+// JUNIPER_CAPTURE_EVERY-th read, so that the rate can be brought within
+// the link's on purpose instead of by dropping records.
+#ifndef JUNIPER_CAPTURE_BAUD
+#define JUNIPER_CAPTURE_BAUD 1000000
+#endif
+#ifndef JUNIPER_CAPTURE_EVERY
+#define JUNIPER_CAPTURE_EVERY 1
+#endif
+
+namespace Io {
+    // Records that did not fit in the TX queue. Each one leaves a gap in the
+    // trace that shows up as a longer timestamp step on replay. The count
+    // since the last record that was sent travels in that record's last
+    // byte, saturating at 255, so replay can report how much was lost.
+    JUNIPER_THREAD_LOCAL uint32_t captureDropped = 0;
+    JUNIPER_THREAD_LOCAL uint8_t captureUnreported = 0;
+    JUNIPER_THREAD_LOCAL uint8_t captureSkip = 0;
+}
+
+namespace Io {
+    // The trace file header: magic "SBTR", version 1, 8 byte records, and a
+    // record count of zero meaning the records run to the end of the file.
+    // Followed by the records, a dump of the serial port is a trace file that
+    // the host build maps and replays with SOUNDBAR_REPLAY.
+    Prelude::unit beginCapture() {
+        const uint8_t header[16] = { 'S', 'B', 'T', 'R', 1, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        Io::txPolicy policy = serialTxPolicy;
+        setTxPolicy(Io::txBlock());
+        serialWrite(header, sizeof(header));
+        setTxPolicy(policy);
+        return {};
+    }
+}
+
+namespace Io {
+    // Every JUNIPER_CAPTURE_EVERY-th raw pin read is streamed as an 8 byte
+    // little-endian record: micros, value, pin and the number of records
+    // dropped just before it.
+    Prelude::unit captureSample(uint16_t pin, uint16_t value) {
+        if (++captureSkip < JUNIPER_CAPTURE_EVERY) {
+            return {};
+        }
+        captureSkip = 0;
+        uint32_t now = micros();
+        uint8_t record[8] = { (uint8_t) now, (uint8_t) (now >> 8), (uint8_t) (now >> 16), (uint8_t) (now >> 24),
+            (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) pin, captureUnreported };
+        if (reserveTx(sizeof(record))) {
+            serialWrite(record, sizeof(record));
+            captureUnreported = 0;
+        } else {
+            captureDropped++;
+            captureUnreported += (captureUnreported < 255) ? 1 : 0;
+        }
+        return {};
     }
 }
+#endif
 
 namespace Io {
     Io::pinState toggle(Io::pinState p) {
@@ -2457,7 +4996,11 @@ namespace Io {
         return (([&]() -> Prelude::unit {
             auto n = c68;
             return (([&]() -> Prelude::unit {
-                Serial.print(&str.characters.data);
+                uint32_t length = 0;
+                while (length < (str).characters.length && ((str).characters.data)[length] != 0) {
+                    length++;
+                }
+                serialWrite((const uint8_t *) (str).characters.data.data, length);
                 return {};
             })());
         })());
@@ -2467,12 +5010,74 @@ namespace Io {
 namespace Io {
     Prelude::unit printFloat(float f) {
         return (([&]() -> Prelude::unit {
-            Serial.print(f);
+            // Large enough for FLT_MAX with its 39 integer digits, a sign,
+            // the point and two decimals.
+            char buf[48];
+#ifdef __AVR__
+            dtostrf(f, 1, 2, buf);
+#else
+            snprintf(buf, sizeof(buf), "%.2f", (double) f);
+#endif
+            serialWrite((const uint8_t *) buf, strlen(buf));
             return {};
         })());
     }
 }
 
+namespace Io {
+    Prelude::unit printText(const char *text) {
+        serialWrite((const uint8_t *) text, strlen(text));
+        return {};
+    }
+}
+
+namespace Io {
+    Prelude::unit printUnsigned(unsigned long value) {
+        char buf[20];
+        char *p = buf + sizeof(buf);
+        do {
+            *--p = (char) ('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        serialWrite((const uint8_t *) p, (size_t) (buf + sizeof(buf) - p));
+        return {};
+    }
+}
+
+namespace Io {
+    Prelude::unit printLine() {
+        return printText("\r\n");
+    }
+}
+
+namespace Io {
+    // Waits until everything queued has reached the transmitter, e.g. before
+    // the host build exits.
+    Prelude::unit flushSerial() {
+        while (!serialTx.empty()) {
+            serviceSerial();
+        }
+        return {};
+    }
+}
+
+namespace Io {
+    // Reports go through the TX queue like all other output, so they stay in
+    // order with it, but under txBlock so that they arrive whole. Returns the
+    // policy for endReport to restore.
+    Io::txPolicy beginReport() {
+        Io::txPolicy previous = serialTxPolicy;
+        setTxPolicy(Io::txBlock());
+        return previous;
+    }
+}
+
+namespace Io {
+    Prelude::unit endReport(Io::txPolicy previous) {
+        return setTxPolicy(previous);
+    }
+}
+
 namespace Io {
     Prelude::unit beginSerial(uint32_t speed) {
         return (([&]() -> Prelude::unit {
@@ -2538,6 +5143,12 @@ namespace Io {
             
             (([&]() -> Prelude::unit {
                 intVal = digitalRead(pin);
+#ifdef JUNIPER_CAPTURE
+                captureSample(pin, intVal);
+#endif
+#ifdef JUNIPER_TELEMETRY
+                telemetrySample(intVal);
+#endif
                 return {};
             })());
             return intToPinState(intVal);
@@ -2570,6 +5181,12 @@ namespace Io {
             
             (([&]() -> Prelude::unit {
                 value = analogRead(pin);
+#ifdef JUNIPER_CAPTURE
+                captureSample(pin, value);
+#endif
+#ifdef JUNIPER_TELEMETRY
+                telemetrySample(value);
+#endif
                 return {};
             })());
             return value;
@@ -2580,6 +5197,12 @@ namespace Io {
 namespace Io {
     Prelude::unit anaWrite(uint16_t pin, uint8_t value) {
         return (([&]() -> Prelude::unit {
+#if defined(JUNIPER_SAMPLE_TIMER) && defined(__AVR__)
+            // PWM on these pins would reprogram the sampling timer.
+            if (digitalPinToTimer(pin) == TIMER1A || digitalPinToTimer(pin) == TIMER1B) {
+                juniper::quit<Prelude::unit>();
+            }
+#endif
             analogWrite(pin, value);
             return {};
         })());
@@ -2696,70 +5319,409 @@ namespace Io {
 }
 
 namespace Io {
-    Prelude::sig<Prelude::unit> fallingEdge(Prelude::sig<Io::pinState> sig, juniper::shared_ptr<Io::pinState> prevState) {
-        return Signal::toUnit<Io::pinState>(Signal::filter<Io::pinState>(juniper::function<bool(Io::pinState)>([=](Io::pinState currState) mutable -> bool { 
-            return (([&]() -> bool {
-                auto guid103 = (([&]() -> bool {
-                    auto guid104 = (Prelude::tuple2<Io::pinState,Io::pinState>{currState, (*((prevState).get()))});
-                    return (((((guid104).e2).tag == 0) && ((((guid104).e1).tag == 1) && true)) ? 
-                        (([&]() -> bool {
-                            return false;
-                        })())
-                    :
-                        (true ? 
-                            (([&]() -> bool {
-                                return true;
-                            })())
-                        :
-                            juniper::quit<bool>()));
-                })());
-                if (!(true)) {
-                    juniper::quit<Prelude::unit>();
-                }
-                auto ret = guid103;
-                
-                (*((Io::pinState*) (prevState.get())) = currState);
-                return ret;
-            })());
-         }), sig));
+    Prelude::sig<Prelude::unit> fallingEdge(Prelude::sig<Io::pinState> sig, juniper::shared_ptr<Io::pinState> prevState) {
+        return Signal::toUnit<Io::pinState>(Signal::filter<Io::pinState>(juniper::function<bool(Io::pinState)>([=](Io::pinState currState) mutable -> bool { 
+            return (([&]() -> bool {
+                auto guid103 = (([&]() -> bool {
+                    auto guid104 = (Prelude::tuple2<Io::pinState,Io::pinState>{currState, (*((prevState).get()))});
+                    return (((((guid104).e2).tag == 0) && ((((guid104).e1).tag == 1) && true)) ? 
+                        (([&]() -> bool {
+                            return false;
+                        })())
+                    :
+                        (true ? 
+                            (([&]() -> bool {
+                                return true;
+                            })())
+                        :
+                            juniper::quit<bool>()));
+                })());
+                if (!(true)) {
+                    juniper::quit<Prelude::unit>();
+                }
+                auto ret = guid103;
+                
+                (*((Io::pinState*) (prevState.get())) = currState);
+                return ret;
+            })());
+         }), sig));
+    }
+}
+
+namespace Io {
+    Prelude::sig<Io::pinState> edge(Prelude::sig<Io::pinState> sig, juniper::shared_ptr<Io::pinState> prevState) {
+        return Signal::filter<Io::pinState>(juniper::function<bool(Io::pinState)>([=](Io::pinState currState) mutable -> bool { 
+            return (([&]() -> bool {
+                auto guid105 = (([&]() -> bool {
+                    auto guid106 = (Prelude::tuple2<Io::pinState,Io::pinState>{currState, (*((prevState).get()))});
+                    return (((((guid106).e2).tag == 1) && ((((guid106).e1).tag == 0) && true)) ? 
+                        (([&]() -> bool {
+                            return false;
+                        })())
+                    :
+                        (((((guid106).e2).tag == 0) && ((((guid106).e1).tag == 1) && true)) ? 
+                            (([&]() -> bool {
+                                return false;
+                            })())
+                        :
+                            (true ? 
+                                (([&]() -> bool {
+                                    return true;
+                                })())
+                            :
+                                juniper::quit<bool>())));
+                })());
+                if (!(true)) {
+                    juniper::quit<Prelude::unit>();
+                }
+                auto ret = guid105;
+                
+                (*((Io::pinState*) (prevState.get())) = currState);
+                return ret;
+            })());
+         }), sig);
+    }
+}
+
+#ifdef JUNIPER_EDGE_INTERRUPTS
+#ifndef JUNIPER_EDGE_EVENTS
+#define JUNIPER_EDGE_EVENTS 32
+#endif
+
+namespace Io {
+    // Edges on the watched pin, queued by the pin change interrupt and taken
+    // off by edgeIn. The interrupt is the only producer and the loop the only
+    // consumer, so no locking is needed. Edges that arrive while the queue is
+    // full are counted in edgesDropped. There is one queue and one watched
+    // pin per firmware.
+    juniper::ring_buffer<Io::edgeEvent, JUNIPER_EDGE_EVENTS> edgeQueue;
+    uint16_t edgePin = 0;
+    bool edgesWatched = false;
+    volatile uint8_t edgeLevel = 0;
+    volatile uint32_t edgesDropped = 0;
+}
+
+namespace Io {
+    // A pin change vector covers a whole port, so this also runs for other
+    // pins on it; only a change of the watched pin's level is recorded.
+    void pinChangeInterrupt() {
+        uint8_t level = (digitalRead(edgePin) == LOW) ? 0 : 1;
+        if (level == edgeLevel) {
+            return;
+        }
+        edgeLevel = level;
+        Io::edgeEvent event = { (uint32_t) micros(), intToPinState(level) };
+        if (!edgeQueue.push(event)) {
+            edgesDropped++;
+        }
+    }
+}
+
+namespace Io {
+    // Starts queueing edges of pin. On AVR this enables the pin's pin change
+    // interrupt, so any digital pin works; on the host build edges come from
+    // host::injectEdge. Watching a second pin would silently take the first
+    // one's edges, so it halts instead.
+    Prelude::unit watchEdges(uint16_t pin) {
+        if (edgesWatched && edgePin != pin) {
+#ifdef JUNIPER_HOST
+            Io::printText("watchEdges: already watching pin ");
+            Io::printUnsigned(edgePin);
+            Io::printLine();
+            Io::flushSerial();
+#endif
+            return juniper::quit<Prelude::unit>();
+        }
+        edgesWatched = true;
+        edgePin = pin;
+        edgeLevel = (digitalRead(pin) == LOW) ? 0 : 1;
+#if defined(__AVR__)
+        *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+        PCIFR |= _BV(digitalPinToPCICRbit(pin));
+        *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+#elif defined(JUNIPER_HOST)
+        host::enablePinChange(pin, pinChangeInterrupt);
+#else
+        attachInterrupt(digitalPinToInterrupt(pin), pinChangeInterrupt, CHANGE);
+#endif
+        return {};
+    }
+}
+
+#ifdef __AVR__
+ISR(PCINT0_vect) {
+    Io::pinChangeInterrupt();
+}
+
+ISR(PCINT1_vect) {
+    Io::pinChangeInterrupt();
+}
+
+ISR(PCINT2_vect) {
+    Io::pinChangeInterrupt();
+}
+#endif
+
+namespace Io {
+    // The oldest queued edge, if any. One edge is taken per call, so a
+    // burst between two passes is spread over the following passes rather
+    // than lost.
+    Prelude::sig<Io::edgeEvent> edgeIn() {
+        Io::edgeEvent event;
+        return (edgeQueue.pop(event) ? 
+            signal<Io::edgeEvent>(just<Io::edgeEvent>(event))
+        :
+            signal<Io::edgeEvent>(nothing<Io::edgeEvent>()));
+    }
+}
+
+namespace Io {
+    // Edges lost to a full queue so far, read whole.
+    uint32_t edgesDroppedCount() {
+        return juniper::atomic_read(edgesDropped);
+    }
+}
+
+namespace Io {
+    // The watched pin's level as last seen by the interrupt, without reading
+    // the pin.
+    Prelude::sig<Io::pinState> edgeLevelIn() {
+        return signal<Io::pinState>(just<Io::pinState>(intToPinState(edgeLevel)));
+    }
+}
+
+namespace Io {
+    Prelude::sig<Prelude::unit> risingEdge(Prelude::sig<Io::edgeEvent> sig) {
+        return Signal::toUnit<Io::edgeEvent>(Signal::filter<Io::edgeEvent>(juniper::function<bool(Io::edgeEvent)>([=](Io::edgeEvent event) mutable -> bool { 
+            return (((event).state).tag == 1);
+         }), sig));
+    }
+}
+
+namespace Io {
+    Prelude::sig<Prelude::unit> fallingEdge(Prelude::sig<Io::edgeEvent> sig) {
+        return Signal::toUnit<Io::edgeEvent>(Signal::filter<Io::edgeEvent>(juniper::function<bool(Io::edgeEvent)>([=](Io::edgeEvent event) mutable -> bool { 
+            return (((event).state).tag == 0);
+         }), sig));
+    }
+}
+#endif
+
+namespace Io {
+    // active / elapsed scaled to 0 .. c870, rounded. Both times are halved
+    // together until elapsed fits in 16 bits, which keeps the arithmetic in
+    // 32 bits for windows of any length and scales up to 65535.
+    template<int c870>
+    uint16_t dutyLevel(uint32_t activeMicros, uint32_t elapsedMicros) {
+        while (elapsedMicros > 0xFFFF) {
+            elapsedMicros >>= 1;
+            activeMicros >>= 1;
+        }
+        return ((elapsedMicros == 0) ? 
+            0
+        :
+            (uint16_t) ((activeMicros * c870 + elapsedMicros / 2) / elapsedMicros));
+    }
+}
+
+namespace Io {
+    // Credits the time since the last update to the level the input had
+    // then, records the new level, and closes the window once windowMicros
+    // have passed. All times are differences, so micros() wrapping is safe.
+    // A time before the last update credits nothing rather than wrapping to
+    // most of an hour, and the level never exceeds c871.
+    template<int c871>
+    Prelude::unit dutyAdvance(Io::dutyState &duty, uint32_t t, bool active, uint32_t windowMicros) {
+        if ((duty).started && (int32_t) (t - (duty).lastMicros) < 0) {
+            t = (duty).lastMicros;
+        }
+        if (!(duty).started) {
+            (duty).windowStart = t;
+            (duty).lastMicros = t;
+            (duty).activeMicros = 0;
+            (duty).started = true;
+        } else if ((duty).active) {
+            (duty).activeMicros += t - (duty).lastMicros;
+        }
+        (duty).lastMicros = t;
+        (duty).active = active;
+        uint32_t elapsed = t - (duty).windowStart;
+        if (elapsed >= windowMicros) {
+            uint16_t level = dutyLevel<c871>((duty).activeMicros, elapsed);
+            (duty).level = (level > c871) ? c871 : level;
+            (duty).windowStart = t;
+            (duty).activeMicros = 0;
+        }
+        return {};
+    }
+}
+
+namespace Io {
+    // Loudness from a digital microphone comparator: the fraction of each
+    // window of windowMicros that the comparator output was low (sound
+    // present), scaled to 0 .. c872. The level of the last completed window
+    // is emitted on every sample, so a bar can be redrawn every pass. The
+    // estimate is only as fine as the sampling; see pulseDensityIn for one
+    // built on exact edge times.
+    template<int c872>
+    Prelude::sig<uint16_t> pulseDensity(Prelude::sig<Io::pinState> sig, uint32_t windowMicros, juniper::shared_ptr<Io::dutyState> state) {
+        return (([&]() -> Prelude::sig<uint16_t> {
+            auto guid196 = sig;
+            return ((((guid196).tag == 0) && ((((guid196).signal).tag == 0) && true)) ? 
+                (([&]() -> Prelude::sig<uint16_t> {
+                    auto value = ((guid196).signal).just;
+                    dutyAdvance<c872>(*((Io::dutyState*) (state.get())), (uint32_t) micros(), (value).tag == 1, windowMicros);
+                    return signal<uint16_t>(just<uint16_t>(((*((state).get()))).level));
+                })())
+            :
+                signal<uint16_t>(nothing<uint16_t>()));
+        })());
+    }
+}
+
+#ifdef JUNIPER_EDGE_INTERRUPTS
+namespace Io {
+    // pulseDensity driven by the watched pin's queued edges instead of
+    // samples, so every pulse counts for exactly its measured length no
+    // matter how slow the loop is. The time up to now is credited to the
+    // level the last edge left, not to edgeLevel: an edge that lands after
+    // the queue is drained has changed edgeLevel but is only counted, from
+    // its own time, on the next pass.
+    template<int c873>
+    Prelude::sig<uint16_t> pulseDensityIn(uint32_t windowMicros, juniper::shared_ptr<Io::dutyState> state) {
+        return (([&]() -> Prelude::sig<uint16_t> {
+            Io::dutyState &duty = *((Io::dutyState*) (state.get()));
+            Io::edgeEvent event;
+            if (!(duty).started) {
+                while (edgeQueue.pop(event)) {
+                }
+            }
+            while (edgeQueue.pop(event)) {
+                dutyAdvance<c873>(duty, (event).micros, ((event).state).tag == 1, windowMicros);
+            }
+            bool active = (duty).started ? (duty).active : (edgeLevel == 0);
+            dutyAdvance<c873>(duty, (uint32_t) micros(), active, windowMicros);
+            return signal<uint16_t>(just<uint16_t>((duty).level));
+        })());
+    }
+}
+#endif
+
+#ifdef JUNIPER_TRACK_MEMORY
+#ifndef JUNIPER_HEAP_BUDGET
+#define JUNIPER_HEAP_BUDGET 0xFFFFFFFFUL
+#endif
+#ifndef JUNIPER_STACK_BUDGET
+#define JUNIPER_STACK_BUDGET 0xFFFFFFFFUL
+#endif
+
+#ifdef __AVR__
+extern "C" {
+    extern char __heap_start;
+    extern char *__brkval;
+}
+#else
+#ifndef JUNIPER_STACK_PAINT_BYTES
+#define JUNIPER_STACK_PAINT_BYTES 65536
+#endif
+#endif
+
+namespace Io {
+    const uint8_t stackPaint = 0xC5;
+    uintptr_t stackPaintLow = 0;
+    uintptr_t stackPaintHigh = 0;
+}
+
+namespace Io {
+    // Fills the unused stack with a known pattern so that stackHighWater can
+    // later find the deepest byte that was overwritten. Call it once, as
+    // early as possible. On AVR this paints the gap between the heap and the
+    // stack pointer. Elsewhere it paints a fixed size block just below the
+    // caller's frame, which is where deeper calls will land.
+#ifdef __AVR__
+    Prelude::unit paintStack() {
+        uint8_t *p = (uint8_t *) (__brkval ? __brkval : &__heap_start);
+        uint8_t *end = (uint8_t *) SP - 16;
+        stackPaintLow = (uintptr_t) p;
+        stackPaintHigh = (uintptr_t) RAMEND + 1;
+        while (p < end) {
+            *p++ = stackPaint;
+        }
+        return {};
+    }
+#else
+    __attribute__((noinline)) Prelude::unit paintStack() {
+        volatile uint8_t region[JUNIPER_STACK_PAINT_BYTES];
+        for (size_t i = 0; i < JUNIPER_STACK_PAINT_BYTES; i++) {
+            region[i] = stackPaint;
+        }
+        stackPaintLow = (uintptr_t) &region[0];
+        stackPaintHigh = (uintptr_t) &region[JUNIPER_STACK_PAINT_BYTES - 1] + 1;
+        return {};
+    }
+#endif
+}
+
+namespace Io {
+    // Deepest stack use since paintStack in bytes, measured from the top of
+    // the painted region. Zero if the stack was never painted.
+    uint32_t stackHighWater() {
+        if (stackPaintLow == 0) {
+            return 0;
+        }
+        uintptr_t low = stackPaintLow;
+#ifdef __AVR__
+        // Heap growth after painting eats into the bottom of the region.
+        if ((uintptr_t) __brkval > low) {
+            low = (uintptr_t) __brkval;
+        }
+#endif
+        const volatile uint8_t *p = (const volatile uint8_t *) low;
+        while ((uintptr_t) p < stackPaintHigh && *p == stackPaint) {
+            p++;
+        }
+        return (uint32_t) (stackPaintHigh - (uintptr_t) p);
+    }
+}
+
+namespace Io {
+    Io::memoryUsage memory() {
+        juniper::memory_stats &stats = juniper::memoryStats();
+        Io::memoryUsage ret;
+        ret.liveAllocations = stats.liveAllocations;
+        ret.liveBytes = stats.liveBytes;
+        ret.peakBytes = stats.peakBytes;
+        ret.stackHighWater = stackHighWater();
+        return ret;
     }
 }
 
 namespace Io {
-    Prelude::sig<Io::pinState> edge(Prelude::sig<Io::pinState> sig, juniper::shared_ptr<Io::pinState> prevState) {
-        return Signal::filter<Io::pinState>(juniper::function<bool(Io::pinState)>([=](Io::pinState currState) mutable -> bool { 
-            return (([&]() -> bool {
-                auto guid105 = (([&]() -> bool {
-                    auto guid106 = (Prelude::tuple2<Io::pinState,Io::pinState>{currState, (*((prevState).get()))});
-                    return (((((guid106).e2).tag == 1) && ((((guid106).e1).tag == 0) && true)) ? 
-                        (([&]() -> bool {
-                            return false;
-                        })())
-                    :
-                        (((((guid106).e2).tag == 0) && ((((guid106).e1).tag == 1) && true)) ? 
-                            (([&]() -> bool {
-                                return false;
-                            })())
-                        :
-                            (true ? 
-                                (([&]() -> bool {
-                                    return true;
-                                })())
-                            :
-                                juniper::quit<bool>())));
-                })());
-                if (!(true)) {
-                    juniper::quit<Prelude::unit>();
-                }
-                auto ret = guid105;
-                
-                (*((Io::pinState*) (prevState.get())) = currState);
-                return ret;
-            })());
-         }), sig);
+    // Budgets come from JUNIPER_HEAP_BUDGET and JUNIPER_STACK_BUDGET and
+    // default to unlimited.
+    bool withinMemoryBudget(Io::memoryUsage usage) {
+        return (usage.peakBytes <= JUNIPER_HEAP_BUDGET) && (usage.stackHighWater <= JUNIPER_STACK_BUDGET);
     }
 }
 
+namespace Io {
+    Prelude::unit printMemory(Io::memoryUsage usage) {
+        Io::txPolicy policy = beginReport();
+        printText("allocs=");
+        printUnsigned(usage.liveAllocations);
+        printText(" heap=");
+        printUnsigned(usage.liveBytes);
+        printText(" peak=");
+        printUnsigned(usage.peakBytes);
+        printText(" stack=");
+        printUnsigned(usage.stackHighWater);
+        printLine();
+        endReport(policy);
+        return {};
+    }
+}
+#endif
+
 namespace Maybe {
     template<typename t453, typename t454>
     Prelude::maybe<t454> map(juniper::function<t454(t453)> f, Prelude::maybe<t453> maybeVal) {
@@ -2904,13 +5866,15 @@ namespace Time {
 }
 
 namespace Time {
-    int32_t now() {
-        return (([&]() -> int32_t {
+    // Milliseconds since boot. This wraps after about 49 days, so compare
+    // times by subtracting them, never by ordering them.
+    uint32_t now() {
+        return (([&]() -> uint32_t {
             auto guid113 = 0;
             if (!(true)) {
                 juniper::quit<Prelude::unit>();
             }
-            auto ret = guid113;
+            uint32_t ret = guid113;
             
             (([&]() -> Prelude::unit {
                 ret = millis();
@@ -2921,49 +5885,370 @@ namespace Time {
     }
 }
 
+namespace Time {
+    // Microseconds since boot, wrapping after about 71 minutes.
+    uint32_t nowMicros() {
+        return (([&]() -> uint32_t {
+            auto guid201 = 0;
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            uint32_t ret = guid201;
+            
+            (([&]() -> Prelude::unit {
+                ret = micros();
+                return {};
+            })());
+            return ret;
+        })());
+    }
+}
+
 namespace Time {
     juniper::shared_ptr<Time::timerState> state() {
         return (juniper::shared_ptr<Time::timerState>(new Time::timerState((([&]() -> Time::timerState{
             Time::timerState guid114;
-            guid114.lastPulse = 0;
+            guid114.deadline = 0;
+            guid114.armed = false;
             return guid114;
         })()))));
     }
 }
 
 namespace Time {
-    Prelude::sig<uint32_t> every(uint32_t interval, juniper::shared_ptr<Time::timerState> state) {
+    // Emits t once each time the clock reaches the next deadline, which is
+    // kept in state and moved on by exactly interval, so pulses do not drift
+    // however late each poll is. The first call only arms the timer one
+    // interval ahead. The deadline is compared as a signed difference, which
+    // stays correct across the clock wrapping as long as interval is below
+    // 2^31. If polling falls more than a whole interval behind, the missed
+    // pulses are dropped and the deadline restarts from t rather than
+    // bursting to catch up. A poll that is not yet due is one subtraction.
+    Prelude::sig<uint32_t> pulseAt(uint32_t t, uint32_t interval, juniper::shared_ptr<Time::timerState> state) {
         return (([&]() -> Prelude::sig<uint32_t> {
-            auto guid115 = now();
-            if (!(true)) {
-                juniper::quit<Prelude::unit>();
-            }
-            auto t = guid115;
-            
-            auto guid116 = ((interval == 0) ? 
-                t
-            :
-                ((t / interval) * interval));
+            auto guid202 = (*((state).get()));
             if (!(true)) {
                 juniper::quit<Prelude::unit>();
             }
-            auto lastWindow = guid116;
+            auto armed = (guid202).armed;
+            auto deadline = (guid202).deadline;
             
-            return ((((*((state).get()))).lastPulse >= lastWindow) ? 
+            return ((armed && ((int32_t) (t - deadline) < 0)) ? 
                 signal<uint32_t>(nothing<uint32_t>())
             :
                 (([&]() -> Prelude::sig<uint32_t> {
+                    auto guid203 = deadline + interval;
+                    if (!(true)) {
+                        juniper::quit<Prelude::unit>();
+                    }
+                    auto next = guid203;
+                    
                     (*((Time::timerState*) (state.get())) = (([&]() -> Time::timerState{
-                        Time::timerState guid117;
-                        guid117.lastPulse = t;
-                        return guid117;
+                        Time::timerState guid204;
+                        guid204.deadline = ((armed && ((int32_t) (t - next) < 0)) ? 
+                            next
+                        :
+                            (t + interval));
+                        guid204.armed = true;
+                        return guid204;
                     })()));
-                    return signal<uint32_t>(just<uint32_t>(t));
+                    return (armed ? 
+                        signal<uint32_t>(just<uint32_t>(t))
+                    :
+                        signal<uint32_t>(nothing<uint32_t>()));
                 })()));
         })());
     }
 }
 
+namespace Time {
+    // Pulses every interval milliseconds (see pulseAt).
+    Prelude::sig<uint32_t> every(uint32_t interval, juniper::shared_ptr<Time::timerState> state) {
+        return pulseAt(now(), interval, state);
+    }
+}
+
+namespace Time {
+    // Pulses every interval microseconds (see pulseAt). Intervals must stay
+    // below 2^31 us, about 35 minutes.
+    Prelude::sig<uint32_t> everyMicros(uint32_t interval, juniper::shared_ptr<Time::timerState> state) {
+        return pulseAt(nowMicros(), interval, state);
+    }
+}
+
+#ifdef JUNIPER_SAMPLE_TIMER
+#if !defined(__AVR__) && !defined(JUNIPER_HOST)
+#error "JUNIPER_SAMPLE_TIMER needs an AVR Timer1 or the host build"
+#endif
+// The sampling timer takes Timer1 for itself, which on an Uno is also the
+// Servo library's timer and the PWM timer of pins 9 and 10. Servo cannot be
+// used alongside it, and Io::anaWrite refuses pins 9 and 10 while it is in.
+#ifdef Servo_h
+#error "JUNIPER_SAMPLE_TIMER and the Servo library both need Timer1"
+#endif
+
+#ifndef JUNIPER_SAMPLE_EVENTS
+#define JUNIPER_SAMPLE_EVENTS 64
+#endif
+
+// Each timer period converts a frame of JUNIPER_SAMPLE_CHANNELS consecutive
+// analog pins, starting at the pin given to startSampling.
+#ifndef JUNIPER_SAMPLE_CHANNELS
+#define JUNIPER_SAMPLE_CHANNELS 1
+#endif
+
+namespace Time {
+    // Conversions made on the sampling timer's schedule, queued by the
+    // conversion interrupt and taken off by sampleIn. Frames go in whole,
+    // channel by channel, or not at all: those that arrive while the queue
+    // is full are counted in samplesMissed, so a consumer can tell a gap in
+    // the sequence from a quiet input, and channels never slip against
+    // each other.
+    juniper::ring_buffer<uint16_t, JUNIPER_SAMPLE_EVENTS> sampleQueue;
+    juniper::array<uint16_t, JUNIPER_SAMPLE_CHANNELS> sampleFrame;
+    uint8_t sampleChannel = 0;
+    uint16_t samplePin = 0;
+    uint16_t samplePrescaler = 1;
+    uint16_t sampleTop = 0;
+    volatile uint32_t samplesTaken = 0;
+    volatile uint32_t samplesMissed = 0;
+}
+
+#ifdef __AVR__
+namespace Time {
+    // ADMUX for channel of the frame, against AVcc.
+    uint8_t sampleMux(uint8_t channel) {
+        return _BV(REFS0) | ((((samplePin >= A0) ? (samplePin - A0) : samplePin) + channel) & 0x07);
+    }
+}
+#endif
+
+namespace Time {
+    // Takes the conversion of the frame's current channel. On AVR the timer
+    // only triggers the first; the rest are started here, back to back.
+    void sampleInterrupt(uint16_t value) {
+        sampleFrame[sampleChannel] = value;
+        if (++sampleChannel < JUNIPER_SAMPLE_CHANNELS) {
+#ifdef __AVR__
+            ADMUX = sampleMux(sampleChannel);
+            ADCSRA |= _BV(ADSC);
+#endif
+            return;
+        }
+        sampleChannel = 0;
+#if defined(__AVR__) && JUNIPER_SAMPLE_CHANNELS > 1
+        ADMUX = sampleMux(0);
+#endif
+        samplesTaken++;
+        if (sampleQueue.free() < (size_t) JUNIPER_SAMPLE_CHANNELS) {
+            samplesMissed++;
+            return;
+        }
+        for (int ch = 0; ch < JUNIPER_SAMPLE_CHANNELS; ch++) {
+            sampleQueue.push(sampleFrame[ch]);
+        }
+    }
+}
+
+#ifdef JUNIPER_HOST
+namespace Time {
+    void sampleTimerInterrupt() {
+        for (int ch = 0; ch < JUNIPER_SAMPLE_CHANNELS; ch++) {
+            sampleInterrupt((uint16_t) analogRead(samplePin + ch));
+        }
+    }
+}
+#endif
+
+namespace Time {
+    // Starts converting a frame from pin rateHz times a second, independent
+    // of how long each pass of the loop takes. Timer1 divides F_CPU by the smallest
+    // prescaler that fits its 16 bit compare register, so the achieved rate
+    // is F_CPU / prescaler / (top + 1), which sampleRate reports. On AVR
+    // compare match B auto-triggers the ADC, so conversions start on the
+    // timer edge; analogRead must not be used while sampling runs, and at
+    // the 125 kHz ADC clock rates above about 9.6 kHz / channels lose
+    // triggers. On the
+    // host build host::startTimer simulates Timer1 and analogRead supplies
+    // the conversions.
+    Prelude::unit startSampling(uint16_t pin, uint32_t rateHz) {
+        static const uint16_t prescalers[5] = { 1, 8, 64, 256, 1024 };
+        rateHz = (rateHz > 0) ? rateHz : 1;
+        uint8_t select = 0;
+        uint32_t ticks = (F_CPU + rateHz / 2) / rateHz;
+        while (ticks > 65536 && select < 4) {
+            select++;
+            ticks = (F_CPU / prescalers[select] + rateHz / 2) / rateHz;
+        }
+        ticks = (ticks > 65536) ? 65536 : ((ticks < 1) ? 1 : ticks);
+        samplePin = pin;
+        sampleChannel = 0;
+        samplePrescaler = prescalers[select];
+        sampleTop = (uint16_t) (ticks - 1);
+        juniper::atomic_write(samplesTaken, (uint32_t) 0);
+        juniper::atomic_write(samplesMissed, (uint32_t) 0);
+#if defined(__AVR__)
+        noInterrupts();
+        ADMUX = sampleMux(0);
+        ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+        ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+        TCCR1A = 0;
+        TCCR1B = 0;
+        TCNT1 = 0;
+        OCR1A = sampleTop;
+        OCR1B = sampleTop;
+        TIFR1 = _BV(OCF1B);
+        TCCR1B = _BV(WGM12) | (select + 1);
+        interrupts();
+#else
+        host::startTimer(F_CPU / samplePrescaler, ticks, sampleTimerInterrupt);
+#endif
+        return {};
+    }
+}
+
+#ifdef __AVR__
+ISR(ADC_vect) {
+    // Compare match B only triggers a conversion on the flag's rising edge,
+    // so clear it for the next one.
+    TIFR1 = _BV(OCF1B);
+    Time::sampleInterrupt(ADC);
+}
+#endif
+
+namespace Time {
+    // The rate the timer actually runs at, in Hz.
+    double sampleRate() {
+        return (double) F_CPU / (double) samplePrescaler / ((double) sampleTop + 1.0);
+    }
+}
+
+namespace Time {
+    // Frames converted since sampling started, read whole.
+    uint32_t samplesTakenCount() {
+        return juniper::atomic_read(samplesTaken);
+    }
+}
+
+namespace Time {
+    // Frames lost to a full queue since sampling started, read whole.
+    uint32_t samplesMissedCount() {
+        return juniper::atomic_read(samplesMissed);
+    }
+}
+
+namespace Time {
+    // The oldest queued sample, if any. One is taken per call, so a loop
+    // that wants every sample drains them with repeated calls, and a frame
+    // of several channels takes as many calls.
+    Prelude::sig<uint16_t> sampleIn() {
+#ifdef JUNIPER_HOST
+        host::serviceTimer();
+#endif
+        uint16_t value;
+        return (sampleQueue.pop(value) ? 
+            signal<uint16_t>(just<uint16_t>(value))
+        :
+            signal<uint16_t>(nothing<uint16_t>()));
+    }
+}
+
+namespace Time {
+    // The oldest c894 queued samples as one block, once that many are
+    // waiting, for the block combinators in Signal. A block is whole frames,
+    // interleaved channel by channel, and consecutive frames in it are
+    // exactly one timer period apart unless samplesMissed moved.
+    template<int c894>
+    Prelude::sig<Prelude::list<uint16_t, c894>> sampleBlockIn() {
+        static_assert(c894 >= 1 && c894 < JUNIPER_SAMPLE_EVENTS, "a sample block must fit in the sample queue");
+        static_assert(c894 % JUNIPER_SAMPLE_CHANNELS == 0, "a sample block must be whole frames");
+#ifdef JUNIPER_HOST
+        host::serviceTimer();
+#endif
+        if (sampleQueue.size() < (size_t) c894) {
+            return signal<Prelude::list<uint16_t, c894>>(nothing<Prelude::list<uint16_t, c894>>());
+        }
+        Prelude::list<uint16_t, c894> block;
+        for (int i = 0; i < c894; i++) {
+            sampleQueue.pop(((block).data)[i]);
+        }
+        (block).length = c894;
+        return signal<Prelude::list<uint16_t, c894>>(just<Prelude::list<uint16_t, c894>>(block));
+    }
+}
+#endif
+
+#ifdef JUNIPER_PROFILE_LOOP
+namespace Time {
+    // Time between successive profileLoop calls. Only the histogram, a pass
+    // count and two timestamps are kept, plus the first pass's timestamp for
+    // the overall pass rate, so this costs 52 bytes of RAM with the default
+    // bucket count.
+    JUNIPER_THREAD_LOCAL juniper::latency_histogram loopHistogram;
+    JUNIPER_THREAD_LOCAL uint32_t lastLoopMicros = 0;
+    JUNIPER_THREAD_LOCAL uint32_t firstLoopMicros = 0;
+    JUNIPER_THREAD_LOCAL uint32_t loopCount = 0;
+}
+
+namespace Time {
+    Prelude::unit printLoopProfile() {
+        Io::txPolicy policy = Io::beginReport();
+        Io::printText("loop us histogram");
+        Io::printLine();
+        for (uint8_t i = 0; i < JUNIPER_HISTOGRAM_BUCKETS; i++) {
+            if (loopHistogram.counts[i] != 0) {
+                Io::printUnsigned(juniper::latency_histogram::lowerBound(i));
+                Io::printText("-");
+                Io::printUnsigned(juniper::latency_histogram::upperBound(i));
+                Io::printText(": ");
+                Io::printUnsigned(loopHistogram.counts[i]);
+                Io::printLine();
+            }
+        }
+        Io::printText("p50=");
+        Io::printUnsigned(loopHistogram.percentile(50));
+        Io::printText(" p99=");
+        Io::printUnsigned(loopHistogram.percentile(99));
+        Io::printText(" max=");
+        Io::printUnsigned(loopHistogram.max);
+        Io::printText(" passes/s=");
+        Io::printFloat((lastLoopMicros != firstLoopMicros) ?
+            (float) ((double) (loopCount - 1) * 1000000.0 / (double) (lastLoopMicros - firstLoopMicros)) : 0.0f);
+        Io::printLine();
+        Io::endReport(policy);
+        return {};
+    }
+}
+
+namespace Time {
+    // Call once at the top of every pass of a main loop. Sending 'h' over
+    // Serial dumps the histogram. On the host build the run stops after
+    // SOUNDBAR_LOOPS passes and prints the percentiles for CI to compare.
+    Prelude::unit profileLoop() {
+        uint32_t t = micros();
+        if (loopCount != 0) {
+            loopHistogram.record(t - lastLoopMicros);
+        } else {
+            firstLoopMicros = t;
+        }
+        loopCount++;
+        if (Serial.available() > 0 && Serial.read() == 'h') {
+            printLoopProfile();
+            t = micros();
+        }
+        lastLoopMicros = t;
+#ifdef JUNIPER_HOST
+        if (host::loopLimit() != 0 && loopCount > host::loopLimit()) {
+            printLoopProfile();
+            Io::flushSerial();
+            exit(0);
+        }
+#endif
+        return {};
+    }
+}
+#endif
+
 namespace Math {
     double pi = 3.141593;
 }
@@ -3411,6 +6696,20 @@ namespace Math {
     }
 }
 
+namespace Math {
+    template<typename t830, int c830>
+    juniper::fixed<t830, c830> mapRange(juniper::fixed<t830, c830> x, juniper::fixed<t830, c830> a1, juniper::fixed<t830, c830> a2, juniper::fixed<t830, c830> b1, juniper::fixed<t830, c830> b2) {
+        return (b1 + (((x - a1) * (b2 - b1)) / (a2 - a1)));
+    }
+}
+
+namespace Math {
+    template<typename t831, int c831>
+    juniper::fixed<t831, c831> sqrt_(juniper::fixed<t831, c831> x) {
+        return juniper::sqrt(x);
+    }
+}
+
 namespace Math {
     template<typename t537>
     t537 clamp(t537 x, t537 min, t537 max) {
@@ -3437,6 +6736,150 @@ namespace Math {
     }
 }
 
+// Fixed point replacements for the libm wrappers above. Qm.n denotes a
+// signed or unsigned integer with n fractional bits. Angles are binary
+// angles, where the full uint16_t range covers one turn, so wrapping is
+// free. All tables live in flash and are linearly interpolated.
+
+namespace Math {
+    // sin(k * pi / 128) in Q15 for k in 0..64, one quarter wave.
+    const juniper::flash_array<int16_t, 65> sinTable JUNIPER_PROGMEM = { {
+        0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962,
+        8739, 9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151,
+        16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594, 23170,
+        23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510,
+        28898, 29268, 29621, 29956, 30273, 30571, 30852, 31113, 31356, 31580, 31785,
+        31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757, 32767
+    } };
+}
+
+namespace Math {
+    // log2(1 + k / 32) in Q16.16 for k in 0..32.
+    const juniper::flash_array<uint32_t, 33> log2Table JUNIPER_PROGMEM = { {
+        0, 2909, 5732, 8473, 11136, 13727, 16248, 18704, 21098, 23433, 25711,
+        27936, 30109, 32234, 34312, 36346, 38336, 40286, 42196, 44068, 45904, 47705,
+        49472, 51207, 52911, 54584, 56229, 57845, 59434, 60997, 62534, 64047, 65536
+    } };
+}
+
+namespace Math {
+    // 2^(k / 32) in Q16.16 for k in 0..32.
+    const juniper::flash_array<uint32_t, 33> exp2Table JUNIPER_PROGMEM = { {
+        65536, 66971, 68438, 69936, 71468, 73032, 74632, 76266, 77936, 79642, 81386,
+        83169, 84990, 86851, 88752, 90696, 92682, 94711, 96785, 98905, 101070, 103283,
+        105545, 107856, 110218, 112631, 115098, 117618, 120194, 122825, 125515, 128263, 131072
+    } };
+}
+
+namespace Math {
+    int16_t sinQ15(uint16_t angle) {
+        uint8_t quadrant = angle >> 14;
+        uint16_t offset = angle & 0x3FFF;
+        if (quadrant & 1) {
+            offset = 0x4000 - offset;
+        }
+        uint8_t index = offset >> 8;
+        uint8_t frac = offset & 0xFF;
+        int16_t a = sinTable[index];
+        int16_t ret = (index == 64) ?
+            a :
+            (int16_t) (a + (((int32_t) (sinTable[index + 1] - a) * frac) >> 8));
+        return (quadrant & 2) ? -ret : ret;
+    }
+}
+
+namespace Math {
+    int16_t cosQ15(uint16_t angle) {
+        return sinQ15(angle + 0x4000);
+    }
+}
+
+namespace Math {
+    // Converts Q16.16 radians to a binary angle: 65536 / (2 * pi) = 10430.38
+    uint16_t radToAngle(int32_t radians) {
+        return (uint16_t) (((int64_t) radians * 10430) >> 16);
+    }
+}
+
+namespace Math {
+    int32_t log2Q16(uint32_t x) {
+        if (x == 0) {
+            return (-2147483647L - 1);
+        }
+        int8_t msb = 31;
+        while (!(x & 0x80000000UL)) {
+            x <<= 1;
+            msb--;
+        }
+        uint8_t index = (x >> 26) & 0x1F;
+        uint16_t frac = (x >> 10) & 0xFFFF;
+        uint32_t a = log2Table[index];
+        uint32_t b = log2Table[index + 1];
+        return ((int32_t) (msb - 16) << 16) + (int32_t) (a + (((b - a) * frac) >> 16));
+    }
+}
+
+namespace Math {
+    // ln(2) in Q16.16 is 45426
+    int32_t logQ16(uint32_t x) {
+        int32_t l = log2Q16(x);
+        return (l == (-2147483647L - 1)) ? l : (int32_t) (((int64_t) l * 45426) >> 16);
+    }
+}
+
+namespace Math {
+    // log10(2) in Q16.16 is 19728
+    int32_t log10Q16(uint32_t x) {
+        int32_t l = log2Q16(x);
+        return (l == (-2147483647L - 1)) ? l : (int32_t) (((int64_t) l * 19728) >> 16);
+    }
+}
+
+namespace Math {
+    // Saturates to 0xFFFFFFFF when the result does not fit in Q16.16. The
+    // mantissa is below 2^17, so shifts of up to 15 still fit.
+    uint32_t exp2Q16(int32_t x) {
+        int16_t whole = (int16_t) (x >> 16);
+        uint16_t fracBits = (uint16_t) (x & 0xFFFF);
+        uint8_t index = fracBits >> 11;
+        uint16_t frac = (fracBits & 0x7FF) << 5;
+        uint32_t a = exp2Table[index];
+        uint32_t b = exp2Table[index + 1];
+        uint32_t mantissa = a + (((b - a) * frac) >> 16);
+        if (whole >= 16) {
+            return 0xFFFFFFFFUL;
+        } else if (whole >= 0) {
+            return mantissa << whole;
+        } else if (whole > -32) {
+            return mantissa >> -whole;
+        } else {
+            return 0;
+        }
+    }
+}
+
+namespace Math {
+    uint32_t powQ16(uint32_t x, int32_t y) {
+        if (x == 0) {
+            return 0;
+        }
+        int64_t e = ((int64_t) log2Q16(x) * y) >> 16;
+        if (e > 2147483647L) {
+            return 0xFFFFFFFFUL;
+        } else if (e < (-2147483647L - 1)) {
+            return 0;
+        }
+        return exp2Q16((int32_t) e);
+    }
+}
+
+namespace Math {
+    // Bitwise square root of x * 2^16, exact to the last bit.
+    uint32_t sqrtQ16(uint32_t x) {
+        return (uint32_t) juniper::isqrt<uint64_t>((uint64_t) x << 16);
+    }
+}
+
 namespace Button {
     juniper::shared_ptr<Button::buttonState> state() {
         return (juniper::shared_ptr<Button::buttonState>(new Button::buttonState((([&]() -> Button::buttonState{
@@ -3496,13 +6939,81 @@ namespace Button {
                             return actualState;
                         })())));
             })());
-         }), incoming);
+         }), incoming);
+    }
+}
+
+namespace Button {
+    Prelude::sig<Io::pinState> debounce(Prelude::sig<Io::pinState> incoming, juniper::shared_ptr<Button::buttonState> buttonState) {
+        return debounceDelay(incoming, 50, buttonState);
+    }
+}
+
+namespace Button {
+    template<typename t880>
+    juniper::shared_ptr<Button::bankState<t880>> bank() {
+        static_assert(juniper::numeric_traits<t880>::is_integer && !juniper::numeric_traits<t880>::is_signed, "a button bank is an unsigned integer bitset");
+        return (juniper::shared_ptr<Button::bankState<t880>>(new Button::bankState<t880>((([&]() -> Button::bankState<t880>{
+            Button::bankState<t880> guid198;
+            guid198.state = 0;
+            guid198.cnt0 = 0;
+            guid198.cnt1 = 0;
+            return guid198;
+        })()))));
+    }
+}
+
+namespace Button {
+    // Bit i is set when pins[i] reads high.
+    template<typename t881, int c880>
+    t881 readBank(Prelude::list<uint16_t, c880> pins) {
+        static_assert(c880 <= 8 * sizeof(t881), "readBank needs a bit of t881 for every pin");
+        return (([&]() -> t881 {
+            t881 bits = 0;
+            (([&]() -> Prelude::unit {
+                uint32_t guid199 = 0;
+                uint32_t guid200 = (pins).length;
+                for (uint32_t i = guid199; i < guid200; i++) {
+                    if (Io::pinStateToInt(Io::digRead(((pins).data)[i])) != 0) {
+                        bits |= (t881) ((t881) 1 << i);
+                    }
+                }
+                return {};
+            })());
+            return bits;
+        })());
     }
 }
 
 namespace Button {
-    Prelude::sig<Io::pinState> debounce(Prelude::sig<Io::pinState> incoming, juniper::shared_ptr<Button::buttonState> buttonState) {
-        return debounceDelay(incoming, 50, buttonState);
+    // Vertical counter debouncing of every bit of incoming at once. An input
+    // has to read differently from its debounced state on four consecutive
+    // ticks before the state follows it; any tick that agrees resets its
+    // counter. Each tick is a handful of bitwise operations whatever the
+    // number of inputs, and the timing comes from how often the caller ticks
+    // (e.g. every 5 ms from Time::every for a 20 ms debounce).
+    template<typename t882>
+    Prelude::sig<t882> debounceBank(Prelude::sig<t882> incoming, juniper::shared_ptr<Button::bankState<t882>> bankState) {
+        if (((incoming).signal).tag == 0) {
+            Button::bankState<t882> &b = *((Button::bankState<t882>*) (bankState.get()));
+            t882 delta = (t882) (((incoming).signal).just ^ (b).state);
+            (b).cnt1 = (t882) (((b).cnt1 ^ (b).cnt0) & delta);
+            (b).cnt0 = (t882) (~(b).cnt0 & delta);
+            (b).state = (t882) ((b).state ^ (delta & ~((b).cnt0 | (b).cnt1)));
+            ((incoming).signal).just = (b).state;
+        }
+        JUNIPER_STAGE_OUTCOME(((incoming).signal).tag == 0);
+        return incoming;
+    }
+}
+
+namespace Button {
+    template<typename t883>
+    Io::pinState bankPin(t883 bits, uint8_t i) {
+        return ((((bits >> i) & 1) != 0) ? 
+            Io::high()
+        :
+            Io::low());
     }
 }
 
@@ -3566,7 +7077,7 @@ namespace Vector {
                     uint32_t guid149 = 0;
                     uint32_t guid150 = (n - 1);
                     for (uint32_t i = guid149; i <= guid150; i++) {
-                        (((result).data)[i] = (((result).data)[i] + ((v2).data)[i]()));
+                        (((result).data)[i] = (((result).data)[i] + ((v2).data)[i]));
                     }
                     return {};
                 })());
@@ -3650,11 +7161,11 @@ namespace Vector {
 
 namespace Vector {
     template<typename t592, int c84>
-    t592 dot(Vector::vector<t592, c84> v1, Vector::vector<t592, c84> v2) {
-        return (([&]() -> t592 {
+    typename juniper::product_sum<t592>::result dot(Vector::vector<t592, c84> v1, Vector::vector<t592, c84> v2) {
+        return (([&]() -> typename juniper::product_sum<t592>::result {
             auto n = c84;
-            return (([&]() -> t592 {
-                auto guid158 = 0;
+            return (([&]() -> typename juniper::product_sum<t592>::result {
+                typename juniper::product_sum<t592>::acc guid158 = 0;
                 if (!(true)) {
                     juniper::quit<Prelude::unit>();
                 }
@@ -3665,13 +7176,13 @@ namespace Vector {
                     uint32_t guid160 = (n - 1);
                     for (uint32_t i = guid159; i <= guid160; i++) {
                         (([&]() -> Prelude::unit {
-                            (sum = (sum + (((v1).data)[i] * ((v2).data)[i])));
+                            (sum = (sum + juniper::product_sum<t592>::product(((v1).data)[i], ((v2).data)[i])));
                             return Prelude::unit();
                         })());
                     }
                     return {};
                 })());
-                return sum;
+                return juniper::product_sum<t592>::finish(sum);
             })());
         })());
     }
@@ -3679,11 +7190,11 @@ namespace Vector {
 
 namespace Vector {
     template<typename t598, int c87>
-    t598 magnitude2(Vector::vector<t598, c87> v) {
-        return (([&]() -> t598 {
+    typename juniper::product_sum<t598>::result magnitude2(Vector::vector<t598, c87> v) {
+        return (([&]() -> typename juniper::product_sum<t598>::result {
             auto n = c87;
-            return (([&]() -> t598 {
-                auto guid161 = 0;
+            return (([&]() -> typename juniper::product_sum<t598>::result {
+                typename juniper::product_sum<t598>::acc guid161 = 0;
                 if (!(true)) {
                     juniper::quit<Prelude::unit>();
                 }
@@ -3694,13 +7205,13 @@ namespace Vector {
                     uint32_t guid163 = (n - 1);
                     for (uint32_t i = guid162; i <= guid163; i++) {
                         (([&]() -> Prelude::unit {
-                            (sum = (sum + (((v).data)[i] * ((v).data)[i])));
+                            (sum = (sum + juniper::product_sum<t598>::product(((v).data)[i], ((v).data)[i])));
                             return Prelude::unit();
                         })());
                     }
                     return {};
                 })());
-                return sum;
+                return juniper::product_sum<t598>::finish(sum);
             })());
         })());
     }
@@ -3708,8 +7219,8 @@ namespace Vector {
 
 namespace Vector {
     template<typename t604, int c90>
-    double magnitude(Vector::vector<t604, c90> v) {
-        return (([&]() -> double {
+    typename juniper::real_type<t604>::type magnitude(Vector::vector<t604, c90> v) {
+        return (([&]() -> typename juniper::real_type<t604>::type {
             auto n = c90;
             return sqrt_(magnitude2<t604, c90>(v));
         })());
@@ -3790,7 +7301,7 @@ namespace Vector {
     double angle(Vector::vector<t626, c98> v1, Vector::vector<t626, c98> v2) {
         return (([&]() -> double {
             auto n = c98;
-            return acos_((dot<t626, c98>(v1, v2) / sqrt_((magnitude2<t626, c98>(v1) * magnitude2<t626, c98>(v2)))));
+            return acos_(clamp<double>(juniper::to_double(dot<t626, c98>(v1, v2) / (magnitude<t626, c98>(v1) * magnitude<t626, c98>(v2))), -1.0, 1.0));
         })());
     }
 }
@@ -3835,44 +7346,126 @@ namespace Vector {
 }
 
 namespace SoundBar {
-    int32_t microphonePin = 15;
+    constexpr int32_t microphonePin = 15;
+}
+
+namespace SoundBar {
+    const juniper::flash_array<uint8_t, 8> barPins JUNIPER_PROGMEM = { {9, 8, 7, 6, 5, 4, 3, 2} };
+}
+
+namespace SoundBar {
+    constexpr int32_t numBarPins = 8;
 }
 
 namespace SoundBar {
-    juniper::array<int32_t, 8> barPins = (juniper::array<int32_t, 8> { {9, 8, 7, 6, 5, 4, 3, 2} });
+    template<int c850>
+    constexpr SoundBar::instance<c850> makeInstance(uint16_t microphonePin, const uint8_t *barPins, SoundBar::barDriver driver) {
+        return SoundBar::instance<c850>{ microphonePin, barPins, driver, 0
+#ifdef SOUNDBAR_PULSE_DENSITY
+            , Io::dutyState{ 0, 0, 0, false, false, 0 }
+#endif
+#ifdef SOUNDBAR_FILTER
+            , juniper::array<Signal::biquadState, 2>{ { Signal::biquadState{ 0, 0, 0, 0 }, Signal::biquadState{ 0, 0, 0, 0 } } }
+#endif
+            };
+    }
 }
 
+#if SOUNDBAR_CHANNELS > 1
 namespace SoundBar {
-    int32_t numBarPins = 8;
+    constexpr int32_t numChannels = SOUNDBAR_CHANNELS;
 }
 
 namespace SoundBar {
-    juniper::shared_ptr<Prelude::list<uint16_t, 5>> state = (juniper::shared_ptr<Prelude::list<uint16_t, 5>>(new Prelude::list<uint16_t, 5>(List::replicate<uint16_t, 5>(0, 0))));
+    constexpr int32_t firstAnalogPin = A0;
 }
 
 namespace SoundBar {
-    Prelude::unit setup() {
+    constexpr int32_t channelBarPins = numBarPins / numChannels;
+    static_assert(channelBarPins >= 1, "every channel needs at least one bar pin");
+}
+
+namespace SoundBar {
+    // Channel i reads A0 + i and drives bar pins i * c861 onwards.
+    template<int c860, int c861, size_t ...Is>
+    constexpr juniper::array<SoundBar::instance<c861>, c860> makeChannels(juniper::index_sequence<Is...>) {
+        return juniper::array<SoundBar::instance<c861>, c860>{ { makeInstance<c861>(firstAnalogPin + Is, barPins.data + Is * c861, Io::digWrite)... } };
+    }
+}
+
+namespace SoundBar {
+    juniper::array<SoundBar::instance<channelBarPins>, numChannels> channels = makeChannels<numChannels, channelBarPins>(juniper::make_index_sequence<numChannels>::type());
+}
+#else
+namespace SoundBar {
+    SoundBar::instance<8> bar = makeInstance<8>(microphonePin, barPins.data, Io::digWrite);
+}
+#endif
+
+namespace SoundBar {
+    template<int c851>
+    Prelude::unit setupInstance(SoundBar::instance<c851> &self) {
         return (([&]() -> Prelude::unit {
-            Io::setPinMode(microphonePin, Io::input());
+            Io::setPinMode((self).microphonePin, Io::input());
+#if defined(SOUNDBAR_PULSE_DENSITY) && defined(JUNIPER_EDGE_INTERRUPTS)
+            Io::watchEdges((self).microphonePin);
+#endif
             return (([&]() -> Prelude::unit {
                 uint16_t guid173 = 0;
-                uint16_t guid174 = (numBarPins - 1);
+                uint16_t guid174 = (c851 - 1);
                 for (uint16_t i = guid173; i <= guid174; i++) {
-                    Io::setPinMode((barPins)[i], Io::output());
+                    Io::setPinMode(juniper::flash_read((self).barPins + i), Io::output());
+                }
+                return {};
+            })());
+        })());
+    }
+}
+
+namespace SoundBar {
+    Prelude::unit setup() {
+        return (([&]() -> Prelude::unit {
+#ifdef JUNIPER_TRACK_MEMORY
+            Io::paintStack();
+#endif
+#if defined(JUNIPER_CAPTURE)
+            Io::beginSerial(JUNIPER_CAPTURE_BAUD);
+#elif defined(JUNIPER_PROFILE_LOOP) || defined(JUNIPER_PROFILE_STAGES) || defined(JUNIPER_TRACK_MEMORY) || defined(JUNIPER_TELEMETRY)
+            Io::beginSerial(115200);
+#endif
+#if SOUNDBAR_CHANNELS > 1
+#ifdef JUNIPER_CAPTURE
+            Io::beginCapture();
+#endif
+            return (([&]() -> Prelude::unit {
+                int32_t guid187 = 0;
+                int32_t guid188 = (numChannels - 1);
+                for (int32_t ch = guid187; ch <= guid188; ch++) {
+                    setupInstance<channelBarPins>(channels[ch]);
                 }
+#ifdef SOUNDBAR_FILTER
+                Time::startSampling(firstAnalogPin, SOUNDBAR_FILTER_RATE);
+#endif
                 return {};
             })());
+#else
+#ifdef JUNIPER_CAPTURE
+            Io::beginCapture();
+#endif
+            return setupInstance<8>(bar);
+#endif
         })());
     }
 }
 
 namespace SoundBar {
-    Prelude::unit resetBar() {
+    template<int c852>
+    Prelude::unit resetBar(SoundBar::instance<c852> &self) {
         return (([&]() -> Prelude::unit {
             int32_t guid175 = 0;
-            int32_t guid176 = (numBarPins - 1);
+            int32_t guid176 = (c852 - 1);
             for (int32_t i = guid175; i <= guid176; i++) {
-                Io::digWrite((barPins)[i], Io::low());
+                (self).driver(juniper::flash_read((self).barPins + i), Io::low());
             }
             return {};
         })());
@@ -3880,24 +7473,394 @@ namespace SoundBar {
 }
 
 namespace SoundBar {
-    Prelude::unit drawBar(uint16_t level) {
+    template<int c853>
+    Prelude::unit drawBar(SoundBar::instance<c853> &self, uint16_t level) {
         return (([&]() -> Prelude::unit {
             (([&]() -> Prelude::unit {
                 int32_t guid177 = 0;
                 int32_t guid178 = level;
                 for (int32_t i = guid177; i <= guid178; i++) {
-                    Io::digWrite((barPins)[i], Io::high());
+                    (self).driver(juniper::flash_read((self).barPins + i), Io::high());
                 }
                 return {};
             })());
             return (([&]() -> Prelude::unit {
                 int32_t guid179 = (level + 1);
-                int32_t guid180 = (numBarPins - 1);
+                int32_t guid180 = (c853 - 1);
                 for (int32_t i = guid179; i <= guid180; i++) {
-                    Io::digWrite((barPins)[i], Io::low());
+                    (self).driver(juniper::flash_read((self).barPins + i), Io::low());
+                }
+                return {};
+            })());
+        })());
+    }
+}
+
+namespace SoundBar {
+    // One pass of the pipeline for one instance. The envelope is reached
+    // through a non-owning pointer made here, so instances can be copied and
+    // moved freely. Returns the smoothed level that was drawn.
+    template<int c854>
+    Prelude::sig<uint16_t> stepInstance(SoundBar::instance<c854> &self) {
+        return (([&]() -> Prelude::sig<uint16_t> {
+            resetBar<c854>(self);
+#ifdef SOUNDBAR_PULSE_DENSITY
+            juniper::shared_ptr<Io::dutyState> duty(&(self).duty, juniper::static_storage);
+#ifdef JUNIPER_EDGE_INTERRUPTS
+            auto guid197 = JUNIPER_STAGE("pulseDensity", Io::pulseDensityIn<c854 - 1>(SOUNDBAR_DUTY_WINDOW_US, duty));
+#else
+            auto guid181 = JUNIPER_STAGE("digIn", Io::digIn((self).microphonePin));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto micSig = guid181;
+            
+            auto guid197 = JUNIPER_STAGE("pulseDensity", Io::pulseDensity<c854 - 1>(micSig, SOUNDBAR_DUTY_WINDOW_US, duty));
+#endif
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto meanBarSig = guid197;
+            
+#else
+            juniper::shared_ptr<uint16_t> state(&(self).envelope, juniper::static_storage);
+            auto guid181 = JUNIPER_STAGE("digIn", Io::digIn((self).microphonePin));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto micSig = guid181;
+            
+            auto guid182 = JUNIPER_STAGE("level", Signal::map<Io::pinState, uint16_t>(juniper::function<uint16_t(Io::pinState)>([=](Io::pinState digVal) mutable -> uint16_t { 
+                return (([&]() -> uint16_t {
+                    auto guid183 = digVal;
+                    return ((((guid183).tag == 1) && true) ? 
+                        (([&]() -> uint16_t {
+                            return ((uint16_t) 7);
+                        })())
+                    :
+                        ((((guid183).tag == 0) && true) ? 
+                            (([&]() -> uint16_t {
+                                return ((uint16_t) 0);
+                            })())
+                        :
+                            juniper::quit<uint16_t>()));
+                })());
+             }), micSig));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto barSig = guid182;
+            
+            auto guid184 = JUNIPER_STAGE("envelope", Signal::envelope<SOUNDBAR_ATTACK, SOUNDBAR_RELEASE, 7>(barSig, state));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto meanBarSig = guid184;
+#endif
+
+            JUNIPER_STAGE("drawBar", Signal::sink<uint16_t>([&](uint16_t level) -> Prelude::unit { 
+                return drawBar<c854>(self, level);
+             }, meanBarSig));
+            return meanBarSig;
+        })());
+    }
+}
+
+#if SOUNDBAR_CHANNELS > 1
+namespace SoundBar {
+    // Distance of a 10 bit sample from mid-scale, scaled to 0 .. c862 - 1.
+    template<int c862>
+    uint16_t analogLevel(uint16_t sample) {
+        uint16_t deviation = (sample > 512) ? (sample - 512) : (512 - sample);
+        return (uint16_t) (((uint32_t) deviation * c862) / 513);
+    }
+}
+
+#ifdef SOUNDBAR_FILTER
+namespace SoundBar {
+    // Two cascaded sections: a DC blocker, then the voice band.
+    constexpr Signal::biquadCoeffs micFilter[2] = {
+        Signal::dcBlock(0.995),
+        Signal::bandPass(SOUNDBAR_FILTER_RATE, 950.0, 0.35)
+    };
+}
+
+namespace SoundBar {
+    // A 10 bit sample centered on mid-scale and scaled to +-4096, which
+    // keeps the filter's accumulators clear of overflow.
+    int16_t centerSample(uint16_t sample) {
+        return (int16_t) (((int16_t) sample - 512) * 8);
+    }
+}
+
+namespace SoundBar {
+    // Magnitude of a filtered sample scaled like analogLevel and clipped to
+    // 0 .. c906 - 1, since the band-pass can ring past full scale.
+    template<int c906>
+    uint16_t filteredLevel(int16_t sample) {
+        uint32_t magnitude = (sample < 0) ? (uint32_t) -(int32_t) sample : (uint32_t) sample;
+        uint32_t level = (magnitude * c906) / 4097;
+        return (uint16_t) ((level > c906 - 1) ? c906 - 1 : level);
+    }
+}
+
+namespace SoundBar {
+    // The filtered counterpart of stepAnalog, fed one channel's block of
+    // centered samples. The block is filtered, levelled and followed by the
+    // envelope sample by sample, but the bar is only drawn once, at the
+    // level the block ends on.
+    template<int c922>
+    Prelude::sig<uint16_t> stepFiltered(SoundBar::instance<c922> &self, Prelude::sig<Prelude::list<int16_t, SOUNDBAR_FILTER_BLOCK>> centeredSig) {
+        return (([&]() -> Prelude::sig<uint16_t> {
+            juniper::shared_ptr<juniper::array<Signal::biquadState, 2>> filterState(&(self).filter, juniper::static_storage);
+            juniper::shared_ptr<uint16_t> state(&(self).envelope, juniper::static_storage);
+            auto guid205 = JUNIPER_STAGE("biquad", Signal::biquadBlock<2, micFilter, SOUNDBAR_FILTER_BLOCK>(centeredSig, filterState));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto filteredSig = guid205;
+            
+            auto guid206 = JUNIPER_STAGE("level", Signal::mapBlock<int16_t, uint16_t, SOUNDBAR_FILTER_BLOCK>(filteredLevel<c922>, filteredSig));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto barSig = guid206;
+            
+            auto guid207 = JUNIPER_STAGE("envelope", Signal::foldPBlock<uint16_t, uint16_t, SOUNDBAR_FILTER_BLOCK>(Signal::envelopeFold<SOUNDBAR_ATTACK, SOUNDBAR_RELEASE, c922 - 1>, state, barSig));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto envelopeSig = guid207;
+            
+            auto meanBarSig = (((envelopeSig).signal).tag == 0) ? 
+                Prelude::signal<uint16_t>(Prelude::just<uint16_t>(Signal::envelopeLevel<c922 - 1>(((((envelopeSig).signal).just).data)[(((envelopeSig).signal).just).length - 1])))
+            :
+                Prelude::signal<uint16_t>(Prelude::nothing<uint16_t>());
+            JUNIPER_STAGE("drawBar", Signal::sink<uint16_t>([&](uint16_t level) -> Prelude::unit { 
+                resetBar<c922>(self);
+                return drawBar<c922>(self, level);
+             }, meanBarSig));
+            return meanBarSig;
+        })());
+    }
+}
+#endif
+
+namespace SoundBar {
+    // The analog counterpart of stepInstance, fed a sample that has already
+    // been read so that all channels can be converted back to back.
+    template<int c863>
+    Prelude::sig<uint16_t> stepAnalog(SoundBar::instance<c863> &self, uint16_t sample) {
+        return (([&]() -> Prelude::sig<uint16_t> {
+            resetBar<c863>(self);
+            juniper::shared_ptr<uint16_t> state(&(self).envelope, juniper::static_storage);
+            auto micSig = Prelude::signal<uint16_t>(Prelude::just<uint16_t>(sample));
+            
+            auto guid189 = JUNIPER_STAGE("level", Signal::map<uint16_t, uint16_t>(analogLevel<c863>, micSig));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto barSig = guid189;
+            
+            auto guid190 = JUNIPER_STAGE("envelope", Signal::envelope<SOUNDBAR_ATTACK, SOUNDBAR_RELEASE, c863 - 1>(barSig, state));
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto meanBarSig = guid190;
+            
+            JUNIPER_STAGE("drawBar", Signal::sink<uint16_t>([&](uint16_t level) -> Prelude::unit { 
+                return drawBar<c863>(self, level);
+             }, meanBarSig));
+            return meanBarSig;
+        })());
+    }
+}
+
+namespace SoundBar {
+    // All c864 channels are converted first, in channel order, so they are
+    // sampled as close together as the ADC allows; only then is each one
+    // smoothed and drawn. Returns the level drawn on every channel. With
+    // SOUNDBAR_FILTER the sampling timer converts them instead, and each
+    // pass takes a block of frames once one is waiting; a channel's level
+    // stays where its envelope is until then.
+    template<int c864, int c865>
+    Prelude::list<uint16_t, c864> stepChannels(juniper::array<SoundBar::instance<c865>, c864> &channels) {
+#ifdef SOUNDBAR_FILTER
+        return (([&]() -> Prelude::list<uint16_t, c864> {
+            auto guid208 = JUNIPER_STAGE("sampleBlock", Time::sampleBlockIn<c864 * SOUNDBAR_FILTER_BLOCK>());
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto framesSig = guid208;
+            
+            Prelude::list<uint16_t, c864> levels = List::replicate<uint16_t, c864>(c864, 0);
+            (([&]() -> Prelude::unit {
+                int32_t guid209 = 0;
+                int32_t guid210 = (c864 - 1);
+                for (int32_t ch = guid209; ch <= guid210; ch++) {
+                    Prelude::sig<Prelude::list<int16_t, SOUNDBAR_FILTER_BLOCK>> centeredSig;
+                    ((centeredSig).signal).tag = ((framesSig).signal).tag;
+                    if (((framesSig).signal).tag == 0) {
+                        for (int32_t i = 0; i < SOUNDBAR_FILTER_BLOCK; i++) {
+                            ((((centeredSig).signal).just).data)[i] = centerSample(((((framesSig).signal).just).data)[i * c864 + ch]);
+                        }
+                        (((centeredSig).signal).just).length = SOUNDBAR_FILTER_BLOCK;
+                    }
+                    auto meanBarSig = stepFiltered<c865>(channels[ch], centeredSig);
+                    ((levels).data)[ch] = (((meanBarSig).signal).tag == 0) ? ((meanBarSig).signal).just : Signal::envelopeLevel<c865 - 1>(channels[ch].envelope);
+                }
+                return {};
+            })());
+            return levels;
+        })());
+#else
+        return (([&]() -> Prelude::list<uint16_t, c864> {
+            juniper::array<uint16_t, c864> samples;
+            (([&]() -> Prelude::unit {
+                int32_t guid192 = 0;
+                int32_t guid193 = (c864 - 1);
+                for (int32_t ch = guid192; ch <= guid193; ch++) {
+                    samples[ch] = (uint16_t) JUNIPER_STAGE("anaIn", Io::anaRead(channels[ch].microphonePin));
+                }
+                return {};
+            })());
+            Prelude::list<uint16_t, c864> levels = List::replicate<uint16_t, c864>(c864, 0);
+            (([&]() -> Prelude::unit {
+                int32_t guid194 = 0;
+                int32_t guid195 = (c864 - 1);
+                for (int32_t ch = guid194; ch <= guid195; ch++) {
+                    auto meanBarSig = stepAnalog<c865>(channels[ch], samples[ch]);
+                    ((levels).data)[ch] = (((meanBarSig).signal).tag == 0) ? ((meanBarSig).signal).just : 0;
                 }
                 return {};
             })());
+            return levels;
+        })());
+#endif
+    }
+}
+#endif
+
+#ifdef JUNIPER_TELEMETRY
+namespace SoundBar {
+    // Only level changes are sent, which keeps the link well below its
+    // capacity while the bar is steady.
+    uint16_t lastSentLevel = 0xFFFF;
+}
+
+namespace SoundBar {
+    Prelude::unit sendLevel(uint16_t level) {
+        if (level != lastSentLevel && Io::telemetryLevels<1>(List::replicate<uint16_t, 1>(1, level))) {
+            lastSentLevel = level;
+        }
+        return {};
+    }
+}
+
+namespace SoundBar {
+    uint32_t telemetryPasses = 0;
+}
+
+namespace SoundBar {
+    // The pass count and both drop counts go out together every passes
+    // passes, so the host can tell a quiet bar from a saturated link.
+    Prelude::unit sendCountersEvery(uint32_t passes) {
+        if (++telemetryPasses % passes == 0) {
+            Io::telemetryCounter(juniper::telemetry::passes, telemetryPasses);
+            Io::telemetryCounter(juniper::telemetry::serialDrops, Io::serialDropped);
+            Io::telemetryCounter(juniper::telemetry::frameDrops, Io::telemetryDropped);
+        }
+        return {};
+    }
+}
+
+#if SOUNDBAR_CHANNELS > 1
+namespace SoundBar {
+    Prelude::list<uint16_t, numChannels> lastSentLevels = List::replicate<uint16_t, numChannels>(numChannels, 0xFFFF);
+}
+
+namespace SoundBar {
+    template<int c866>
+    Prelude::unit sendLevels(Prelude::list<uint16_t, c866> levels) {
+        if (levels != lastSentLevels && Io::telemetryLevels<c866>(levels)) {
+            lastSentLevels = levels;
+        }
+        return {};
+    }
+}
+#endif
+#endif
+
+#ifdef JUNIPER_TRACK_MEMORY
+namespace SoundBar {
+    uint16_t memoryCheckCountdown = 0;
+    bool memoryBudgetReported = false;
+}
+
+namespace SoundBar {
+    // Scanning the painted stack is not free, so the budget is only checked
+    // every 256 passes. The first violation is reported over Serial; the host
+    // build exits with a failure status so a CI run catches it.
+    Prelude::unit checkMemory() {
+        if (++memoryCheckCountdown < 256) {
+            return {};
+        }
+        memoryCheckCountdown = 0;
+        Io::memoryUsage usage = Io::memory();
+        if (!memoryBudgetReported && !Io::withinMemoryBudget(usage)) {
+            memoryBudgetReported = true;
+            Io::printText("memory budget exceeded: ");
+            Io::printMemory(usage);
+#ifdef JUNIPER_HOST
+            Io::flushSerial();
+            exit(1);
+#endif
+        }
+        return {};
+    }
+}
+#endif
+
+namespace SoundBar {
+    Prelude::unit loop() {
+        return (([&]() -> Prelude::unit {
+#ifdef JUNIPER_PROFILE_LOOP
+            Time::profileLoop();
+#endif
+#if SOUNDBAR_CHANNELS > 1
+            auto guid186 = stepChannels<numChannels, channelBarPins>(channels);
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto levels = guid186;
+            // Only sent on under JUNIPER_TELEMETRY.
+            (void) levels;
+#else
+            auto guid186 = stepInstance<8>(bar);
+            if (!(true)) {
+                juniper::quit<Prelude::unit>();
+            }
+            auto meanBarSig = guid186;
+            // Only sent on under JUNIPER_TELEMETRY.
+            (void) meanBarSig;
+#endif
+            
+#ifdef JUNIPER_PROFILE_STAGES
+            Signal::printStageProfileEvery(10000);
+#endif
+#ifdef JUNIPER_TRACK_MEMORY
+            checkMemory();
+#endif
+#ifdef JUNIPER_TELEMETRY
+#if SOUNDBAR_CHANNELS > 1
+            sendLevels<numChannels>(levels);
+#else
+            Signal::sink<uint16_t>(sendLevel, meanBarSig);
+#endif
+            sendCountersEvery(1024);
+#endif
+            Io::serviceSerial();
+            return {};
         })());
     }
 }
@@ -3908,49 +7871,7 @@ namespace SoundBar {
             setup();
             return (([&]() -> Prelude::unit {
                 while (true) {
-                    (([&]() -> Prelude::unit {
-                        resetBar();
-                        auto guid181 = Io::digIn(microphonePin);
-                        if (!(true)) {
-                            juniper::quit<Prelude::unit>();
-                        }
-                        auto micSig = guid181;
-                        
-                        auto guid182 = Signal::map<Io::pinState, uint16_t>(juniper::function<uint16_t(Io::pinState)>([=](Io::pinState digVal) mutable -> uint16_t { 
-                            return (([&]() -> uint16_t {
-                                auto guid183 = digVal;
-                                return ((((guid183).tag == 1) && true) ? 
-                                    (([&]() -> uint16_t {
-                                        return ((uint16_t) 7);
-                                    })())
-                                :
-                                    ((((guid183).tag == 0) && true) ? 
-                                        (([&]() -> uint16_t {
-                                            return ((uint16_t) 0);
-                                        })())
-                                    :
-                                        juniper::quit<uint16_t>()));
-                            })());
-                         }), micSig);
-                        if (!(true)) {
-                            juniper::quit<Prelude::unit>();
-                        }
-                        auto barSig = guid182;
-                        
-                        auto guid184 = Signal::record<uint16_t, 5>(barSig, state);
-                        if (!(true)) {
-                            juniper::quit<Prelude::unit>();
-                        }
-                        auto pastBarSig = guid184;
-                        
-                        auto guid185 = Signal::map<Prelude::list<uint16_t, 5>, uint16_t>(List::average<uint16_t, 5>, pastBarSig);
-                        if (!(true)) {
-                            juniper::quit<Prelude::unit>();
-                        }
-                        auto meanBarSig = guid185;
-                        
-                        return Signal::sink<uint16_t>(drawBar, meanBarSig);
-                    })());
+                    loop();
                 }
                 return {};
             })());
@@ -3958,8 +7879,32 @@ namespace SoundBar {
     }
 }
 
+#ifndef JUNIPER_HOST_TEST
 int main() {
     init();
+#ifdef JUNIPER_HOST
+    if (getenv("SOUNDBAR_THREADS") != NULL) {
+#if defined(JUNIPER_SAMPLE_TIMER)
+        // One timer and one sample queue cannot be shared between workers.
+        fprintf(stderr, "parallel replay: not with JUNIPER_SAMPLE_TIMER\n");
+        exit(1);
+#elif SOUNDBAR_CHANNELS > 1
+        typedef juniper::array<SoundBar::instance<SoundBar::channelBarPins>, SoundBar::numChannels> channelArray;
+        host::parallelReplay([]() {
+            return SoundBar::makeChannels<SoundBar::numChannels, SoundBar::channelBarPins>(juniper::make_index_sequence<SoundBar::numChannels>::type());
+        }, [](channelArray &channels) {
+            for (int32_t ch = 0; ch < SoundBar::numChannels; ch++) {
+                SoundBar::setupInstance<SoundBar::channelBarPins>(channels[ch]);
+            }
+        }, SoundBar::stepChannels<SoundBar::numChannels, SoundBar::channelBarPins>);
+#else
+        host::parallelReplay([]() {
+            return SoundBar::makeInstance<8>(SoundBar::microphonePin, SoundBar::barPins.data, Io::digWrite);
+        }, SoundBar::setupInstance<8>, SoundBar::stepInstance<8>);
+#endif
+    }
+#endif
     SoundBar::main();
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,225 @@
+// Native tests for the biquad stages in Signal and the filtered analog
+// channels they drive (SOUNDBAR_FILTER), plus a benchmark of the cost per
+// sample per section of biquad and biquadBlock.
+// Run with: pio test -e native -f test_biquad
+#define JUNIPER_HOST_TEST
+#define JUNIPER_SAMPLE_TIMER
+#define SOUNDBAR_CHANNELS 2
+#define SOUNDBAR_FILTER
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <math.h>
+#include <stdio.h>
+
+typedef Prelude::list<int16_t, 64> block64;
+
+constexpr Signal::biquadCoeffs oneSection[1] = {
+    Signal::dcBlock(0.995)
+};
+
+constexpr Signal::biquadCoeffs fourSections[4] = {
+    Signal::dcBlock(0.995),
+    Signal::highPass(8000.0, 40.0, 0.7071),
+    Signal::bandPass(8000.0, 950.0, 0.35),
+    Signal::bandPass(8000.0, 950.0, 0.35)
+};
+
+static const double pi = 3.14159265358979;
+
+// Filter state is kept in locals behind non-owning pointers, the way the
+// sketch keeps its own.
+template<size_t n>
+static juniper::shared_ptr<juniper::array<Signal::biquadState, n>> local(juniper::array<Signal::biquadState, n> &state) {
+    state.fill(Signal::biquadState{ 0, 0, 0, 0 });
+    return juniper::shared_ptr<juniper::array<Signal::biquadState, n>>(&state, juniper::static_storage);
+}
+
+// A centered sample of a tone at hz, amplitude of full scale, and offset.
+static int16_t tone(uint32_t i, double hz, double amplitude, double offset) {
+    return (int16_t) lround(4096.0 * (offset + amplitude * sin(2.0 * pi * hz * i / SOUNDBAR_FILTER_RATE)));
+}
+
+// Largest magnitude of the filtered tone once the first second has settled.
+static int16_t settledPeak(double hz, double offset) {
+    juniper::array<Signal::biquadState, 2> history;
+    juniper::shared_ptr<juniper::array<Signal::biquadState, 2>> state = local(history);
+    int16_t peak = 0;
+    for (uint32_t i = 0; i < 2 * SOUNDBAR_FILTER_RATE; i++) {
+        Prelude::sig<int16_t> y = Signal::biquad<2, SoundBar::micFilter>(Prelude::signal<int16_t>(Prelude::just<int16_t>(tone(i, hz, 0.5, offset))), state);
+        int16_t magnitude = (int16_t) abs(y.signal.just);
+        peak = (i >= SOUNDBAR_FILTER_RATE && magnitude > peak) ? magnitude : peak;
+    }
+    return peak;
+}
+
+// Queues a frame the way the conversion interrupt does.
+static void convertFrame(uint16_t first, uint16_t second) {
+    Time::sampleInterrupt(first);
+    Time::sampleInterrupt(second);
+}
+
+static uint16_t toneSample(uint32_t i, double hz) {
+    return (uint16_t) (512 + tone(i, hz, 0.9, 0.0) / 8);
+}
+
+void setUp(void) {
+    host::useFakeClock(1000);
+    uint16_t value;
+    while (Time::sampleQueue.pop(value)) {
+    }
+}
+
+void tearDown(void) {}
+
+void test_block_matches_one_sample_at_a_time(void) {
+    juniper::array<Signal::biquadState, 2> valueHistory;
+    juniper::array<Signal::biquadState, 2> blockHistory;
+    juniper::shared_ptr<juniper::array<Signal::biquadState, 2>> valueState = local(valueHistory);
+    juniper::shared_ptr<juniper::array<Signal::biquadState, 2>> blockState = local(blockHistory);
+    for (uint32_t round = 0; round < 8; round++) {
+        Prelude::sig<block64> s;
+        s.signal.tag = 0;
+        s.signal.just.length = 64;
+        for (uint32_t j = 0; j < 64; j++) {
+            s.signal.just.data[j] = tone(round * 64 + j, 700.0, 0.4, 0.3);
+        }
+        Prelude::sig<block64> filtered = Signal::biquadBlock<2, SoundBar::micFilter, 64>(s, blockState);
+        TEST_ASSERT_EQUAL(0, filtered.signal.tag);
+        for (uint32_t j = 0; j < 64; j++) {
+            Prelude::sig<int16_t> one = Signal::biquad<2, SoundBar::micFilter>(Prelude::signal<int16_t>(Prelude::just<int16_t>(s.signal.just.data[j])), valueState);
+            TEST_ASSERT_EQUAL_INT16(one.signal.just, filtered.signal.just.data[j]);
+        }
+    }
+    TEST_ASSERT_TRUE(valueHistory == blockHistory);
+}
+
+void test_empty_block_is_not_emitted(void) {
+    juniper::array<Signal::biquadState, 2> history;
+    juniper::shared_ptr<juniper::array<Signal::biquadState, 2>> state = local(history);
+    Prelude::sig<block64> s;
+    s.signal.tag = 0;
+    s.signal.just.length = 0;
+    TEST_ASSERT_EQUAL(1, (Signal::biquadBlock<2, SoundBar::micFilter, 64>(s, state).signal.tag));
+}
+
+void test_band_keeps_voice_and_drops_bias_and_rumble(void) {
+    int16_t voice = settledPeak(950.0, 0.0);
+    TEST_ASSERT_TRUE(voice > 1800);
+    // Mains rumble is down by more than 20 dB.
+    TEST_ASSERT_TRUE(settledPeak(30.0, 0.0) < voice / 10);
+    // DC on its own settles to nothing.
+    TEST_ASSERT_TRUE(settledPeak(0.0, 0.4) < 8);
+}
+
+void test_frames_keep_their_channels_together(void) {
+    Time::startSampling(SoundBar::firstAnalogPin, SOUNDBAR_FILTER_RATE);
+    host::pinState().analog[SoundBar::firstAnalogPin] = 100;
+    host::pinState().analog[SoundBar::firstAnalogPin + 1] = 900;
+    host::advanceMicros(3 * 1000000 / SOUNDBAR_FILTER_RATE + 1);
+    Prelude::sig<Prelude::list<uint16_t, 6>> frames = Time::sampleBlockIn<6>();
+    TEST_ASSERT_EQUAL(0, frames.signal.tag);
+    for (int i = 0; i < 6; i += 2) {
+        TEST_ASSERT_EQUAL_UINT16(100, frames.signal.just.data[i]);
+        TEST_ASSERT_EQUAL_UINT16(900, frames.signal.just.data[i + 1]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, Time::samplesTakenCount());
+}
+
+void test_a_full_queue_drops_whole_frames(void) {
+    Time::startSampling(SoundBar::firstAnalogPin, SOUNDBAR_FILTER_RATE);
+    for (int i = 0; i < 40; i++) {
+        convertFrame(1, 2);
+    }
+    // The queue keeps one slot open, so an odd slot is left over too.
+    TEST_ASSERT_EQUAL_UINT32(40, Time::samplesTakenCount());
+    TEST_ASSERT_EQUAL_UINT32(40 - (JUNIPER_SAMPLE_EVENTS - 1) / 2, Time::samplesMissedCount());
+    TEST_ASSERT_EQUAL((JUNIPER_SAMPLE_EVENTS - 1) / 2 * 2, Time::sampleQueue.size());
+    uint16_t value = 0;
+    for (int i = 0; Time::sampleQueue.pop(value); i++) {
+        TEST_ASSERT_EQUAL_UINT16((i % 2) ? 2 : 1, value);
+    }
+}
+
+void test_bars_follow_a_tone_but_not_a_bias(void) {
+    SoundBar::setup();
+    Prelude::list<uint16_t, 2> levels;
+    uint32_t blocks = 0;
+    for (uint32_t i = 0; i < SOUNDBAR_FILTER_RATE / 2; i++) {
+        convertFrame(900, toneSample(i, 950.0));
+        levels = SoundBar::stepChannels<SoundBar::numChannels, SoundBar::channelBarPins>(SoundBar::channels);
+        blocks += (Time::sampleQueue.size() == 0) ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL_UINT32(SOUNDBAR_FILTER_RATE / 2 / SOUNDBAR_FILTER_BLOCK, blocks);
+    TEST_ASSERT_EQUAL_UINT16(0, levels.data[0]);
+    TEST_ASSERT_TRUE(levels.data[1] >= SoundBar::channelBarPins / 2);
+    // Until the next block, both hold where their envelopes are.
+    Prelude::list<uint16_t, 2> held = SoundBar::stepChannels<SoundBar::numChannels, SoundBar::channelBarPins>(SoundBar::channels);
+    TEST_ASSERT_TRUE(held == levels);
+}
+
+static const uint32_t benchSamples = 1 << 18;
+
+template<int n, const Signal::biquadCoeffs *coeffs>
+static double perValueCycles() {
+    juniper::array<Signal::biquadState, n> history;
+    juniper::shared_ptr<juniper::array<Signal::biquadState, n>> state = local(history);
+    volatile int16_t sink = 0;
+    uint64_t start = host::cycles();
+    for (uint32_t i = 0; i < benchSamples; i++) {
+        sink = Signal::biquad<n, coeffs>(Prelude::signal<int16_t>(Prelude::just<int16_t>((int16_t) ((i * 40503UL) >> 20))), state).signal.just;
+    }
+    uint64_t stop = host::cycles();
+    (void) sink;
+    return (double) (stop - start) / benchSamples / n;
+}
+
+template<int n, const Signal::biquadCoeffs *coeffs>
+static double perBlockCycles() {
+    juniper::array<Signal::biquadState, n> history;
+    juniper::shared_ptr<juniper::array<Signal::biquadState, n>> state = local(history);
+    volatile int16_t sink = 0;
+    Prelude::sig<block64> s;
+    s.signal.tag = 0;
+    uint64_t start = host::cycles();
+    for (uint32_t i = 0; i < benchSamples; i += 64) {
+        for (uint32_t j = 0; j < 64; j++) {
+            s.signal.just.data[j] = (int16_t) (((i + j) * 40503UL) >> 20);
+        }
+        s.signal.just.length = 64;
+        sink = Signal::biquadBlock<n, coeffs, 64>(s, state).signal.just.data[63];
+    }
+    uint64_t stop = host::cycles();
+    (void) sink;
+    return (double) (stop - start) / benchSamples / n;
+}
+
+// The best of three runs, since one can land on a busy moment of the host.
+static double bestOf3(double (*run)()) {
+    double best = run();
+    for (int i = 0; i < 2; i++) {
+        double next = run();
+        best = (next < best) ? next : best;
+    }
+    return best;
+}
+
+void test_cycles_per_sample_per_section(void) {
+    char line[160];
+    snprintf(line, sizeof(line), "host::cycles/sample/section: biquad 1 %.1f, 2 %.1f, 4 %.1f; biquadBlock<64> 1 %.1f, 2 %.1f, 4 %.1f",
+        bestOf3(perValueCycles<1, oneSection>), bestOf3(perValueCycles<2, SoundBar::micFilter>), bestOf3(perValueCycles<4, fourSections>),
+        bestOf3(perBlockCycles<1, oneSection>), bestOf3(perBlockCycles<2, SoundBar::micFilter>), bestOf3(perBlockCycles<4, fourSections>));
+    TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_block_matches_one_sample_at_a_time);
+    RUN_TEST(test_empty_block_is_not_emitted);
+    RUN_TEST(test_band_keeps_voice_and_drops_bias_and_rumble);
+    RUN_TEST(test_frames_keep_their_channels_together);
+    RUN_TEST(test_a_full_queue_drops_whole_frames);
+    RUN_TEST(test_bars_follow_a_tone_but_not_a_bias);
+    RUN_TEST(test_cycles_per_sample_per_section);
+    return UNITY_END();
+}
@@ -0,0 +1,162 @@
+// Native tests for the block combinators in Signal, and a benchmark of the
+// per-sample cost of a map, foldP and sink chain at block sizes 1, 16 and
+// 64 against the same chain one value at a time and a hand-written loop.
+// Run with: pio test -e native -f test_block
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <chrono>
+#include <stdio.h>
+
+typedef Prelude::list<uint16_t, 8> block8;
+
+static Prelude::sig<block8> blockOf(uint32_t length, uint16_t first) {
+    block8 block;
+    for (uint32_t i = 0; i < 8; i++) {
+        block.data[i] = (uint16_t) (first + i);
+    }
+    block.length = length;
+    return Prelude::signal<block8>(Prelude::just<block8>(block));
+}
+
+static uint16_t halve(uint16_t x) {
+    return x / 2;
+}
+
+static uint16_t accumulate(uint16_t x, uint16_t total) {
+    return total + x;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_empty_blocks_are_never_emitted(void) {
+    uint16_t total = 3;
+    juniper::shared_ptr<uint16_t> state(&total, juniper::static_storage);
+    TEST_ASSERT_EQUAL(1, (Signal::mapBlock<uint16_t, uint16_t, 8>(halve, blockOf(0, 1)).signal.tag));
+    TEST_ASSERT_EQUAL(1, (Signal::foldPBlock<uint16_t, uint16_t, 8>(accumulate, state, blockOf(0, 1)).signal.tag));
+    TEST_ASSERT_EQUAL_UINT16(3, total);
+    TEST_ASSERT_EQUAL(1, (Signal::filterBlock<uint16_t, 8>([](uint16_t) { return true; }, blockOf(4, 1)).signal.tag));
+    TEST_ASSERT_EQUAL(1, (Signal::mapBlock<uint16_t, uint16_t, 8>(halve, Prelude::signal<block8>(Prelude::nothing<block8>())).signal.tag));
+}
+
+void test_map_and_filter_keep_order(void) {
+    Prelude::sig<block8> mapped = Signal::mapBlock<uint16_t, uint16_t, 8>(halve, blockOf(5, 10));
+    TEST_ASSERT_EQUAL(0, mapped.signal.tag);
+    TEST_ASSERT_EQUAL_UINT32(5, mapped.signal.just.length);
+    TEST_ASSERT_EQUAL_UINT16(5, mapped.signal.just.data[0]);
+    TEST_ASSERT_EQUAL_UINT16(7, mapped.signal.just.data[4]);
+
+    Prelude::sig<block8> odd = Signal::filterBlock<uint16_t, 8>([](uint16_t x) { return x % 2 == 0; }, blockOf(6, 10));
+    TEST_ASSERT_EQUAL(0, odd.signal.tag);
+    TEST_ASSERT_EQUAL_UINT32(3, odd.signal.just.length);
+    TEST_ASSERT_EQUAL_UINT16(11, odd.signal.just.data[0]);
+    TEST_ASSERT_EQUAL_UINT16(13, odd.signal.just.data[1]);
+    TEST_ASSERT_EQUAL_UINT16(15, odd.signal.just.data[2]);
+}
+
+void test_fold_matches_fold_one_at_a_time(void) {
+    uint16_t blockTotal = 0;
+    uint16_t valueTotal = 0;
+    juniper::shared_ptr<uint16_t> blockState(&blockTotal, juniper::static_storage);
+    juniper::shared_ptr<uint16_t> valueState(&valueTotal, juniper::static_storage);
+    Prelude::sig<block8> folded = Signal::foldPBlock<uint16_t, uint16_t, 8>(accumulate, blockState, blockOf(6, 1));
+    TEST_ASSERT_EQUAL(0, folded.signal.tag);
+    for (uint32_t i = 0; i < 6; i++) {
+        Prelude::sig<uint16_t> one = Signal::foldP<uint16_t, uint16_t>(juniper::function<uint16_t(uint16_t, uint16_t)>(accumulate),
+            valueState, Prelude::signal<uint16_t>(Prelude::just<uint16_t>((uint16_t) (1 + i))));
+        TEST_ASSERT_EQUAL_UINT16(one.signal.just, folded.signal.just.data[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT16(valueTotal, blockTotal);
+}
+
+void test_sink_sees_live_samples_in_order(void) {
+    uint16_t seen[8] = { 0 };
+    int count = 0;
+    Signal::sinkBlock<uint16_t, 8>([&](uint16_t x) { seen[count++] = x; }, blockOf(3, 20));
+    TEST_ASSERT_EQUAL(3, count);
+    TEST_ASSERT_EQUAL_UINT16(20, seen[0]);
+    TEST_ASSERT_EQUAL_UINT16(22, seen[2]);
+}
+
+static const uint32_t benchSamples = 1 << 20;
+
+static uint16_t input(uint32_t i) {
+    return (uint16_t) ((i * 40503UL) >> 6);
+}
+
+static double perValueNs() {
+    uint16_t total = 0;
+    juniper::shared_ptr<uint16_t> state(&total, juniper::static_storage);
+    juniper::function<uint16_t(uint16_t)> f(halve);
+    juniper::function<uint16_t(uint16_t, uint16_t)> g(accumulate);
+    volatile uint16_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < benchSamples; i++) {
+        Prelude::sig<uint16_t> s = Prelude::signal<uint16_t>(Prelude::just<uint16_t>(input(i)));
+        Signal::sink<uint16_t>([&](uint16_t x) -> Prelude::unit { sink = x; return {}; },
+            Signal::foldP<uint16_t, uint16_t>(g, state, Signal::map<uint16_t, uint16_t>(f, s)));
+    }
+    auto stop = std::chrono::steady_clock::now();
+    (void) sink;
+    return std::chrono::duration<double, std::nano>(stop - start).count() / benchSamples;
+}
+
+template<int n>
+static double perBlockNs() {
+    uint16_t total = 0;
+    juniper::shared_ptr<uint16_t> state(&total, juniper::static_storage);
+    volatile uint16_t sink = 0;
+    Prelude::sig<Prelude::list<uint16_t, n>> s;
+    s.signal.tag = 0;
+    s.signal.just.length = n;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < benchSamples; i += n) {
+        for (int j = 0; j < n; j++) {
+            s.signal.just.data[j] = input(i + j);
+        }
+        Signal::sinkBlock<uint16_t, n>([&](uint16_t x) { sink = x; },
+            Signal::foldPBlock<uint16_t, uint16_t, n>(accumulate, state, Signal::mapBlock<uint16_t, uint16_t, n>(halve, s)));
+    }
+    auto stop = std::chrono::steady_clock::now();
+    (void) sink;
+    return std::chrono::duration<double, std::nano>(stop - start).count() / benchSamples;
+}
+
+static double handWrittenNs() {
+    uint16_t total = 0;
+    volatile uint16_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < benchSamples; i++) {
+        total = accumulate(halve(input(i)), total);
+        sink = total;
+    }
+    auto stop = std::chrono::steady_clock::now();
+    (void) sink;
+    return std::chrono::duration<double, std::nano>(stop - start).count() / benchSamples;
+}
+
+void test_per_sample_cost_by_block_size(void) {
+    double value = perValueNs();
+    double block1 = perBlockNs<1>();
+    double block16 = perBlockNs<16>();
+    double block64 = perBlockNs<64>();
+    double hand = handWrittenNs();
+    char line[160];
+    snprintf(line, sizeof(line), "ns/sample: per value %.2f, block 1 %.2f, block 16 %.2f, block 64 %.2f, hand-written %.2f",
+        value, block1, block16, block64, hand);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(block64 < value);
+    TEST_ASSERT_TRUE(block64 < block1);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_blocks_are_never_emitted);
+    RUN_TEST(test_map_and_filter_keep_order);
+    RUN_TEST(test_fold_matches_fold_one_at_a_time);
+    RUN_TEST(test_sink_sees_live_samples_in_order);
+    RUN_TEST(test_per_sample_cost_by_block_size);
+    return UNITY_END();
+}
@@ -0,0 +1,159 @@
+// Native tests for the debouncers in Button: the per-button debounceDelay
+// and the vertical counter debounceBank, plus a benchmark of one bank
+// against a debounceDelay per button.
+// Run with: pio test -e native -f test_button
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+static Prelude::sig<uint8_t> raw8(uint8_t bits) {
+    return Prelude::signal<uint8_t>(Prelude::just<uint8_t>(bits));
+}
+
+// State is kept in locals behind non-owning pointers, the way the sketch
+// keeps its own.
+template<typename T>
+static juniper::shared_ptr<T> local(T &state) {
+    return juniper::shared_ptr<T>(&state, juniper::static_storage);
+}
+
+static Button::buttonState released() {
+    Button::buttonState button;
+    button.actualState = Io::low();
+    button.lastState = Io::low();
+    button.lastDebounceTime = 0;
+    return button;
+}
+
+static uint8_t tick(juniper::shared_ptr<Button::bankState<uint8_t>> bank, uint8_t bits) {
+    return Button::debounceBank<uint8_t>(raw8(bits), bank).signal.just;
+}
+
+void setUp(void) {
+    host::pins fresh = {};
+    host::pinState() = fresh;
+    host::useFakeClock(1000000);
+}
+
+void tearDown(void) {}
+
+void test_read_bank_sets_a_bit_per_high_pin(void) {
+    Prelude::list<uint16_t, 3> pins = { { { 4, 5, 6 } }, 3 };
+    host::pinState().digital[4] = HIGH;
+    host::pinState().digital[6] = HIGH;
+    TEST_ASSERT_EQUAL_HEX8(0x05, (Button::readBank<uint8_t, 3>(pins)));
+    host::pinState().digital[4] = LOW;
+    host::pinState().digital[5] = HIGH;
+    TEST_ASSERT_EQUAL_HEX8(0x06, (Button::readBank<uint8_t, 3>(pins)));
+}
+
+void test_bank_follows_after_four_ticks(void) {
+    Button::bankState<uint8_t> bits = { 0, 0, 0 };
+    juniper::shared_ptr<Button::bankState<uint8_t>> bank = local(bits);
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x01));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x01));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x01));
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x01));
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x01));
+    // And back again, on the same count.
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x00));
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x00));
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x00));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x00));
+}
+
+void test_bounce_restarts_the_count(void) {
+    Button::bankState<uint8_t> bits = { 0, 0, 0 };
+    juniper::shared_ptr<Button::bankState<uint8_t>> bank = local(bits);
+    tick(bank, 0x80);
+    tick(bank, 0x80);
+    tick(bank, 0x80);
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x00));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x80));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x80));
+    TEST_ASSERT_EQUAL_HEX8(0x00, tick(bank, 0x80));
+    TEST_ASSERT_EQUAL_HEX8(0x80, tick(bank, 0x80));
+}
+
+void test_bits_debounce_independently(void) {
+    Button::bankState<uint8_t> bits = { 0, 0, 0 };
+    juniper::shared_ptr<Button::bankState<uint8_t>> bank = local(bits);
+    // Bit 0 is held from the start; bit 1 is pressed two ticks later.
+    tick(bank, 0x01);
+    tick(bank, 0x01);
+    tick(bank, 0x03);
+    TEST_ASSERT_EQUAL_HEX8(0x01, tick(bank, 0x03));
+    tick(bank, 0x03);
+    TEST_ASSERT_EQUAL_HEX8(0x03, tick(bank, 0x03));
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(Button::bankPin<uint8_t>(0x03, 1)));
+    TEST_ASSERT_EQUAL(0, Io::pinStateToInt(Button::bankPin<uint8_t>(0x03, 2)));
+}
+
+void test_delay_debounce_waits_out_the_delay(void) {
+    Button::buttonState button = released();
+    juniper::shared_ptr<Button::buttonState> state = local(button);
+    Prelude::sig<Io::pinState> high = Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(Io::high()));
+    Prelude::sig<Io::pinState> low = Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(Io::low()));
+    TEST_ASSERT_EQUAL(0, Io::pinStateToInt(Button::debounceDelay(high, 50, state).signal.just));
+    host::advanceMicros(30000);
+    TEST_ASSERT_EQUAL(0, Io::pinStateToInt(Button::debounceDelay(high, 50, state).signal.just));
+    host::advanceMicros(30000);
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(Button::debounceDelay(high, 50, state).signal.just));
+    // A short glitch does not get through.
+    Button::debounceDelay(low, 50, state);
+    host::advanceMicros(10000);
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(Button::debounceDelay(high, 50, state).signal.just));
+    host::advanceMicros(60000);
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(Button::debounceDelay(high, 50, state).signal.just));
+}
+
+void test_bank_against_delay_benchmark(void) {
+    const int buttons = 32;
+    const uint32_t ticks = 20000;
+    std::vector<Button::buttonState> buttonStates(buttons, released());
+    std::vector<juniper::shared_ptr<Button::buttonState>> states;
+    for (int b = 0; b < buttons; b++) {
+        states.push_back(local(buttonStates[b]));
+    }
+    Button::bankState<uint32_t> bits = { 0, 0, 0 };
+    juniper::shared_ptr<Button::bankState<uint32_t>> bank = local(bits);
+    volatile uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < ticks; t++) {
+        for (int b = 0; b < buttons; b++) {
+            Io::pinState level = (((t >> 4) + b) & 1) ? Io::high() : Io::low();
+            sink += Io::pinStateToInt(Button::debounceDelay(Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(level)), 50, states[b]).signal.just);
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < ticks; t++) {
+        uint32_t raw = ((t >> 4) & 1) ? 0xAAAAAAAAUL : 0x55555555UL;
+        sink += Button::debounceBank<uint32_t>(Prelude::signal<uint32_t>(Prelude::just<uint32_t>(raw)), bank).signal.just;
+    }
+    auto stop = std::chrono::steady_clock::now();
+    (void) sink;
+
+    double delayNs = std::chrono::duration<double, std::nano>(middle - start).count() / ticks;
+    double bankNs = std::chrono::duration<double, std::nano>(stop - middle).count() / ticks;
+    char line[160];
+    snprintf(line, sizeof(line), "32 x debounceDelay %.0f ns/tick, %u bytes of state; debounceBank<uint32_t> %.0f ns/tick, %u bytes of state",
+        delayNs, (unsigned) (buttons * sizeof(Button::buttonState)), bankNs, (unsigned) sizeof(Button::bankState<uint32_t>));
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(bankNs < delayNs);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_bank_sets_a_bit_per_high_pin);
+    RUN_TEST(test_bank_follows_after_four_ticks);
+    RUN_TEST(test_bounce_restarts_the_count);
+    RUN_TEST(test_bits_debounce_independently);
+    RUN_TEST(test_delay_debounce_waits_out_the_delay);
+    RUN_TEST(test_bank_against_delay_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,276 @@
+// Native tests for JUNIPER_CAPTURE and the host's trace files: a capture
+// written through the serial port must map back with mapTrace record for
+// record, replay to the same reads, and capture again to the same bytes.
+// Run with: pio test -e native -f test_capture
+#define JUNIPER_HOST_TEST
+#define JUNIPER_CAPTURE
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint16_t pin = 15;
+static const uint32_t reads = 5000;
+
+static char wirePath[32];
+static int savedStdout = -1;
+
+// Sends stdout, and so everything the capture writes, to a new temporary
+// file at path until stopWire. Nothing may be asserted in between, since
+// Unity reports on stdout too.
+static void startWire(char *path) {
+    strcpy(path, "/tmp/test_capture_XXXXXX");
+    int fd = mkstemp(path);
+    fflush(stdout);
+    savedStdout = dup(1);
+    dup2(fd, 1);
+    close(fd);
+}
+
+static void stopWire() {
+    if (savedStdout < 0) {
+        return;
+    }
+    Io::flushSerial();
+    fflush(stdout);
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    savedStdout = -1;
+}
+
+static std::vector<uint8_t> readFile(const char *path) {
+    std::vector<uint8_t> bytes;
+    FILE *f = fopen(path, "rb");
+    int c;
+    while (f != NULL && (c = fgetc(f)) != EOF) {
+        bytes.push_back((uint8_t) c);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return bytes;
+}
+
+static void writeFile(const char *path, const std::vector<uint8_t> &bytes) {
+    FILE *f = fopen(path, "wb");
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+}
+
+static uint16_t level(uint32_t i) {
+    return (uint16_t) ((i * 37) % 1024);
+}
+
+// Captures the sketch's reads of a ramp on pin, one every 60 us, into
+// wirePath.
+static void captureRamp() {
+    host::useFakeClock(5000);
+    startWire(wirePath);
+    Io::beginCapture();
+    for (uint32_t i = 0; i < reads; i++) {
+        host::advanceMicros(60);
+        host::pinState().analog[pin] = level(i);
+        Io::anaRead(pin);
+    }
+    stopWire();
+}
+
+void setUp(void) {
+    host::simulateUart(0);
+    uint8_t byte;
+    while (Io::serialTx.pop(byte)) {
+    }
+    Io::setTxPolicy(Io::txDrop());
+    Io::captureDropped = 0;
+    Io::captureUnreported = 0;
+    Io::captureSkip = 0;
+}
+
+void tearDown(void) {
+    stopWire();
+    unlink(wirePath);
+}
+
+void test_capture_maps_back_record_for_record(void) {
+    captureRamp();
+    std::vector<uint8_t> bytes = readFile(wirePath);
+    TEST_ASSERT_EQUAL_UINT32(16 + 8 * reads, bytes.size());
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    // The device writes a count of zero: the records run to the end.
+    TEST_ASSERT_EQUAL_UINT32(reads, trace.count);
+    for (uint32_t i = 0; i < reads; i++) {
+        TEST_ASSERT_EQUAL_UINT32(5000 + 60 * (i + 1), trace.samples[i].micros);
+        TEST_ASSERT_EQUAL_UINT16(level(i), trace.samples[i].value);
+        TEST_ASSERT_EQUAL_UINT8(pin, trace.samples[i].pin);
+        TEST_ASSERT_EQUAL_UINT8(0, trace.samples[i].dropped);
+    }
+    host::unmapTrace(trace);
+    TEST_ASSERT_NULL(trace.base);
+    TEST_ASSERT_EQUAL_UINT32(0, trace.count);
+}
+
+void test_a_trailing_partial_record_is_ignored(void) {
+    captureRamp();
+    std::vector<uint8_t> bytes = readFile(wirePath);
+    bytes.resize(bytes.size() - 3);
+    writeFile(wirePath, bytes);
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_EQUAL_UINT32(reads - 1, trace.count);
+    host::unmapTrace(trace);
+}
+
+void test_a_count_in_the_header_limits_the_records(void) {
+    captureRamp();
+    std::vector<uint8_t> bytes = readFile(wirePath);
+    bytes[8] = 100;
+    writeFile(wirePath, bytes);
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_EQUAL_UINT32(100, trace.count);
+    host::unmapTrace(trace);
+    // A count past the end of the file is held to the records there are.
+    bytes[8] = 0;
+    bytes[10] = 1;
+    writeFile(wirePath, bytes);
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_EQUAL_UINT32(reads, trace.count);
+    host::unmapTrace(trace);
+}
+
+void test_trace_blocks_stop_at_the_end(void) {
+    captureRamp();
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    host::trace_block first = host::traceBlock(trace, 0, 4096);
+    TEST_ASSERT_TRUE(first.samples == trace.samples);
+    TEST_ASSERT_EQUAL_UINT32(4096, first.count);
+    host::trace_block last = host::traceBlock(trace, 4096, 4096);
+    TEST_ASSERT_TRUE(last.samples == trace.samples + 4096);
+    TEST_ASSERT_EQUAL_UINT32(reads - 4096, last.count);
+    TEST_ASSERT_EQUAL_UINT32(1, host::traceBlock(trace, reads - 1, 4096).count);
+    TEST_ASSERT_EQUAL_UINT32(0, host::traceBlock(trace, reads, 4096).count);
+    TEST_ASSERT_EQUAL_UINT32(0, host::traceBlock(trace, reads + 1, 4096).count);
+    TEST_ASSERT_EQUAL_UINT32(0, host::traceBlock(trace, 0, 0).count);
+    host::unmapTrace(trace);
+}
+
+void test_replaying_a_capture_captures_it_again(void) {
+    captureRamp();
+    std::vector<uint8_t> original = readFile(wirePath);
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    // Replay in two blocks, split mid-trace, reading the pin as the sketch
+    // would and capturing what it sees.
+    std::vector<uint16_t> seen;
+    std::vector<uint8_t> again(original.begin(), original.begin() + 16);
+    size_t split = 1234;
+    for (int part = 0; part < 2; part++) {
+        host::startSegment((part == 0) ? host::traceBlock(trace, 0, split) : host::traceBlock(trace, split, reads));
+        char partPath[32];
+        startWire(partPath);
+        while (true) {
+            int32_t value = Io::anaRead(pin);
+            if (host::replayState().done) {
+                break;
+            }
+            seen.push_back((uint16_t) value);
+        }
+        stopWire();
+        std::vector<uint8_t> bytes = readFile(partPath);
+        unlink(partPath);
+        // The read that found the block used up was captured too.
+        again.insert(again.end(), bytes.begin(), bytes.end() - 8);
+    }
+    host::unmapTrace(trace);
+    TEST_ASSERT_EQUAL_UINT32(reads, seen.size());
+    for (uint32_t i = 0; i < reads; i++) {
+        TEST_ASSERT_EQUAL_UINT16(level(i), seen[i]);
+    }
+    TEST_ASSERT_TRUE(again == original);
+}
+
+void test_drops_are_reported_in_the_next_record(void) {
+    // At 9600 baud the port carries one record every 8.3 ms, so most of the
+    // reads are dropped. The queue is serviced after every read, as the
+    // loop does.
+    host::useFakeClock(5000);
+    host::simulateUart(9600);
+    startWire(wirePath);
+    Io::beginCapture();
+    for (uint32_t i = 0; i < reads; i++) {
+        host::advanceMicros(60);
+        host::pinState().analog[pin] = level(i);
+        Io::anaRead(pin);
+        Io::serviceSerial();
+    }
+    uint32_t unreported = Io::captureUnreported;
+    stopWire();
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_TRUE(Io::captureDropped > reads / 2);
+    TEST_ASSERT_EQUAL_UINT32(reads - Io::captureDropped, trace.count);
+    uint32_t reported = 0;
+    for (size_t i = 0; i < trace.count; i++) {
+        reported += trace.samples[i].dropped;
+    }
+    TEST_ASSERT_EQUAL_UINT32(Io::captureDropped - unreported, reported);
+    host::unmapTrace(trace);
+}
+
+// Writes the capture with one header byte replaced and checks it is
+// refused.
+static void assertRefusedWith(size_t offset, uint8_t byte) {
+    std::vector<uint8_t> bytes = readFile(wirePath);
+    bytes[offset] = byte;
+    char path[32];
+    strcpy(path, "/tmp/test_capture_XXXXXX");
+    close(mkstemp(path));
+    writeFile(path, bytes);
+    host::trace_file trace;
+    TEST_ASSERT_FALSE(host::mapTrace(path, trace));
+    TEST_ASSERT_NULL(trace.base);
+    TEST_ASSERT_EQUAL_UINT32(0, trace.count);
+    unlink(path);
+}
+
+void test_bad_headers_are_refused(void) {
+    captureRamp();
+    // Magic, version and record size.
+    assertRefusedWith(0, 'X');
+    assertRefusedWith(3, 'S');
+    assertRefusedWith(4, 2);
+    assertRefusedWith(5, 1);
+    assertRefusedWith(6, 12);
+    // Too short for a header, and missing altogether.
+    std::vector<uint8_t> bytes = readFile(wirePath);
+    bytes.resize(15);
+    writeFile(wirePath, bytes);
+    host::trace_file trace;
+    TEST_ASSERT_FALSE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_FALSE(host::mapTrace("/tmp/test_capture_missing", trace));
+    // A header with no records is a valid, empty trace.
+    bytes.resize(16);
+    bytes[15] = 0;
+    writeFile(wirePath, bytes);
+    TEST_ASSERT_TRUE(host::mapTrace(wirePath, trace));
+    TEST_ASSERT_EQUAL_UINT32(0, trace.count);
+    TEST_ASSERT_EQUAL_UINT32(0, host::traceBlock(trace, 0, 4096).count);
+    host::unmapTrace(trace);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_capture_maps_back_record_for_record);
+    RUN_TEST(test_a_trailing_partial_record_is_ignored);
+    RUN_TEST(test_a_count_in_the_header_limits_the_records);
+    RUN_TEST(test_trace_blocks_stop_at_the_end);
+    RUN_TEST(test_replaying_a_capture_captures_it_again);
+    RUN_TEST(test_drops_are_reported_in_the_next_record);
+    RUN_TEST(test_bad_headers_are_refused);
+    return UNITY_END();
+}
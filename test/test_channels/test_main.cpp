@@ -0,0 +1,93 @@
+// Native build of the widest multi-channel mode, eight filtered analog
+// channels of one bar pin each: the sample queue must hold two blocks of
+// frames, and one-pin bars must stay on their own pin.
+// Run with: pio test -e native -f test_channels
+#define JUNIPER_HOST_TEST
+#define JUNIPER_SAMPLE_TIMER
+#define SOUNDBAR_CHANNELS 8
+#define SOUNDBAR_FILTER
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static const uint32_t blockSamples = SOUNDBAR_CHANNELS * SOUNDBAR_FILTER_BLOCK;
+
+// Queues a frame of the same sample on every channel, the way the
+// conversion interrupt does.
+static void convertFrame(uint16_t sample) {
+    for (int ch = 0; ch < SOUNDBAR_CHANNELS; ch++) {
+        Time::sampleInterrupt(sample);
+    }
+}
+
+void setUp(void) {
+    host::useFakeClock(1000);
+    host::pins fresh = {};
+    host::pinState() = fresh;
+    uint16_t value;
+    while (Time::sampleQueue.pop(value)) {
+    }
+}
+
+void tearDown(void) {}
+
+void test_every_channel_gets_one_bar_pin(void) {
+    TEST_ASSERT_EQUAL(1, SoundBar::channelBarPins);
+    for (int ch = 0; ch < SoundBar::numChannels; ch++) {
+        TEST_ASSERT_EQUAL(SoundBar::firstAnalogPin + ch, SoundBar::channels[ch].microphonePin);
+        TEST_ASSERT_TRUE(SoundBar::channels[ch].barPins == SoundBar::barPins.data + ch);
+    }
+}
+
+void test_the_queue_holds_two_blocks(void) {
+    TEST_ASSERT_TRUE(JUNIPER_SAMPLE_EVENTS > 2 * blockSamples);
+    Time::startSampling(SoundBar::firstAnalogPin, SOUNDBAR_FILTER_RATE);
+    for (uint32_t i = 0; i < 2 * SOUNDBAR_FILTER_BLOCK; i++) {
+        convertFrame((uint16_t) i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, Time::samplesMissedCount());
+    for (uint32_t block = 0; block < 2; block++) {
+        Prelude::sig<Prelude::list<uint16_t, blockSamples>> frames = Time::sampleBlockIn<blockSamples>();
+        TEST_ASSERT_EQUAL(0, frames.signal.tag);
+        for (uint32_t i = 0; i < blockSamples; i++) {
+            TEST_ASSERT_EQUAL_UINT16(block * SOUNDBAR_FILTER_BLOCK + i / SOUNDBAR_CHANNELS, frames.signal.just.data[i]);
+        }
+    }
+    TEST_ASSERT_EQUAL(1, (Time::sampleBlockIn<blockSamples>().signal.tag));
+}
+
+void test_a_one_pin_envelope_reads_zero(void) {
+    // Every value is clipped to the bound of 0, so the state never moves.
+    uint16_t level = 0;
+    for (uint32_t i = 0; i < 100; i++) {
+        level = Signal::envelopeFold<SOUNDBAR_ATTACK, SOUNDBAR_RELEASE, 0>((uint16_t) (i * 997), level);
+        TEST_ASSERT_EQUAL_UINT16(0, level);
+        TEST_ASSERT_EQUAL_UINT16(0, Signal::envelopeLevel<0>(level));
+    }
+}
+
+void test_one_pin_bars_stay_on_their_pin(void) {
+    SoundBar::setup();
+    Prelude::list<uint16_t, SOUNDBAR_CHANNELS> levels;
+    for (uint32_t i = 0; i < 16 * SOUNDBAR_FILTER_BLOCK; i++) {
+        convertFrame((i % 2) ? 1023 : 0);
+        levels = SoundBar::stepChannels<SoundBar::numChannels, SoundBar::channelBarPins>(SoundBar::channels);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, Time::samplesMissedCount());
+    for (int ch = 0; ch < SoundBar::numChannels; ch++) {
+        // A one-pin bar's only level is 0, which lights its pin.
+        TEST_ASSERT_EQUAL_UINT16(0, levels.data[ch]);
+        TEST_ASSERT_EQUAL_UINT16(0, SoundBar::channels[ch].envelope);
+        uint8_t pin = SoundBar::barPins.data[ch];
+        TEST_ASSERT_EQUAL(OUTPUT, host::pinState().mode[pin]);
+        TEST_ASSERT_EQUAL(HIGH, host::pinState().digital[pin]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_channel_gets_one_bar_pin);
+    RUN_TEST(test_the_queue_holds_two_blocks);
+    RUN_TEST(test_a_one_pin_envelope_reads_zero);
+    RUN_TEST(test_one_pin_bars_stay_on_their_pin);
+    return UNITY_END();
+}
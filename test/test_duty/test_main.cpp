@@ -0,0 +1,309 @@
+// Native tests for the pulse density (duty cycle) level estimate, both from
+// samples and from interrupt-queued edges, plus a benchmark of the accuracy
+// and cost of each over a recorded trace.
+// Run with: pio test -e native -f test_duty
+#define JUNIPER_HOST_TEST
+#define SOUNDBAR_PULSE_DENSITY
+#define JUNIPER_EDGE_INTERRUPTS
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint16_t micPin = 15;
+static const uint32_t window = 1000;
+
+static Io::dutyState fresh() {
+    Io::dutyState duty = { 0, 0, 0, false, false, 0 };
+    return duty;
+}
+
+void setUp(void) {
+    host::useFakeClock(5000);
+    Io::edgeEvent event;
+    while (Io::edgeQueue.pop(event)) {
+    }
+}
+
+void tearDown(void) {}
+
+void test_level_rounds_and_scales_long_windows(void) {
+    TEST_ASSERT_EQUAL_UINT16(0, Io::dutyLevel<7>(0, 0));
+    TEST_ASSERT_EQUAL_UINT16(4, Io::dutyLevel<7>(500, 1000));
+    TEST_ASSERT_EQUAL_UINT16(7, Io::dutyLevel<7>(1000, 1000));
+    TEST_ASSERT_EQUAL_UINT16(32768, Io::dutyLevel<65535>(1UL << 30, 1UL << 31));
+}
+
+void test_window_closes_on_the_active_share(void) {
+    Io::dutyState duty = fresh();
+    // Active for 250 us of every 1000 us window.
+    Io::dutyAdvance<100>(duty, 0, true, window);
+    Io::dutyAdvance<100>(duty, 250, false, window);
+    TEST_ASSERT_EQUAL_UINT16(0, duty.level);
+    Io::dutyAdvance<100>(duty, 1000, true, window);
+    TEST_ASSERT_EQUAL_UINT16(25, duty.level);
+    Io::dutyAdvance<100>(duty, 1750, false, window);
+    Io::dutyAdvance<100>(duty, 2000, false, window);
+    TEST_ASSERT_EQUAL_UINT16(75, duty.level);
+}
+
+void test_timestamps_that_go_back_credit_nothing(void) {
+    Io::dutyState duty = fresh();
+    Io::dutyAdvance<100>(duty, 1000, true, window);
+    Io::dutyAdvance<100>(duty, 1500, true, window);
+    // A late edge: its level counts from now, the 400 us it claims do not.
+    Io::dutyAdvance<100>(duty, 1100, false, window);
+    TEST_ASSERT_EQUAL_UINT32(500, duty.activeMicros);
+    TEST_ASSERT_EQUAL_UINT32(1500, duty.lastMicros);
+    Io::dutyAdvance<100>(duty, 2000, false, window);
+    TEST_ASSERT_EQUAL_UINT16(50, duty.level);
+}
+
+void test_level_never_exceeds_full_scale(void) {
+    Io::dutyState duty = fresh();
+    Io::dutyAdvance<7>(duty, 0, true, window);
+    duty.activeMicros = 5000;
+    Io::dutyAdvance<7>(duty, 1000, true, window);
+    TEST_ASSERT_EQUAL_UINT16(7, duty.level);
+}
+
+void test_sampled_density_follows_the_pin(void) {
+    Io::dutyState duty = fresh();
+    juniper::shared_ptr<Io::dutyState> state(&duty, juniper::static_storage);
+    // Low (sound) for the first 300 of every 1000 us, sampled every 10 us.
+    for (uint32_t t = 0; t < 3000; t += 10) {
+        Io::pinState level = ((t % 1000) < 300) ? Io::low() : Io::high();
+        Io::pulseDensity<100>(Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(level)), window, state);
+        host::advanceMicros(10);
+    }
+    TEST_ASSERT_UINT_WITHIN(1, 30, duty.level);
+}
+
+void test_edge_density_uses_exact_edge_times(void) {
+    Io::dutyState duty = fresh();
+    juniper::shared_ptr<Io::dutyState> state(&duty, juniper::static_storage);
+    host::pinState().digital[micPin] = HIGH;
+    Io::watchEdges(micPin);
+    Io::pulseDensityIn<100>(window, state);
+    // One 400 us pulse per window, with passes far apart.
+    for (int w = 0; w < 3; w++) {
+        host::advanceMicros(100);
+        host::injectEdge(micPin, LOW);
+        host::advanceMicros(400);
+        host::injectEdge(micPin, HIGH);
+        host::advanceMicros(500);
+        Io::pulseDensityIn<100>(window, state);
+    }
+    TEST_ASSERT_EQUAL_UINT16(40, duty.level);
+}
+
+void test_edge_after_the_drain_is_not_credited_early(void) {
+    Io::dutyState duty = fresh();
+    juniper::shared_ptr<Io::dutyState> state(&duty, juniper::static_storage);
+    host::pinState().digital[micPin] = HIGH;
+    Io::watchEdges(micPin);
+    Io::pulseDensityIn<100>(window, state);
+    host::advanceMicros(600);
+    // The pin goes low, but the pass only sees the new edgeLevel: its edge
+    // is still queued, as if it landed just after the queue was drained.
+    host::pinState().digital[micPin] = LOW;
+    Io::edgeLevel = 0;
+    Io::pulseDensityIn<100>(window, state);
+    TEST_ASSERT_EQUAL_UINT32(0, duty.activeMicros);
+    host::advanceMicros(400);
+    Io::edgeEvent late = { (uint32_t) micros() - 450, Io::low() };
+    Io::edgeQueue.push(late);
+    Io::pulseDensityIn<100>(window, state);
+    TEST_ASSERT_EQUAL_UINT16(40, duty.level);
+}
+
+// A comparator's output as a list of edges: bursts of sound (low) and quiet
+// (high) of varying length, in passages that range from near silence to
+// near continuous sound.
+struct edge {
+    uint32_t micros;
+    uint8_t level;
+};
+
+static const uint32_t traceStart = 10000;
+static const uint32_t traceMicros = 4000000;
+
+static uint32_t lcg(uint32_t &seed) {
+    seed = seed * 1664525UL + 1013904223UL;
+    return seed >> 8;
+}
+
+static std::vector<edge> comparatorEdges() {
+    std::vector<edge> edges;
+    uint32_t seed = 12345;
+    uint32_t t = traceStart;
+    while (t < traceStart + traceMicros) {
+        // Quiet gaps scale with a loudness that changes every 100 ms.
+        uint32_t loudness = 1 + ((t - traceStart) / 100000 * 7) % 16;
+        edge sound = { t, LOW };
+        edges.push_back(sound);
+        t += 30 + lcg(seed) % 1500;
+        edge quiet = { t, HIGH };
+        edges.push_back(quiet);
+        t += 30 + lcg(seed) % (250 * loudness);
+    }
+    return edges;
+}
+
+// The comparator's level at time t.
+static uint8_t levelAt(const std::vector<edge> &edges, uint32_t t) {
+    size_t lo = 0;
+    size_t hi = edges.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        (edges[mid].micros <= t ? lo : hi) = mid;
+    }
+    return (edges[lo].micros <= t) ? edges[lo].level : HIGH;
+}
+
+// The exact level of a window, from the comparator's edges.
+static uint16_t exactLevel(const std::vector<edge> &edges, uint32_t from, uint32_t to) {
+    uint32_t active = 0;
+    for (size_t i = 0; i < edges.size() && edges[i].micros < to; i++) {
+        if (edges[i].level == LOW) {
+            uint32_t end = (i + 1 < edges.size()) ? edges[i + 1].micros : to;
+            uint32_t a = (edges[i].micros > from) ? edges[i].micros : from;
+            uint32_t b = (end < to) ? end : to;
+            active += (b > a) ? b - a : 0;
+        }
+    }
+    return Io::dutyLevel<100>(active, to - from);
+}
+
+// Writes what the sketch would capture reading the comparator once a pass,
+// with passes of 150 to 250 us, as a trace file at path.
+static void writeCapture(const std::vector<edge> &edges, const char *path) {
+    FILE *f = fopen(path, "wb");
+    const uint8_t header[16] = { 'S', 'B', 'T', 'R', 1, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    fwrite(header, 1, sizeof(header), f);
+    uint32_t seed = 777;
+    for (uint32_t t = traceStart; t < traceStart + traceMicros; t += 150 + lcg(seed) % 100) {
+        host::trace_sample s = { t, levelAt(edges, t), (uint8_t) micPin, 0 };
+        fwrite(&s, sizeof(s), 1, f);
+    }
+    fclose(f);
+}
+
+struct densityRun {
+    double meanError;
+    uint16_t worstError;
+    uint32_t windows;
+    double cycles;
+};
+
+// Scores each window the estimate closes against the comparator's exact
+// level over the same span.
+static void scoreWindow(const std::vector<edge> &edges, const Io::dutyState &before, const Io::dutyState &after, densityRun &run, uint64_t &errors) {
+    if (before.started && after.windowStart != before.windowStart) {
+        uint16_t exact = exactLevel(edges, before.windowStart, after.windowStart);
+        uint16_t error = (after.level > exact) ? after.level - exact : exact - after.level;
+        errors += error;
+        run.worstError = (error > run.worstError) ? error : run.worstError;
+        run.windows++;
+    }
+}
+
+// pulseDensity on the pin as the replayed trace drives it, one read a pass.
+static densityRun sampledRun(const std::vector<edge> &edges, const host::trace_file &trace) {
+    densityRun run = { 0, 0, 0, 0 };
+    uint64_t errors = 0;
+    uint64_t cycles = 0;
+    Io::dutyState duty = fresh();
+    juniper::shared_ptr<Io::dutyState> state(&duty, juniper::static_storage);
+    host::startSegment(host::traceBlock(trace, 0, trace.count));
+    host::pinState().mode[micPin] = INPUT;
+    uint32_t passes = 0;
+    while (true) {
+        Prelude::sig<Io::pinState> mic = Io::digIn(micPin);
+        if (host::replayState().done) {
+            break;
+        }
+        Io::dutyState before = duty;
+        uint64_t start = host::cycles();
+        Io::pulseDensity<100>(mic, SOUNDBAR_DUTY_WINDOW_US, state);
+        cycles += host::cycles() - start;
+        scoreWindow(edges, before, duty, run, errors);
+        passes++;
+    }
+    run.meanError = (double) errors / run.windows;
+    run.cycles = (double) cycles / passes;
+    return run;
+}
+
+// pulseDensityIn fed the comparator's edges as the pin change interrupt
+// would see them, polled at the trace's pass times.
+static densityRun edgeRun(const std::vector<edge> &edges, const host::trace_file &trace) {
+    densityRun run = { 0, 0, 0, 0 };
+    uint64_t errors = 0;
+    uint64_t cycles = 0;
+    Io::dutyState duty = fresh();
+    juniper::shared_ptr<Io::dutyState> state(&duty, juniper::static_storage);
+    Io::edgeEvent event;
+    while (Io::edgeQueue.pop(event)) {
+    }
+    host::useFakeClock(trace.samples[0].micros);
+    host::pinState().digital[micPin] = HIGH;
+    Io::watchEdges(micPin);
+    size_t next = 0;
+    for (size_t i = 0; i < trace.count; i++) {
+        for (; next < edges.size() && edges[next].micros <= trace.samples[i].micros; next++) {
+            host::clockState().fakeMicros = edges[next].micros;
+            host::injectEdge(micPin, edges[next].level);
+        }
+        host::clockState().fakeMicros = trace.samples[i].micros;
+        Io::dutyState before = duty;
+        uint64_t start = host::cycles();
+        Io::pulseDensityIn<100>(SOUNDBAR_DUTY_WINDOW_US, state);
+        cycles += host::cycles() - start;
+        scoreWindow(edges, before, duty, run, errors);
+    }
+    run.meanError = (double) errors / run.windows;
+    run.cycles = (double) cycles / trace.count;
+    return run;
+}
+
+void test_density_accuracy_and_cycles_over_a_trace(void) {
+    std::vector<edge> edges = comparatorEdges();
+    char path[32];
+    strcpy(path, "/tmp/test_duty_XXXXXX");
+    close(mkstemp(path));
+    writeCapture(edges, path);
+    host::trace_file trace;
+    TEST_ASSERT_TRUE(host::mapTrace(path, trace));
+    unlink(path);
+    densityRun sampled = sampledRun(edges, trace);
+    densityRun edged = edgeRun(edges, trace);
+    host::unmapTrace(trace);
+    char line[200];
+    snprintf(line, sizeof(line), "levels off per %u us window (of 100): pulseDensity mean %.2f worst %u, pulseDensityIn mean %.2f worst %u; host::cycles/pass: %.1f, %.1f",
+        (unsigned) SOUNDBAR_DUTY_WINDOW_US, sampled.meanError, sampled.worstError, edged.meanError, edged.worstError, sampled.cycles, edged.cycles);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(sampled.windows >= traceMicros / SOUNDBAR_DUTY_WINDOW_US - 1);
+    TEST_ASSERT_EQUAL_UINT32(sampled.windows, edged.windows);
+    // Exact edge times leave only rounding; sampling adds the error of
+    // seeing each pulse only at pass times.
+    TEST_ASSERT_TRUE(edged.worstError <= 1);
+    TEST_ASSERT_TRUE(sampled.meanError < 3.0);
+    TEST_ASSERT_TRUE(edged.meanError <= sampled.meanError);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_level_rounds_and_scales_long_windows);
+    RUN_TEST(test_window_closes_on_the_active_share);
+    RUN_TEST(test_timestamps_that_go_back_credit_nothing);
+    RUN_TEST(test_level_never_exceeds_full_scale);
+    RUN_TEST(test_sampled_density_follows_the_pin);
+    RUN_TEST(test_edge_density_uses_exact_edge_times);
+    RUN_TEST(test_edge_after_the_drain_is_not_credited_early);
+    RUN_TEST(test_density_accuracy_and_cycles_over_a_trace);
+    return UNITY_END();
+}
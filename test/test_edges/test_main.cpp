@@ -0,0 +1,110 @@
+// Native tests for the interrupt-fed edge queue (JUNIPER_EDGE_INTERRUPTS)
+// and the ring_buffer under it.
+// Run with: pio test -e native -f test_edges
+#define JUNIPER_HOST_TEST
+#define JUNIPER_EDGE_INTERRUPTS
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <sys/wait.h>
+
+static const uint16_t micPin = 15;
+
+void setUp(void) {
+    host::useFakeClock(1000);
+    Io::edgeEvent event;
+    while (Io::edgeQueue.pop(event)) {
+    }
+    Io::edgesDropped = 0;
+}
+
+void tearDown(void) {}
+
+void test_ring_buffer_is_fifo_across_wraps(void) {
+    juniper::ring_buffer<uint16_t, 4> queue;
+    uint16_t value = 0;
+    for (uint16_t round = 0; round < 10; round++) {
+        TEST_ASSERT_TRUE(queue.push(round));
+        TEST_ASSERT_TRUE(queue.push(round + 100));
+        TEST_ASSERT_EQUAL(2, queue.size());
+        TEST_ASSERT_TRUE(queue.pop(value));
+        TEST_ASSERT_EQUAL_UINT16(round, value);
+        TEST_ASSERT_TRUE(queue.pop(value));
+        TEST_ASSERT_EQUAL_UINT16(round + 100, value);
+        TEST_ASSERT_TRUE(queue.empty());
+    }
+    TEST_ASSERT_FALSE(queue.pop(value));
+}
+
+void test_ring_buffer_keeps_one_slot_open(void) {
+    juniper::ring_buffer<uint8_t, 4> queue;
+    TEST_ASSERT_TRUE(queue.push(1));
+    TEST_ASSERT_TRUE(queue.push(2));
+    TEST_ASSERT_TRUE(queue.push(3));
+    TEST_ASSERT_EQUAL(0, queue.free());
+    TEST_ASSERT_FALSE(queue.push(4));
+    uint8_t value = 0;
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL_UINT8(1, value);
+    TEST_ASSERT_TRUE(queue.push(4));
+    TEST_ASSERT_EQUAL_UINT8(2, queue.peek());
+}
+
+void test_edges_arrive_in_order_with_their_time(void) {
+    host::pinState().digital[micPin] = HIGH;
+    Io::watchEdges(micPin);
+    host::injectEdge(micPin, LOW);
+    host::advanceMicros(250);
+    host::injectEdge(micPin, LOW);
+    host::injectEdge(micPin, HIGH);
+
+    Prelude::sig<Io::edgeEvent> first = Io::edgeIn();
+    TEST_ASSERT_EQUAL(0, first.signal.tag);
+    TEST_ASSERT_EQUAL_UINT32(1000, first.signal.just.micros);
+    TEST_ASSERT_EQUAL(0, Io::pinStateToInt(first.signal.just.state));
+    Prelude::sig<Io::edgeEvent> second = Io::edgeIn();
+    TEST_ASSERT_EQUAL(0, second.signal.tag);
+    TEST_ASSERT_EQUAL_UINT32(1250, second.signal.just.micros);
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(second.signal.just.state));
+    TEST_ASSERT_EQUAL(1, Io::edgeIn().signal.tag);
+    TEST_ASSERT_EQUAL(1, Io::pinStateToInt(Io::edgeLevelIn().signal.just));
+}
+
+void test_edges_past_a_full_queue_are_counted(void) {
+    host::pinState().digital[micPin] = HIGH;
+    Io::watchEdges(micPin);
+    for (int i = 0; i < JUNIPER_EDGE_EVENTS + 9; i++) {
+        host::injectEdge(micPin, (i % 2) ? HIGH : LOW);
+    }
+    TEST_ASSERT_EQUAL_UINT32(10, Io::edgesDroppedCount());
+    int queued = 0;
+    while (Io::edgeIn().signal.tag == 0) {
+        queued++;
+    }
+    TEST_ASSERT_EQUAL(JUNIPER_EDGE_EVENTS - 1, queued);
+}
+
+void test_watching_a_second_pin_halts(void) {
+    Io::watchEdges(micPin);
+    Io::watchEdges(micPin);
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        Io::watchEdges(micPin + 1);
+        _exit(0);
+    }
+    int status = 0;
+    TEST_ASSERT_EQUAL(child, waitpid(child, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL(1, WEXITSTATUS(status));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_buffer_is_fifo_across_wraps);
+    RUN_TEST(test_ring_buffer_keeps_one_slot_open);
+    RUN_TEST(test_edges_arrive_in_order_with_their_time);
+    RUN_TEST(test_edges_past_a_full_queue_are_counted);
+    RUN_TEST(test_watching_a_second_pin_halts);
+    return UNITY_END();
+}
@@ -0,0 +1,138 @@
+// Native tests for the envelope follower in Signal: envelopeStep must
+// settle exactly on any steady target, and the sketch's 0 .. 7 envelope
+// at the default shifts must keep its attack and release step responses.
+// Run with: pio test -e native -f test_envelope
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static const uint16_t levels[5] = { 0, 1, 100, 57344, 0xFFFF };
+
+// Steps from start to target with envelopeStep<attack, release>, checking
+// every step moves towards the target without passing it, and returns the
+// number of steps taken to land on it exactly.
+template<int attack, int release>
+static uint32_t stepsToSettle(uint16_t start, uint16_t target) {
+    uint16_t current = start;
+    uint32_t steps = 0;
+    while (current != target && steps <= 0x10000) {
+        uint16_t next = Signal::envelopeStep<attack, release>(target, current);
+        if (target > current) {
+            TEST_ASSERT_TRUE(next > current && next <= target);
+        } else {
+            TEST_ASSERT_TRUE(next < current && next >= target);
+        }
+        current = next;
+        steps++;
+    }
+    TEST_ASSERT_EQUAL_UINT16(target, current);
+    TEST_ASSERT_EQUAL_UINT16(target, (Signal::envelopeStep<attack, release>(target, current)));
+    return steps;
+}
+
+template<int attack, int release>
+static void assertSettlesEverywhere() {
+    for (int from = 0; from < 5; from++) {
+        for (int to = 0; to < 5; to++) {
+            stepsToSettle<attack, release>(levels[from], levels[to]);
+        }
+    }
+}
+
+// Feeds value to the sketch's envelope steps times, keeping each output.
+static void follow(juniper::shared_ptr<uint16_t> state, uint16_t value, uint16_t *out, int steps) {
+    for (int i = 0; i < steps; i++) {
+        out[i] = Signal::envelope<1, 4, 7>(Prelude::signal<uint16_t>(Prelude::just<uint16_t>(value)), state).signal.just;
+    }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_steps_settle_exactly_for_any_shifts(void) {
+    assertSettlesEverywhere<0, 0>();
+    assertSettlesEverywhere<1, 4>();
+    assertSettlesEverywhere<2, 6>();
+    assertSettlesEverywhere<4, 4>();
+    assertSettlesEverywhere<15, 15>();
+}
+
+void test_settling_takes_the_expected_steps(void) {
+    // Each step takes 1 / 2^shift of the distance, rounded up.
+    TEST_ASSERT_EQUAL_UINT32(1, (stepsToSettle<0, 0>(0, 0xFFFF)));
+    TEST_ASSERT_EQUAL_UINT32(16, (stepsToSettle<1, 4>(0, 0xFFFF)));
+    TEST_ASSERT_EQUAL_UINT32(139, (stepsToSettle<1, 4>(0xFFFF, 0)));
+    TEST_ASSERT_EQUAL_UINT32(1, (stepsToSettle<1, 4>(100, 101)));
+    TEST_ASSERT_EQUAL_UINT32(477, (stepsToSettle<2, 6>(0xFFFF, 0)));
+}
+
+void test_attack_step_response(void) {
+    uint16_t envelope = 0;
+    juniper::shared_ptr<uint16_t> state(&envelope, juniper::static_storage);
+    static const uint16_t expected[6] = { 4, 5, 6, 7, 7, 7 };
+    uint16_t out[6];
+    follow(state, 7, out, 6);
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL_UINT16(expected[i], out[i]);
+    }
+    // The state, 7 in Q3.13, lands on full scale on the 16th step.
+    uint16_t rest[10];
+    follow(state, 7, rest, 9);
+    TEST_ASSERT_EQUAL_UINT16(57343, envelope);
+    follow(state, 7, rest, 1);
+    TEST_ASSERT_EQUAL_UINT16(57344, envelope);
+    // Values past the bound are clipped to it.
+    follow(state, 200, rest, 10);
+    TEST_ASSERT_EQUAL_UINT16(57344, envelope);
+}
+
+void test_release_step_response(void) {
+    uint16_t envelope = 57344;
+    juniper::shared_ptr<uint16_t> state(&envelope, juniper::static_storage);
+    static const uint16_t expected[16] = { 7, 6, 6, 5, 5, 5, 4, 4, 4, 4, 3, 3, 3, 3, 3, 2 };
+    uint16_t out[16];
+    follow(state, 0, out, 16);
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL_UINT16(expected[i], out[i]);
+    }
+    // Dark after 41 steps, and the state is exactly zero after 137.
+    uint16_t rest[95];
+    follow(state, 0, rest, 25);
+    TEST_ASSERT_EQUAL_UINT16(1, rest[23]);
+    TEST_ASSERT_EQUAL_UINT16(0, rest[24]);
+    follow(state, 0, rest, 95);
+    TEST_ASSERT_NOT_EQUAL(0, envelope);
+    follow(state, 0, rest, 1);
+    TEST_ASSERT_EQUAL_UINT16(0, envelope);
+}
+
+void test_block_fold_matches_the_envelope(void) {
+    uint16_t valueEnvelope = 0;
+    uint16_t blockEnvelope = 0;
+    juniper::shared_ptr<uint16_t> valueState(&valueEnvelope, juniper::static_storage);
+    juniper::shared_ptr<uint16_t> blockState(&blockEnvelope, juniper::static_storage);
+    Prelude::sig<Prelude::list<uint16_t, 32>> s;
+    s.signal.tag = 0;
+    s.signal.just.length = 32;
+    for (uint16_t i = 0; i < 32; i++) {
+        s.signal.just.data[i] = (i < 8) ? 7 : ((i < 20) ? 0 : i % 9);
+    }
+    Prelude::sig<Prelude::list<uint16_t, 32>> folded = Signal::foldPBlock<uint16_t, uint16_t, 32>(Signal::envelopeFold<1, 4, 7>, blockState, s);
+    TEST_ASSERT_EQUAL(0, folded.signal.tag);
+    for (uint32_t i = 0; i < 32; i++) {
+        uint16_t level = Signal::envelope<1, 4, 7>(Prelude::signal<uint16_t>(Prelude::just<uint16_t>(s.signal.just.data[i])), valueState).signal.just;
+        TEST_ASSERT_EQUAL_UINT16(valueEnvelope, folded.signal.just.data[i]);
+        TEST_ASSERT_EQUAL_UINT16(level, Signal::envelopeLevel<7>(folded.signal.just.data[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT16(valueEnvelope, blockEnvelope);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_steps_settle_exactly_for_any_shifts);
+    RUN_TEST(test_settling_takes_the_expected_steps);
+    RUN_TEST(test_attack_step_response);
+    RUN_TEST(test_release_step_response);
+    RUN_TEST(test_block_fold_matches_the_envelope);
+    return UNITY_END();
+}
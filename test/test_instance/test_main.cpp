@@ -0,0 +1,78 @@
+// Native tests for SoundBar::instance: its footprint, and that any number
+// of instances step side by side without sharing state.
+// Run with: pio test -e native -f test_instance
+#define JUNIPER_HOST_TEST
+#define JUNIPER_TRACK_MEMORY
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <stdio.h>
+#include <vector>
+
+static const uint16_t quietPin = 20;
+static const uint16_t loudPin = 21;
+
+void setUp(void) {
+    host::pins fresh = {};
+    host::pinState() = fresh;
+    host::pinState().digital[quietPin] = HIGH;
+    host::pinState().digital[loudPin] = LOW;
+}
+
+void tearDown(void) {}
+
+void test_footprint_is_within_budget(void) {
+    char message[64];
+    snprintf(message, sizeof(message), "instance<8>: %u bytes, budget %u",
+        (unsigned) sizeof(SoundBar::instance<8>), (unsigned) SoundBar::instanceBudget);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL(SoundBar::instanceBudget, sizeof(SoundBar::instance<8>));
+    TEST_ASSERT_EQUAL(sizeof(SoundBar::instance<1>), sizeof(SoundBar::instance<8>));
+}
+
+static uint16_t envelopeAfter(uint16_t microphonePin, int passes) {
+    SoundBar::instance<8> bar = SoundBar::makeInstance<8>(microphonePin, SoundBar::barPins.data, Io::digWrite);
+    for (int i = 0; i < passes; i++) {
+        SoundBar::stepInstance<8>(bar);
+    }
+    return bar.envelope;
+}
+
+void test_instances_do_not_share_state(void) {
+    const int passes = 20;
+    uint16_t quiet = envelopeAfter(quietPin, passes);
+    uint16_t loud = envelopeAfter(loudPin, passes);
+    TEST_ASSERT_NOT_EQUAL(quiet, loud);
+
+    std::vector<SoundBar::instance<8>> bars;
+    for (int i = 0; i < 1000; i++) {
+        bars.push_back(SoundBar::makeInstance<8>((i % 2) ? loudPin : quietPin, SoundBar::barPins.data, Io::digWrite));
+    }
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < bars.size(); i++) {
+            SoundBar::stepInstance<8>(bars[i]);
+        }
+    }
+    for (size_t i = 0; i < bars.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT16((i % 2) ? loud : quiet, bars[i].envelope);
+    }
+}
+
+void test_drawing_does_not_allocate(void) {
+    SoundBar::instance<8> bar = SoundBar::makeInstance<8>(loudPin, SoundBar::barPins.data, Io::digWrite);
+    juniper::memory_stats before = juniper::memoryStats();
+    Signal::sink<uint16_t>([&](uint16_t level) -> Prelude::unit {
+        return SoundBar::drawBar<8>(bar, level);
+    }, Prelude::signal<uint16_t>(Prelude::just<uint16_t>(5)));
+    TEST_ASSERT_EQUAL_UINT32(before.totalAllocations, juniper::memoryStats().totalAllocations);
+    TEST_ASSERT_EQUAL(HIGH, host::pinState().digital[juniper::flash_read(SoundBar::barPins.data + 5)]);
+    TEST_ASSERT_EQUAL(LOW, host::pinState().digital[juniper::flash_read(SoundBar::barPins.data + 6)]);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_footprint_is_within_budget);
+    RUN_TEST(test_instances_do_not_share_state);
+    RUN_TEST(test_drawing_does_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,110 @@
+// Native tests for the List module and the list runtime helpers.
+// Run with: pio test -e native -f test_list
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+template<typename A, typename B>
+struct same_type { static const bool value = false; };
+template<typename A>
+struct same_type<A, A> { static const bool value = true; };
+
+// Accumulator widths. The negative side of a signed type reaches max + 1,
+// so 65536 int16_t values still fit int32_t but 65537 do not.
+static_assert(same_type<juniper::accumulator<uint16_t, 5>::type, uint32_t>::value, "");
+static_assert(same_type<juniper::accumulator<uint16_t, 64, 1023>::type, uint16_t>::value, "");
+static_assert(same_type<juniper::accumulator<uint16_t, 65, 1023>::type, uint32_t>::value, "");
+static_assert(same_type<juniper::accumulator<int8_t, 1>::type, int8_t>::value, "");
+static_assert(same_type<juniper::accumulator<int16_t, 65536>::type, int32_t>::value, "");
+static_assert(same_type<juniper::accumulator<int16_t, 65537>::type, int64_t>::value, "");
+static_assert(same_type<juniper::int_for_bound<127, true, 128>::type, int8_t>::value, "");
+static_assert(same_type<juniper::int_for_bound<127, true, 129>::type, int16_t>::value, "");
+static_assert(same_type<juniper::int_for_bound<128, true, 128>::type, int16_t>::value, "");
+
+// The constexpr list algorithms must fold at compile time.
+constexpr uint16_t twice(uint16_t x) { return x * 2; }
+constexpr Prelude::list<uint16_t, 4> replicated = List::replicate<uint16_t, 4>(3, 7);
+constexpr Prelude::list<uint16_t, 4> mapped = List::mapConst<uint16_t, uint16_t>(twice, replicated);
+constexpr Prelude::list<uint16_t, 8> appended = List::appendConst<uint16_t, 4, 4, 8>(replicated, mapped);
+static_assert(replicated.length == 3 && replicated.data[2] == 7, "");
+static_assert(mapped.length == 3 && mapped.data[0] == 14, "");
+static_assert(appended.length == 6 && appended.data[2] == 7 && appended.data[3] == 14 && appended.data[5] == 14 && appended.data[7] == 0, "");
+constexpr Prelude::list<uint8_t, 300> large = List::replicate<uint8_t, 300>(300, 1);
+static_assert(large.data[299] == 1, "");
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_sum_does_not_overflow(void) {
+    Prelude::list<uint16_t, 256> lst = List::replicate<uint16_t, 256>(256, 1023);
+    TEST_ASSERT_EQUAL_UINT32(256UL * 1023UL, (List::sumWide<uint16_t, 256>(lst)));
+    TEST_ASSERT_EQUAL_UINT16(1023, (List::averageBounded<uint16_t, 256, 1023>(lst)));
+
+    Prelude::list<int16_t, 4> neg = List::replicate<int16_t, 4>(4, -32768);
+    TEST_ASSERT_EQUAL_INT32(-131072L, (List::sumWide<int16_t, 4>(neg)));
+}
+
+void test_const_algorithms_match_runtime(void) {
+    Prelude::list<uint16_t, 8> runtime = List::append<uint16_t, 4, 4, 8>(replicated, mapped);
+    TEST_ASSERT_EQUAL_UINT32(appended.length, runtime.length);
+    for (uint32_t i = 0; i < runtime.length; i++) {
+        TEST_ASSERT_EQUAL_UINT16(appended.data[i], runtime.data[i]);
+    }
+}
+
+// A list of length live whose dead tail is filled with junk.
+template<typename T, int N>
+static Prelude::list<T, N> withTail(uint32_t live, T value, T junk) {
+    Prelude::list<T, N> lst;
+    for (int i = 0; i < N; i++) {
+        lst.data[i] = ((uint32_t) i < live) ? value : junk;
+    }
+    lst.length = live;
+    return lst;
+}
+
+void test_equality_ignores_dead_tails(void) {
+    // Bytewise (memcmp) element type.
+    TEST_ASSERT_TRUE((withTail<uint16_t, 8>(3, 5, 0) == withTail<uint16_t, 8>(3, 5, 0xBEEF)));
+    TEST_ASSERT_FALSE((withTail<uint16_t, 8>(3, 5, 0) != withTail<uint16_t, 8>(3, 5, 0xBEEF)));
+    TEST_ASSERT_TRUE((withTail<uint16_t, 8>(0, 5, 1) == withTail<uint16_t, 8>(0, 6, 2)));
+    // Element type compared with its own operator==.
+    TEST_ASSERT_TRUE((withTail<double, 8>(2, 0.5, 1.0) == withTail<double, 8>(2, 0.5, -1.0)));
+    TEST_ASSERT_TRUE((withTail<Io::pinState, 4>(1, Io::high(), Io::low()) == withTail<Io::pinState, 4>(1, Io::high(), Io::high())));
+}
+
+void test_equality_compares_live_elements(void) {
+    TEST_ASSERT_FALSE((withTail<uint16_t, 8>(3, 5, 0) == withTail<uint16_t, 8>(4, 5, 0)));
+    Prelude::list<uint16_t, 8> changed = withTail<uint16_t, 8>(3, 5, 0);
+    changed.data[2] = 6;
+    TEST_ASSERT_FALSE((withTail<uint16_t, 8>(3, 5, 0) == changed));
+    TEST_ASSERT_FALSE((withTail<double, 8>(2, 0.5, 0.0) == withTail<double, 8>(2, 0.25, 0.0)));
+    // Floats are not compared bytewise: -0.0 equals 0.0.
+    TEST_ASSERT_TRUE((withTail<double, 4>(2, 0.0, 1.0) == withTail<double, 4>(2, -0.0, 1.0)));
+}
+
+void test_member_only_searches_live_elements(void) {
+    Prelude::list<uint16_t, 8> lst = withTail<uint16_t, 8>(3, 5, 9);
+    TEST_ASSERT_TRUE((List::member<uint16_t, 8>(5, lst)));
+    TEST_ASSERT_FALSE((List::member<uint16_t, 8>(9, lst)));
+}
+
+void test_drop_repeats_sees_through_dead_tails(void) {
+    typedef Prelude::list<uint16_t, 8> block;
+    Prelude::maybe<block> previous = Prelude::nothing<block>();
+    juniper::shared_ptr<Prelude::maybe<block>> state(&previous, juniper::static_storage);
+    TEST_ASSERT_EQUAL(0, (Signal::dropRepeats<block>(Prelude::signal<block>(Prelude::just<block>(withTail<uint16_t, 8>(3, 5, 0))), state).signal.tag));
+    TEST_ASSERT_EQUAL(1, (Signal::dropRepeats<block>(Prelude::signal<block>(Prelude::just<block>(withTail<uint16_t, 8>(3, 5, 7))), state).signal.tag));
+    TEST_ASSERT_EQUAL(0, (Signal::dropRepeats<block>(Prelude::signal<block>(Prelude::just<block>(withTail<uint16_t, 8>(4, 5, 7))), state).signal.tag));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sum_does_not_overflow);
+    RUN_TEST(test_const_algorithms_match_runtime);
+    RUN_TEST(test_equality_ignores_dead_tails);
+    RUN_TEST(test_equality_compares_live_elements);
+    RUN_TEST(test_member_only_searches_live_elements);
+    RUN_TEST(test_drop_repeats_sees_through_dead_tails);
+    return UNITY_END();
+}
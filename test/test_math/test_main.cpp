@@ -0,0 +1,173 @@
+// Native tests for the Math module and juniper::fixed: accuracy of the
+// table-driven fixed point functions against libm, fixed point conversion
+// and Vector arithmetic, and throughput of each next to double.
+// Run with: pio test -e native -f test_math
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <chrono>
+
+typedef juniper::fixed<int16_t, 15> q15;
+typedef juniper::fixed<int32_t, 16> q16;
+
+// Whether From converts implicitly to To.
+template<typename From, typename To>
+struct converts
+{
+    static char test(To);
+    static long test(...);
+    static const bool value = sizeof(test(*(From *) 0)) == sizeof(char);
+};
+
+static_assert(converts<int, q16>::value && converts<double, q16>::value, "");
+static_assert(!converts<q15, q16>::value && !converts<q16, q15>::value, "");
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_sin_cos_error(void) {
+    double worst = 0;
+    for (uint32_t a = 0; a < 65536; a++) {
+        double r = a * 2 * M_PI / 65536;
+        worst = fmax(worst, fabs(Math::sinQ15(a) / 32767.0 - sin(r)));
+        worst = fmax(worst, fabs(Math::cosQ15(a) / 32767.0 - cos(r)));
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(2e-4, worst);
+    TEST_ASSERT_EQUAL_INT16(0, Math::sinQ15(0));
+    TEST_ASSERT_EQUAL_INT16(32767, Math::sinQ15(0x4000));
+    TEST_ASSERT_EQUAL_INT16(-32767, Math::sinQ15(0xC000));
+}
+
+void test_log_error(void) {
+    double worst = 0;
+    for (uint32_t x = 1; x < 4000000000UL; x += 9973) {
+        worst = fmax(worst, fabs(Math::log2Q16(x) / 65536.0 - log2(x / 65536.0)));
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(3e-4, worst);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-3, log(10.0), Math::logQ16(10UL << 16) / 65536.0);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-3, 3.0, Math::log10Q16(1000UL << 16) / 65536.0);
+}
+
+void test_exp_pow_error(void) {
+    double worst = 0;
+    for (int32_t x = -20 * 65536L; x < 16 * 65536L; x += 37) {
+        double expected = exp2(x / 65536.0);
+        if (expected > 0.01) {
+            worst = fmax(worst, fabs(Math::exp2Q16(x) / 65536.0 / expected - 1));
+        }
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(2e-3, worst);
+    TEST_ASSERT_EQUAL_UINT32(0x80000000UL, Math::exp2Q16(15L << 16));
+    TEST_ASSERT_EQUAL_UINT32(0x80000000UL, Math::powQ16(2UL << 16, 15L << 16));
+    TEST_ASSERT_TRUE(Math::exp2Q16((15L << 16) + 0xFFFF) > 0xFF000000UL);
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFUL, Math::exp2Q16(16L << 16));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-3, sqrt(2.0), Math::powQ16(2UL << 16, 32768) / 65536.0);
+}
+
+void test_sqrt_exact(void) {
+    for (uint32_t x = 0; x < 4000000000UL; x += 7919) {
+        uint64_t r = Math::sqrtQ16(x);
+        uint64_t v = (uint64_t) x << 16;
+        TEST_ASSERT_TRUE(r * r <= v && (r + 1) * (r + 1) > v);
+    }
+}
+
+void test_fixed_conversion_saturates(void) {
+    TEST_ASSERT_EQUAL_INT16(32767, q15(1).raw);
+    TEST_ASSERT_EQUAL_INT16(-32768, q15(-1).raw);
+    TEST_ASSERT_EQUAL_INT16(32767, q15(70000L).raw);
+    TEST_ASSERT_EQUAL_INT16(32767, q15(4000000000UL).raw);
+    TEST_ASSERT_EQUAL_INT16(-32768, q15(-2147483647L).raw);
+    TEST_ASSERT_EQUAL_INT32(2147483647L, q16(100000L).raw);
+    TEST_ASSERT_EQUAL_INT32(2147483647L, q16(4000000000UL).raw);
+    TEST_ASSERT_EQUAL_INT32(-2147483647L - 1, q16(-1e300).raw);
+    TEST_ASSERT_EQUAL_INT32(2147483647L, q16(1e300).raw);
+    TEST_ASSERT_EQUAL_INT32(0, q16(NAN).raw);
+    TEST_ASSERT_EQUAL_INT32(-81920L, q16(-1.25).raw);
+    TEST_ASSERT_EQUAL_INT16(16384, q15(0.5f).raw);
+}
+
+void test_fixed_arithmetic_saturates(void) {
+    TEST_ASSERT_EQUAL_INT32(2147483647L, (q16(30000) * q16(30000)).raw);
+    TEST_ASSERT_EQUAL_INT32(-2147483647L - 1, (q16(-30000) - q16(30000)).raw);
+    TEST_ASSERT_EQUAL_INT32(2147483647L, (q16(1) / q16(0)).raw);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 50.0, (Math::mapRange<int32_t, 16>(q16(5), 0, 10, 0, 100).toDouble()));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-3, sqrt(2.0), juniper::sqrt(q16(2)).toDouble());
+}
+
+void test_dot_accumulates_wide(void) {
+    // Partial sums leave the element range, the results do not.
+    Vector::vector<q15, 3> a = Vector::make<q15, 3>(juniper::array<q15, 3>{ { q15(0.9), q15(0.9), q15(0.9) } });
+    Vector::vector<q15, 3> b = Vector::make<q15, 3>(juniper::array<q15, 3>{ { q15(0.9), q15(0.9), q15(-0.9) } });
+    TEST_ASSERT_DOUBLE_WITHIN(1e-3, 0.81, (Vector::dot<q15, 3>(a, b).toDouble()));
+
+    Vector::vector<int16_t, 2> i = Vector::make<int16_t, 2>(juniper::array<int16_t, 2>{ { 30000, -30000 } });
+    TEST_ASSERT_EQUAL_INT32(1800000000L, (Vector::magnitude2<int16_t, 2>(i)));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, 30000 * sqrt(2.0), (Vector::magnitude<int16_t, 2>(i)));
+
+    Vector::vector<uint8_t, 2> u = Vector::make<uint8_t, 2>(juniper::array<uint8_t, 2>{ { 255, 3 } });
+    TEST_ASSERT_EQUAL_UINT32(255UL * 255 + 9, (Vector::dot<uint8_t, 2>(u, u)));
+}
+
+void test_normalize(void) {
+    Vector::vector<q16, 3> v = Vector::make<q16, 3>(juniper::array<q16, 3>{ { q16(3), q16(4), q16(12) } });
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 13.0, (Vector::magnitude<q16, 3>(v).toDouble()));
+    Vector::vector<q16, 3> n = Vector::normalize<q16, 3>(v);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 3.0 / 13, n.data[0].toDouble());
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 4.0 / 13, n.data[1].toDouble());
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 12.0 / 13, n.data[2].toDouble());
+}
+
+template<typename F>
+static double nanosPerCall(F f, uint32_t n) {
+    volatile int64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n; i++) {
+        sink += f(i);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    (void) sink;
+    return std::chrono::duration<double, std::nano>(stop - start).count() / n;
+}
+
+void test_throughput(void) {
+    const uint32_t n = 1000000;
+    char line[160];
+    snprintf(line, sizeof(line), "sin: table %.1f ns, libm %.1f ns",
+        nanosPerCall([](uint32_t i) { return (int64_t) Math::sinQ15((uint16_t) (i * 40503UL)); }, n),
+        nanosPerCall([](uint32_t i) { return (int64_t) (32767 * sin(i * 0.0001)); }, n));
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "log2: table %.1f ns, libm %.1f ns",
+        nanosPerCall([](uint32_t i) { return (int64_t) Math::log2Q16(i * 4093UL + 1); }, n),
+        nanosPerCall([](uint32_t i) { return (int64_t) (65536 * log2((i * 4093.0 + 1) / 65536)); }, n));
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "sqrt: bitwise %.1f ns, libm %.1f ns",
+        nanosPerCall([](uint32_t i) { return (int64_t) Math::sqrtQ16(i * 4093UL); }, n),
+        nanosPerCall([](uint32_t i) { return (int64_t) (65536 * sqrt(i * 4093.0 / 65536)); }, n));
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "normalize: Q16.16 %.1f ns, double %.1f ns",
+        nanosPerCall([](uint32_t i) {
+            Vector::vector<q16, 3> v = Vector::make<q16, 3>(juniper::array<q16, 3>{ { q16::fromRaw(i), q16(4), q16(12) } });
+            return (int64_t) Vector::normalize<q16, 3>(v).data[0].raw;
+        }, n),
+        nanosPerCall([](uint32_t i) {
+            Vector::vector<double, 3> v = Vector::make<double, 3>(juniper::array<double, 3>{ { i / 65536.0, 4, 12 } });
+            return (int64_t) (65536 * Vector::normalize<double, 3>(v).data[0]);
+        }, n));
+    TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sin_cos_error);
+    RUN_TEST(test_log_error);
+    RUN_TEST(test_exp_pow_error);
+    RUN_TEST(test_sqrt_exact);
+    RUN_TEST(test_fixed_conversion_saturates);
+    RUN_TEST(test_fixed_arithmetic_saturates);
+    RUN_TEST(test_dot_accumulates_wide);
+    RUN_TEST(test_normalize);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
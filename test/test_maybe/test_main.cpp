@@ -0,0 +1,74 @@
+// Native tests for maybe and sig stored in their value's niche: just and
+// nothing must survive a round trip and compare as before.
+// Run with: pio test -e native -f test_maybe
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static_assert(sizeof(Prelude::maybe<uint16_t>) == 2 * sizeof(uint16_t), "maybe<uint16_t> keeps its own tag");
+
+template<typename T>
+static void assertRoundTrip(T value) {
+    Prelude::maybe<T> present = Prelude::just<T>(value);
+    TEST_ASSERT_EQUAL(0, present.tag);
+    TEST_ASSERT_TRUE(present.just == value);
+    Prelude::maybe<T> absent = Prelude::nothing<T>();
+    TEST_ASSERT_EQUAL(1, absent.tag);
+    TEST_ASSERT_TRUE(present != absent);
+    TEST_ASSERT_TRUE(absent == Prelude::nothing<T>());
+
+    // Copies keep their tag, and overwriting one flips it both ways.
+    Prelude::maybe<T> copy = present;
+    TEST_ASSERT_EQUAL(0, copy.tag);
+    copy = absent;
+    TEST_ASSERT_EQUAL(1, copy.tag);
+    copy = present;
+    TEST_ASSERT_EQUAL(0, copy.tag);
+    TEST_ASSERT_TRUE(copy == present);
+
+    Prelude::sig<T> sig = Prelude::signal<T>(present);
+    TEST_ASSERT_EQUAL(0, sig.signal.tag);
+    TEST_ASSERT_TRUE(sig.signal.just == value);
+    TEST_ASSERT_EQUAL(1, Prelude::signal<T>(absent).signal.tag);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_unit_round_trips(void) {
+    assertRoundTrip<Prelude::unit>(Prelude::unit());
+}
+
+void test_bool_round_trips(void) {
+    assertRoundTrip<bool>(false);
+    assertRoundTrip<bool>(true);
+    TEST_ASSERT_TRUE(Prelude::just<bool>(false) != Prelude::just<bool>(true));
+}
+
+void test_pin_state_round_trips(void) {
+    assertRoundTrip<Io::pinState>(Io::high());
+    assertRoundTrip<Io::pinState>(Io::low());
+    TEST_ASSERT_TRUE(Prelude::just<Io::pinState>(Io::high()) != Prelude::just<Io::pinState>(Io::low()));
+}
+
+void test_combinators_see_the_niche_tag(void) {
+    Prelude::sig<Io::pinState> high = Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(Io::high()));
+    Prelude::sig<Io::pinState> none = Prelude::signal<Io::pinState>(Prelude::nothing<Io::pinState>());
+    juniper::function<bool(Io::pinState)> isHigh([](Io::pinState p) { return Io::pinStateToInt(p) != 0; });
+    // filter drops the values its predicate holds for.
+    TEST_ASSERT_EQUAL(1, (Signal::filter<Io::pinState>(isHigh, high).signal.tag));
+    TEST_ASSERT_EQUAL(0, (Signal::filter<Io::pinState>(isHigh, Prelude::signal<Io::pinState>(Prelude::just<Io::pinState>(Io::low()))).signal.tag));
+    TEST_ASSERT_EQUAL(1, (Signal::filter<Io::pinState>(isHigh, none).signal.tag));
+    Prelude::sig<Prelude::unit> unitSig = Signal::toUnit<Io::pinState>(high);
+    TEST_ASSERT_EQUAL(0, unitSig.signal.tag);
+    TEST_ASSERT_EQUAL(1, (Signal::toUnit<Io::pinState>(none).signal.tag));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_unit_round_trips);
+    RUN_TEST(test_bool_round_trips);
+    RUN_TEST(test_pin_state_round_trips);
+    RUN_TEST(test_combinators_see_the_niche_tag);
+    return UNITY_END();
+}
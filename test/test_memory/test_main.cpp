@@ -0,0 +1,151 @@
+// Native tests for the runtime's heap accounting and the stack high-water
+// mark (JUNIPER_TRACK_MEMORY), against small configured budgets.
+// Run with: pio test -e native -f test_memory
+#define JUNIPER_HOST_TEST
+#define JUNIPER_TRACK_MEMORY
+#define JUNIPER_HEAP_BUDGET 512
+#define JUNIPER_STACK_BUDGET 16384
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <sys/wait.h>
+#include <vector>
+
+typedef std::vector<juniper::function<uint16_t(uint16_t)>> pipeline;
+
+// A pipeline of depth stages, each closure holding a 64 byte table for as
+// long as the pipeline lives.
+static pipeline stages(int depth) {
+    pipeline p;
+    for (int i = 0; i < depth; i++) {
+        juniper::array<uint16_t, 32> table;
+        table.fill((uint16_t) 1);
+        p.push_back(juniper::function<uint16_t(uint16_t)>([=](uint16_t x) mutable -> uint16_t { return x + table[x % 32]; }));
+    }
+    return p;
+}
+
+static Prelude::sig<uint16_t> run(const pipeline &p, uint16_t value) {
+    Prelude::sig<uint16_t> s = Prelude::signal<uint16_t>(Prelude::just<uint16_t>(value));
+    for (size_t i = 0; i < p.size(); i++) {
+        s = Signal::map<uint16_t, uint16_t>(p[i], s);
+    }
+    return s;
+}
+
+// Runs passes of the sketch's memory check in a child, which reports and
+// exits 1 once the budget is exceeded; returns the child's exit status.
+static int checkMemoryExitStatus(int depth) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        pipeline p = stages(depth);
+        for (int pass = 0; pass < 1024; pass++) {
+            run(p, (uint16_t) pass);
+            SoundBar::checkMemory();
+        }
+        _exit(0);
+    }
+    int status = 0;
+    TEST_ASSERT_EQUAL(child, waitpid(child, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_function_closures_are_counted(void) {
+    juniper::memory_stats before = juniper::memoryStats();
+    {
+        uint32_t offset = 3;
+        juniper::function<uint32_t(uint32_t)> f([=](uint32_t x) { return x + offset; });
+        TEST_ASSERT_EQUAL_UINT32(before.liveAllocations + 1, juniper::memoryStats().liveAllocations);
+        TEST_ASSERT_TRUE(juniper::memoryStats().liveBytes > before.liveBytes);
+        juniper::function<uint32_t(uint32_t)> g = f;
+        TEST_ASSERT_EQUAL_UINT32(before.liveAllocations + 2, juniper::memoryStats().liveAllocations);
+        TEST_ASSERT_EQUAL_UINT32(8, g(5));
+    }
+    TEST_ASSERT_EQUAL_UINT32(before.liveAllocations, juniper::memoryStats().liveAllocations);
+    TEST_ASSERT_EQUAL_UINT32(before.liveBytes, juniper::memoryStats().liveBytes);
+    TEST_ASSERT_EQUAL_UINT32(before.totalAllocations + 2, juniper::memoryStats().totalAllocations);
+}
+
+void test_shared_ptr_is_counted_once(void) {
+    juniper::memory_stats before = juniper::memoryStats();
+    {
+        juniper::shared_ptr<uint32_t> p(new uint32_t(7));
+        juniper::shared_ptr<uint32_t> q = p;
+        TEST_ASSERT_EQUAL_UINT32(before.liveAllocations + 1, juniper::memoryStats().liveAllocations);
+        TEST_ASSERT_EQUAL_UINT32(before.liveBytes + sizeof(uint32_t) + sizeof(int), juniper::memoryStats().liveBytes);
+        TEST_ASSERT_TRUE(juniper::memoryStats().peakBytes >= juniper::memoryStats().liveBytes);
+    }
+    TEST_ASSERT_EQUAL_UINT32(before.liveBytes, juniper::memoryStats().liveBytes);
+
+    // Static storage is never adopted, so it is not counted either.
+    static uint16_t storage = 0;
+    juniper::shared_ptr<uint16_t> s(&storage, juniper::static_storage);
+    TEST_ASSERT_EQUAL_UINT32(before.liveAllocations, juniper::memoryStats().liveAllocations);
+}
+
+__attribute__((noinline)) static uint32_t useStack(uint32_t bytes) {
+    volatile uint8_t buf[32768];
+    for (uint32_t i = 0; i < bytes && i < sizeof(buf); i++) {
+        buf[sizeof(buf) - 1 - i] = (uint8_t) i;
+    }
+    return buf[sizeof(buf) - 1];
+}
+
+void test_stack_high_water(void) {
+    Io::paintStack();
+    uint32_t idle = Io::stackHighWater();
+    useStack(8192);
+    uint32_t deep = Io::stackHighWater();
+    TEST_ASSERT_GREATER_OR_EQUAL(idle + 8192, deep);
+    TEST_ASSERT_LESS_THAN(JUNIPER_STACK_PAINT_BYTES, deep);
+    TEST_ASSERT_EQUAL_UINT32(deep, Io::memory().stackHighWater);
+    TEST_ASSERT_TRUE(Io::withinMemoryBudget(Io::memory()));
+}
+
+void test_stack_past_the_budget_is_reported(void) {
+    Io::paintStack();
+    useStack(JUNIPER_STACK_BUDGET / 2);
+    TEST_ASSERT_TRUE(Io::withinMemoryBudget(Io::memory()));
+    useStack(JUNIPER_STACK_BUDGET + 1024);
+    TEST_ASSERT_FALSE(Io::withinMemoryBudget(Io::memory()));
+    Io::paintStack();
+    TEST_ASSERT_TRUE(Io::withinMemoryBudget(Io::memory()));
+}
+
+void test_sketch_pipeline_stays_within_budget(void) {
+    SoundBar::setupInstance<8>(SoundBar::bar);
+    for (int pass = 0; pass < 1024; pass++) {
+        host::pinState().digital[SoundBar::microphonePin] = (pass % 3) ? HIGH : LOW;
+        SoundBar::stepInstance<8>(SoundBar::bar);
+        SoundBar::checkMemory();
+    }
+    TEST_ASSERT_TRUE(Io::withinMemoryBudget(Io::memory()));
+    TEST_ASSERT_EQUAL(0, checkMemoryExitStatus(2));
+}
+
+// Last, since the heap peak it leaves behind cannot be taken back.
+void test_heap_past_the_budget_is_reported(void) {
+    TEST_ASSERT_EQUAL(1, checkMemoryExitStatus(16));
+    {
+        pipeline p = stages(16);
+        TEST_ASSERT_EQUAL_UINT16(16, run(p, 0).signal.just);
+        TEST_ASSERT_TRUE(juniper::memoryStats().liveBytes > JUNIPER_HEAP_BUDGET);
+    }
+    TEST_ASSERT_FALSE(Io::withinMemoryBudget(Io::memory()));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_function_closures_are_counted);
+    RUN_TEST(test_shared_ptr_is_counted_once);
+    RUN_TEST(test_stack_high_water);
+    RUN_TEST(test_stack_past_the_budget_is_reported);
+    RUN_TEST(test_sketch_pipeline_stays_within_budget);
+    RUN_TEST(test_heap_past_the_budget_is_reported);
+    return UNITY_END();
+}
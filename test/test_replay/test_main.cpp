@@ -0,0 +1,137 @@
+// Native tests for deterministic replay: the bar digest must be stable
+// for a given pipeline and must move when the pipeline's output does.
+// Run with: pio test -e native -f test_replay
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <vector>
+
+// A microphone on pin 15 that is low for a varying share of every 64
+// samples, so the bar keeps rising and falling.
+static std::vector<host::trace_sample> micTrace(size_t n) {
+    std::vector<host::trace_sample> trace(n);
+    for (size_t i = 0; i < n; i++) {
+        size_t period = i / 64;
+        host::trace_sample s = { (uint32_t) (1000 + 50 * i), (uint16_t) ((i % 64) < (period * 13) % 64 ? 0 : 1), 15, 0 };
+        trace[i] = s;
+    }
+    return trace;
+}
+
+typedef void (*step_fn)(SoundBar::instance<8> &self);
+
+static uint64_t replayDigest(const std::vector<host::trace_sample> &trace, step_fn step) {
+    host::trace_block block = { trace.data(), trace.size() };
+    host::startSegment(block);
+    SoundBar::instance<8> bar = SoundBar::makeInstance<8>(SoundBar::microphonePin, SoundBar::barPins.data, Io::digWrite);
+    SoundBar::setupInstance<8>(bar);
+    while (!host::replayState().done) {
+        step(bar);
+    }
+    return host::replayState().digest;
+}
+
+static void sketchStep(SoundBar::instance<8> &self) {
+    SoundBar::stepInstance<8>(self);
+}
+
+// The sketch's digital pipeline with the envelope's release as a parameter.
+template<int release>
+static void releaseStep(SoundBar::instance<8> &self) {
+    SoundBar::resetBar<8>(self);
+    juniper::shared_ptr<uint16_t> state(&self.envelope, juniper::static_storage);
+    Prelude::sig<uint16_t> level = Signal::map<Io::pinState, uint16_t>(
+        juniper::function<uint16_t(Io::pinState)>([](Io::pinState p) -> uint16_t { return (Io::pinStateToInt(p) == 0) ? 7 : 0; }),
+        Io::digIn(self.microphonePin));
+    Prelude::sig<uint16_t> smoothed = Signal::envelope<SOUNDBAR_ATTACK, release, 7>(level, state);
+    if (smoothed.signal.tag == 0) {
+        SoundBar::drawBar<8>(self, smoothed.signal.just);
+    }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_digest_is_deterministic(void) {
+    std::vector<host::trace_sample> trace = micTrace(20000);
+    uint64_t first = replayDigest(trace, sketchStep);
+    TEST_ASSERT_NOT_EQUAL(host::digestSeed, first);
+    TEST_ASSERT_EQUAL_HEX64(first, replayDigest(trace, sketchStep));
+    TEST_ASSERT_EQUAL_HEX64(first, replayDigest(trace, releaseStep<SOUNDBAR_RELEASE>));
+}
+
+void test_smoothing_change_moves_digest(void) {
+    std::vector<host::trace_sample> trace = micTrace(20000);
+    uint64_t sketch = replayDigest(trace, sketchStep);
+    TEST_ASSERT_NOT_EQUAL(sketch, replayDigest(trace, releaseStep<SOUNDBAR_RELEASE + 1>));
+    TEST_ASSERT_NOT_EQUAL(sketch, replayDigest(trace, releaseStep<SOUNDBAR_RELEASE - 1>));
+}
+
+void test_input_change_moves_digest(void) {
+    std::vector<host::trace_sample> trace = micTrace(20000);
+    uint64_t sketch = replayDigest(trace, sketchStep);
+    // A single low sample while the microphone is high makes the bar jump.
+    size_t i = 10000;
+    while (trace[i].value == 0) {
+        i++;
+    }
+    trace[i].value = 0;
+    TEST_ASSERT_NOT_EQUAL(sketch, replayDigest(trace, sketchStep));
+}
+
+// The microphone trace with a record of another pin before every sample.
+static std::vector<host::trace_sample> withForeignPin(const std::vector<host::trace_sample> &trace, uint8_t pin, uint16_t value) {
+    std::vector<host::trace_sample> mixed;
+    for (size_t i = 0; i < trace.size(); i++) {
+        host::trace_sample other = { trace[i].micros - 25, (uint16_t) (value ^ (i & 1)), pin, 0 };
+        mixed.push_back(other);
+        mixed.push_back(trace[i]);
+    }
+    return mixed;
+}
+
+void test_unread_pins_are_skipped(void) {
+    std::vector<host::trace_sample> trace = micTrace(20000);
+    uint64_t mixed = replayDigest(withForeignPin(trace, 3, 0), sketchStep);
+    TEST_ASSERT_TRUE(host::replayState().done);
+    TEST_ASSERT_EQUAL_UINT64(trace.size(), host::replayState().skipped);
+    // Neither the pin nor the values of the skipped records matter.
+    TEST_ASSERT_EQUAL_HEX64(mixed, replayDigest(withForeignPin(trace, 4, 1), sketchStep));
+    TEST_ASSERT_NOT_EQUAL(host::digestSeed, mixed);
+}
+
+static std::vector<uint16_t> timerReads;
+
+static void readOnTimer() {
+    timerReads.push_back((uint16_t) analogRead(15));
+}
+
+void test_a_timer_that_reads_keeps_the_replay_going(void) {
+    std::vector<host::trace_sample> trace = micTrace(500);
+    host::trace_block block = { trace.data(), trace.size() };
+    host::startSegment(block);
+    timerReads.clear();
+    // 125 us periods of a 2 MHz timer clock; nothing else moves the clock.
+    host::startTimer(2000000, 250, readOnTimer);
+    for (int polls = 0; polls < 10000 && !host::replayState().done; polls++) {
+        host::serviceTimer();
+    }
+    host::timerState().handler = NULL;
+    TEST_ASSERT_TRUE(host::replayState().done);
+    // The read that finds the trace used up ends it.
+    TEST_ASSERT_EQUAL(trace.size() + 1, timerReads.size());
+    for (size_t i = 0; i < trace.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT16(trace[i].value, timerReads[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_digest_is_deterministic);
+    RUN_TEST(test_smoothing_change_moves_digest);
+    RUN_TEST(test_input_change_moves_digest);
+    RUN_TEST(test_unread_pins_are_skipped);
+    RUN_TEST(test_a_timer_that_reads_keeps_the_replay_going);
+    return UNITY_END();
+}
@@ -0,0 +1,59 @@
+// Native tests for the fixed-rate sampling clock (JUNIPER_SAMPLE_TIMER),
+// driven by the host's simulated Timer1.
+// Run with: pio test -e native -f test_sampling
+#define JUNIPER_HOST_TEST
+#define JUNIPER_SAMPLE_TIMER
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static const uint16_t micPin = 14;
+
+void setUp(void) {
+    host::useFakeClock(1000);
+    uint16_t value;
+    while (Time::sampleQueue.pop(value)) {
+    }
+}
+
+void tearDown(void) {}
+
+void test_rate_is_the_nearest_the_timer_can_run(void) {
+    Time::startSampling(micPin, 8000);
+    TEST_ASSERT_DOUBLE_WITHIN(0.01, 8000.0, Time::sampleRate());
+    Time::startSampling(micPin, 7);
+    TEST_ASSERT_DOUBLE_WITHIN(0.01, 7.0, Time::sampleRate());
+    // A rate of zero is taken as 1 Hz.
+    Time::startSampling(micPin, 0);
+    TEST_ASSERT_DOUBLE_WITHIN(0.01, 1.0, Time::sampleRate());
+}
+
+void test_samples_keep_the_timer_schedule(void) {
+    Time::startSampling(micPin, 8000);
+    for (uint16_t i = 0; i < 40; i++) {
+        host::pinState().analog[micPin] = i;
+        host::advanceMicros(125);
+        Prelude::sig<uint16_t> sample = Time::sampleIn();
+        TEST_ASSERT_EQUAL(0, sample.signal.tag);
+        TEST_ASSERT_EQUAL_UINT16(i, sample.signal.just);
+    }
+    TEST_ASSERT_EQUAL(1, Time::sampleIn().signal.tag);
+    TEST_ASSERT_EQUAL_UINT32(40, Time::samplesTakenCount());
+    TEST_ASSERT_EQUAL_UINT32(0, Time::samplesMissedCount());
+}
+
+void test_a_slow_consumer_counts_what_it_missed(void) {
+    Time::startSampling(micPin, 8000);
+    // 100 periods without taking any: the queue keeps all but one slot's worth.
+    host::advanceMicros(100 * 125);
+    Time::sampleIn();
+    TEST_ASSERT_EQUAL_UINT32(100, Time::samplesTakenCount());
+    TEST_ASSERT_EQUAL_UINT32(100 - (JUNIPER_SAMPLE_EVENTS - 1), Time::samplesMissedCount());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_rate_is_the_nearest_the_timer_can_run);
+    RUN_TEST(test_samples_keep_the_timer_schedule);
+    RUN_TEST(test_a_slow_consumer_counts_what_it_missed);
+    return UNITY_END();
+}
@@ -0,0 +1,208 @@
+// Native tests for the serial TX queue in Io: serialWrite, reserveTx and
+// the txDrop/txBlock policies, driven against the host's simulated UART on
+// the fake clock, with everything that reaches the wire read back from
+// stdout.
+// Run with: pio test -e native -f test_serial
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+#include <stdio.h>
+#include <unistd.h>
+
+// 960 bytes a second, so one byte leaves the UART every 1041 us.
+static const uint32_t baud = 9600;
+static const uint64_t byteMicros = 1000000ULL / (baud / 10);
+
+static int savedStdout = -1;
+static FILE *wireFile = NULL;
+
+// Sends stdout, and so the wire, to a temporary file until stopWire.
+// Nothing may be asserted in between, since Unity reports on stdout too.
+static void startWire() {
+    fflush(stdout);
+    wireFile = tmpfile();
+    savedStdout = dup(1);
+    dup2(fileno(wireFile), 1);
+}
+
+// Restores stdout and returns how many bytes reached the wire, copying up
+// to size of them into buf.
+static size_t stopWire(uint8_t *buf, size_t size) {
+    if (savedStdout < 0) {
+        return 0;
+    }
+    fflush(stdout);
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    savedStdout = -1;
+    long bytes = ftell(wireFile);
+    rewind(wireFile);
+    size_t read = fread(buf, 1, size, wireFile);
+    fclose(wireFile);
+    wireFile = NULL;
+    (void) read;
+    return (size_t) bytes;
+}
+
+void setUp(void) {
+    host::useFakeClock(1000);
+    host::simulateUart(baud);
+    host::uartState().bytesWritten = 0;
+    uint8_t byte;
+    while (Io::serialTx.pop(byte)) {
+    }
+    Io::serialDropped = 0;
+    Io::telemetryDropped = 0;
+    Io::setTxPolicy(Io::txDrop());
+}
+
+void tearDown(void) {
+    uint8_t ignored;
+    stopWire(&ignored, 0);
+    host::simulateUart(0);
+}
+
+void test_drop_keeps_what_fits_and_counts_the_rest(void) {
+    uint8_t out[300];
+    for (int i = 0; i < 300; i++) {
+        out[i] = (uint8_t) i;
+    }
+    startWire();
+    size_t written = Io::serialWrite(out, sizeof(out));
+    uint64_t afterWrite = host::nowMicros();
+    Io::setTxPolicy(Io::txBlock());
+    Io::flushSerial();
+    // Once the queue drains, writes are accepted again.
+    Io::setTxPolicy(Io::txDrop());
+    size_t again = Io::serialWrite(out, 4);
+    Io::flushSerial();
+    uint8_t wire[300];
+    size_t sent = stopWire(wire, sizeof(wire));
+    // The queue keeps one slot open, and a full queue never waits.
+    TEST_ASSERT_EQUAL_UINT32(JUNIPER_SERIAL_TX_BYTES - 1, written);
+    TEST_ASSERT_EQUAL_UINT32(300 - (JUNIPER_SERIAL_TX_BYTES - 1), Io::serialDropped);
+    TEST_ASSERT_EQUAL_UINT64(1000, afterWrite);
+    // What was accepted goes out as the leading bytes, in order.
+    TEST_ASSERT_EQUAL_UINT32(written + 4, sent);
+    for (size_t i = 0; i < written; i++) {
+        TEST_ASSERT_EQUAL_UINT8(out[i], wire[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(4, again);
+    TEST_ASSERT_EQUAL_UINT32(300 - (JUNIPER_SERIAL_TX_BYTES - 1), Io::serialDropped);
+}
+
+void test_block_waits_until_the_queue_drains(void) {
+    uint8_t out[400];
+    for (int i = 0; i < 400; i++) {
+        out[i] = (uint8_t) (i * 7);
+    }
+    Io::setTxPolicy(Io::txBlock());
+    startWire();
+    size_t written = Io::serialWrite(out, sizeof(out));
+    uint64_t waited = host::nowMicros() - 1000;
+    uint64_t onWire = host::uartState().bytesWritten;
+    Io::flushSerial();
+    uint8_t wire[400];
+    size_t sent = stopWire(wire, sizeof(wire));
+    TEST_ASSERT_EQUAL_UINT32(400, written);
+    TEST_ASSERT_EQUAL_UINT32(0, Io::serialDropped);
+    // Only the bytes past the TX queue and the UART's own buffer had to
+    // wait for the line, one byte time each.
+    uint64_t queued = (JUNIPER_SERIAL_TX_BYTES - 1) + 64;
+    TEST_ASSERT_TRUE(onWire >= 400 - queued);
+    TEST_ASSERT_TRUE(waited >= (400 - queued - 1) * byteMicros);
+    TEST_ASSERT_TRUE(waited <= (400 - 64 + 1) * byteMicros);
+    TEST_ASSERT_EQUAL_UINT32(400, sent);
+    for (size_t i = 0; i < sent; i++) {
+        TEST_ASSERT_EQUAL_UINT8(out[i], wire[i]);
+    }
+}
+
+void test_reserve_tx(void) {
+    // More than the queue can ever hold is refused under either policy,
+    // rather than waiting forever.
+    TEST_ASSERT_FALSE(Io::reserveTx(JUNIPER_SERIAL_TX_BYTES));
+    Io::setTxPolicy(Io::txBlock());
+    TEST_ASSERT_FALSE(Io::reserveTx(JUNIPER_SERIAL_TX_BYTES));
+    TEST_ASSERT_TRUE(Io::reserveTx(JUNIPER_SERIAL_TX_BYTES - 1));
+    // Fill the queue without servicing it.
+    while (Io::serialTx.free() > 0) {
+        Io::serialTx.push('x');
+    }
+    Io::setTxPolicy(Io::txDrop());
+    TEST_ASSERT_FALSE(Io::reserveTx(1));
+    TEST_ASSERT_EQUAL_UINT64(1000, host::nowMicros());
+    Io::setTxPolicy(Io::txBlock());
+    startWire();
+    bool reserved = Io::reserveTx(100);
+    uint64_t waited = host::nowMicros() - 1000;
+    size_t free = Io::serialTx.free();
+    Io::flushSerial();
+    uint8_t wire[1];
+    stopWire(wire, sizeof(wire));
+    TEST_ASSERT_TRUE(reserved);
+    TEST_ASSERT_TRUE(free >= 100);
+    // The first 64 bytes fill the idle UART at once, the rest wait on it.
+    TEST_ASSERT_TRUE(waited >= (100 - 64 - 1) * byteMicros);
+    TEST_ASSERT_EQUAL_UINT32(0, Io::serialDropped);
+}
+
+void test_no_partial_frames_reach_the_wire(void) {
+    // Counter frames offered far faster than the line carries them, with
+    // the queue serviced between frames as the loop does.
+    startWire();
+    uint32_t offered = 0;
+    for (uint32_t i = 0; i < 2000; i++) {
+        Io::telemetryCounter(juniper::telemetry::passes, i);
+        offered++;
+        Io::serviceSerial();
+        host::advanceMicros(byteMicros * 3);
+    }
+    Io::flushSerial();
+    static uint8_t wire[2000 * 9];
+    size_t sent = stopWire(wire, sizeof(wire));
+    TEST_ASSERT_TRUE(Io::telemetryDropped > 0);
+    TEST_ASSERT_TRUE(Io::telemetryDropped < offered);
+    TEST_ASSERT_EQUAL_UINT32(0, Io::serialDropped);
+    TEST_ASSERT_EQUAL_UINT32((offered - Io::telemetryDropped) * 9, sent);
+    juniper::telemetry::decoder rx;
+    uint32_t last = 0;
+    for (size_t i = 0; i < sent; i++) {
+        if (rx.feed(wire[i])) {
+            uint32_t value = rx.u32(1);
+            TEST_ASSERT_TRUE(rx.frames == 1 || value > last);
+            last = value;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(offered - Io::telemetryDropped, rx.frames);
+    TEST_ASSERT_EQUAL_UINT32(0, rx.errors);
+}
+
+void test_print_str_stops_at_the_terminator(void) {
+    Prelude::string<8> str;
+    str.characters.length = 8;
+    memcpy(str.characters.data.data, "bar\0junk", 8);
+    Prelude::string<3> full;
+    full.characters.length = 3;
+    memcpy(full.characters.data.data, "abc", 3);
+    startWire();
+    Io::printStr<8>(str);
+    Io::printStr<3>(full);
+    Io::flushSerial();
+    uint8_t wire[16];
+    size_t sent = stopWire(wire, sizeof(wire));
+    TEST_ASSERT_EQUAL_UINT32(6, sent);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(wire, "barabc", 6));
+    TEST_ASSERT_EQUAL_UINT32(0, Io::serialDropped);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_drop_keeps_what_fits_and_counts_the_rest);
+    RUN_TEST(test_block_waits_until_the_queue_drains);
+    RUN_TEST(test_reserve_tx);
+    RUN_TEST(test_no_partial_frames_reach_the_wire);
+    RUN_TEST(test_print_str_stops_at_the_terminator);
+    return UNITY_END();
+}
@@ -0,0 +1,132 @@
+// Native tests for the binary telemetry link: frames written by the Io
+// senders must come back out of juniper::telemetry::decoder unchanged.
+// Run with: pio test -e native -f test_telemetry
+#define JUNIPER_HOST_TEST
+#define JUNIPER_TELEMETRY
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static juniper::telemetry::decoder rx;
+
+// Drains the TX queue into the decoder and returns how many frames it
+// completed. The last complete frame stays in rx.
+static uint32_t drain() {
+    uint32_t frames = 0;
+    uint8_t byte;
+    while (Io::serialTx.pop(byte)) {
+        if (rx.feed(byte)) {
+            frames++;
+        }
+    }
+    return frames;
+}
+
+void setUp(void) {
+    rx = juniper::telemetry::decoder();
+    uint8_t byte;
+    while (Io::serialTx.pop(byte)) {
+    }
+    Io::telemetryDropped = 0;
+    Io::setTxPolicy(Io::txDrop());
+}
+
+void tearDown(void) {}
+
+void test_levels_round_trip(void) {
+    Prelude::list<uint16_t, 4> levels = List::replicate<uint16_t, 4>(3, 0);
+    levels.data[0] = 7;
+    levels.data[1] = 0x1234;
+    levels.data[2] = 0xFFFF;
+    TEST_ASSERT_TRUE(Io::telemetryLevels<4>(levels));
+    TEST_ASSERT_EQUAL_UINT32(1, drain());
+    TEST_ASSERT_EQUAL_UINT8(juniper::telemetry::levels, rx.type);
+    TEST_ASSERT_EQUAL_UINT8(6, rx.length);
+    TEST_ASSERT_EQUAL_UINT16(7, rx.u16(0));
+    TEST_ASSERT_EQUAL_UINT16(0x1234, rx.u16(2));
+    TEST_ASSERT_EQUAL_UINT16(0xFFFF, rx.u16(4));
+    TEST_ASSERT_EQUAL_UINT32(0, rx.errors);
+}
+
+void test_counter_round_trip(void) {
+    TEST_ASSERT_TRUE(Io::telemetryCounter(juniper::telemetry::frameDrops, 0xDEADBEEFUL));
+    TEST_ASSERT_EQUAL_UINT32(1, drain());
+    TEST_ASSERT_EQUAL_UINT8(juniper::telemetry::counters, rx.type);
+    TEST_ASSERT_EQUAL_UINT8(5, rx.length);
+    TEST_ASSERT_EQUAL_UINT8(juniper::telemetry::frameDrops, rx.payload[0]);
+    TEST_ASSERT_EQUAL_UINT32(0xDEADBEEFUL, rx.u32(1));
+}
+
+void test_empty_list_sends_empty_frame(void) {
+    TEST_ASSERT_TRUE(Io::telemetryLevels<2>(List::replicate<uint16_t, 2>(0, 0)));
+    TEST_ASSERT_EQUAL_UINT32(1, drain());
+    TEST_ASSERT_EQUAL_UINT8(0, rx.length);
+}
+
+void test_largest_list_goes_out_whole(void) {
+    // The largest capacity telemetryWords accepts for the TX queue.
+    const int most = (JUNIPER_SERIAL_TX_BYTES - 1 - juniper::telemetry::overhead) / 2;
+    Prelude::list<uint16_t, most> words = List::replicate<uint16_t, most>(most, 0);
+    for (int i = 0; i < most; i++) {
+        words.data[i] = (uint16_t) (i * 1000);
+    }
+    TEST_ASSERT_TRUE(Io::telemetryLevels<most>(words));
+    TEST_ASSERT_EQUAL_UINT32(1, drain());
+    TEST_ASSERT_EQUAL_UINT8(2 * most, rx.length);
+    TEST_ASSERT_EQUAL_UINT16((most - 1) * 1000, rx.u16(2 * (most - 1)));
+    TEST_ASSERT_EQUAL_UINT32(0, Io::telemetryDropped);
+}
+
+void test_samples_are_batched(void) {
+    for (uint16_t i = 0; i < JUNIPER_TELEMETRY_SAMPLE_EVERY * JUNIPER_TELEMETRY_SAMPLE_BATCH; i++) {
+        Io::telemetrySample(i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, drain());
+    TEST_ASSERT_EQUAL_UINT8(juniper::telemetry::samples, rx.type);
+    TEST_ASSERT_EQUAL_UINT8(2 * JUNIPER_TELEMETRY_SAMPLE_BATCH, rx.length);
+    TEST_ASSERT_EQUAL_UINT16(JUNIPER_TELEMETRY_SAMPLE_EVERY - 1, rx.u16(0));
+    TEST_ASSERT_EQUAL_UINT16(2 * JUNIPER_TELEMETRY_SAMPLE_EVERY - 1, rx.u16(2));
+}
+
+void test_corruption_is_detected_and_resynced(void) {
+    juniper::ring_buffer<uint8_t, 64> queue;
+    const uint8_t payload[3] = { 1, juniper::telemetry::sync, 3 };
+    TEST_ASSERT_TRUE(juniper::telemetry::write_frame(queue, juniper::telemetry::counters, payload, 3));
+    TEST_ASSERT_TRUE(juniper::telemetry::write_frame(queue, juniper::telemetry::counters, payload, 3));
+    uint8_t bytes[32];
+    size_t n = 0;
+    while (queue.pop(bytes[n])) {
+        n++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(2 * (3 + juniper::telemetry::overhead), n);
+    bytes[4] ^= 0x40;
+    uint32_t frames = 0;
+    for (size_t i = 0; i < n; i++) {
+        frames += rx.feed(bytes[i]) ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, frames);
+    TEST_ASSERT_EQUAL_UINT32(1, rx.errors);
+    TEST_ASSERT_EQUAL_UINT8(juniper::telemetry::sync, rx.payload[1]);
+}
+
+void test_full_queue_drops_whole_frames(void) {
+    Prelude::list<uint16_t, 40> big = List::replicate<uint16_t, 40>(40, 0x5555);
+    uint32_t sent = 0;
+    while (Io::telemetryLevels<40>(big)) {
+        sent++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, Io::telemetryDropped);
+    TEST_ASSERT_EQUAL_UINT32(sent, drain());
+    TEST_ASSERT_EQUAL_UINT32(0, rx.errors);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_levels_round_trip);
+    RUN_TEST(test_counter_round_trip);
+    RUN_TEST(test_empty_list_sends_empty_frame);
+    RUN_TEST(test_largest_list_goes_out_whole);
+    RUN_TEST(test_samples_are_batched);
+    RUN_TEST(test_corruption_is_detected_and_resynced);
+    RUN_TEST(test_full_queue_drops_whole_frames);
+    return UNITY_END();
+}
@@ -0,0 +1,160 @@
+// Native tests for the periodic pulses in Time: pulseAt must keep its
+// deadlines on the interval grid however late it is polled, across the
+// millis() and micros() wrap, and fire only once after a stall.
+// Run with: pio test -e native -f test_time
+#define JUNIPER_HOST_TEST
+#include <unity.h>
+#include "../../src/main.cpp"
+
+static Time::timerState timer;
+
+static juniper::shared_ptr<Time::timerState> fresh() {
+    timer.deadline = 0;
+    timer.armed = false;
+    return juniper::shared_ptr<Time::timerState>(&timer, juniper::static_storage);
+}
+
+static bool pulsed(Prelude::sig<uint32_t> s) {
+    return s.signal.tag == 0;
+}
+
+void setUp(void) {
+    host::useFakeClock(1000);
+}
+
+void tearDown(void) {}
+
+void test_first_poll_only_arms(void) {
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(500, 100, state)));
+    TEST_ASSERT_TRUE(timer.armed);
+    TEST_ASSERT_EQUAL_UINT32(600, timer.deadline);
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(599, 100, state)));
+    Prelude::sig<uint32_t> s = Time::pulseAt(600, 100, state);
+    TEST_ASSERT_TRUE(pulsed(s));
+    TEST_ASSERT_EQUAL_UINT32(600, s.signal.just);
+    TEST_ASSERT_EQUAL_UINT32(700, timer.deadline);
+}
+
+void test_late_polls_do_not_drift(void) {
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    Time::pulseAt(0, 1000, state);
+    uint32_t pulses = 0;
+    uint32_t seed = 1;
+    // Each pulse is polled up to 999 us late, and polls come every 37 us
+    // in between.
+    for (uint32_t k = 1; k <= 5000; k++) {
+        seed = seed * 1664525UL + 1013904223UL;
+        uint32_t due = k * 1000;
+        for (uint32_t t = due - 1000 + 37; t < due; t += 37) {
+            TEST_ASSERT_FALSE(pulsed(Time::pulseAt(t, 1000, state)));
+        }
+        uint32_t late = (seed >> 8) % 1000;
+        Prelude::sig<uint32_t> s = Time::pulseAt(due + late, 1000, state);
+        TEST_ASSERT_TRUE(pulsed(s));
+        TEST_ASSERT_EQUAL_UINT32(due + late, s.signal.just);
+        TEST_ASSERT_EQUAL_UINT32(due + 1000, timer.deadline);
+        pulses++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(5000, pulses);
+}
+
+void test_a_stall_gives_one_pulse_and_restarts(void) {
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    Time::pulseAt(0, 100, state);
+    // Five and a half intervals late: one pulse, no burst to catch up.
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(650, 100, state)));
+    TEST_ASSERT_EQUAL_UINT32(750, timer.deadline);
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(651, 100, state)));
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(749, 100, state)));
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(750, 100, state)));
+    // Exactly one whole interval late already counts as a stall.
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(950, 100, state)));
+    TEST_ASSERT_EQUAL_UINT32(1050, timer.deadline);
+    // Anything less catches up on the grid.
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(1149, 100, state)));
+    TEST_ASSERT_EQUAL_UINT32(1150, timer.deadline);
+}
+
+void test_interval_zero_pulses_on_every_poll(void) {
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(10, 0, state)));
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(10, 0, state)));
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(10, 0, state)));
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(11, 0, state)));
+    TEST_ASSERT_EQUAL_UINT32(11, timer.deadline);
+}
+
+void test_pulse_at_crosses_the_wrap(void) {
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    Time::pulseAt(0xFFFFFF00UL, 0x100, state);
+    TEST_ASSERT_EQUAL_UINT32(0, timer.deadline);
+    // Just before the wrap is still before a deadline of 0.
+    TEST_ASSERT_FALSE(pulsed(Time::pulseAt(0xFFFFFFFFUL, 0x100, state)));
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(0x10, 0x100, state)));
+    TEST_ASSERT_EQUAL_UINT32(0x100, timer.deadline);
+    // A stall across the wrap restarts from the poll.
+    state = fresh();
+    Time::pulseAt(0xFFFFFFF0UL, 0x100, state);
+    TEST_ASSERT_TRUE(pulsed(Time::pulseAt(0x300, 0x100, state)));
+    TEST_ASSERT_EQUAL_UINT32(0x400, timer.deadline);
+}
+
+void test_every_crosses_the_millis_wrap(void) {
+    // 50 ms before millis() wraps, after about 49.7 days.
+    host::useFakeClock((1ULL << 32) * 1000ULL - 50000ULL);
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    Time::every(10, state);
+    uint32_t pulses = 0;
+    uint32_t last = millis();
+    for (int ms = 0; ms < 200; ms++) {
+        host::advanceMicros(1000);
+        Prelude::sig<uint32_t> s = Time::every(10, state);
+        if (pulsed(s)) {
+            TEST_ASSERT_EQUAL_UINT32(10, s.signal.just - last);
+            last = s.signal.just;
+            pulses++;
+        }
+    }
+    TEST_ASSERT_TRUE(millis() < 1000);
+    TEST_ASSERT_EQUAL_UINT32(20, pulses);
+}
+
+void test_every_micros_crosses_the_micros_wrap(void) {
+    // 5 ms before micros() wraps, after about 71.6 minutes.
+    host::useFakeClock((1ULL << 32) - 5000ULL);
+    juniper::shared_ptr<Time::timerState> state = fresh();
+    Time::everyMicros(250, state);
+    uint32_t pulses = 0;
+    uint32_t last = micros();
+    uint32_t elapsed = 0;
+    for (int polls = 0; polls < 1000; polls++) {
+        host::advanceMicros(10 + polls % 7);
+        elapsed += 10 + polls % 7;
+        Prelude::sig<uint32_t> s = Time::everyMicros(250, state);
+        if (pulsed(s)) {
+            // Late by less than a poll, never early.
+            uint32_t step = s.signal.just - last;
+            TEST_ASSERT_TRUE(step >= 250 - 16 && step <= 250 + 16);
+            TEST_ASSERT_TRUE((int32_t) (s.signal.just - (timer.deadline - 250)) >= 0);
+            last = s.signal.just;
+            pulses++;
+        }
+    }
+    TEST_ASSERT_TRUE(micros() < 10000);
+    // The deadline stayed on the grid all the way through.
+    TEST_ASSERT_EQUAL_UINT32((uint32_t) ((1ULL << 32) - 5000ULL + 250ULL * (pulses + 1)), timer.deadline);
+    TEST_ASSERT_EQUAL_UINT32(elapsed / 250, pulses);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_poll_only_arms);
+    RUN_TEST(test_late_polls_do_not_drift);
+    RUN_TEST(test_a_stall_gives_one_pulse_and_restarts);
+    RUN_TEST(test_interval_zero_pulses_on_every_poll);
+    RUN_TEST(test_pulse_at_crosses_the_wrap);
+    RUN_TEST(test_every_crosses_the_millis_wrap);
+    RUN_TEST(test_every_micros_crosses_the_micros_wrap);
+    return UNITY_END();
+}